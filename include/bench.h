@@ -0,0 +1,8 @@
+void bench_fail(const char * const fmt, ...) __attribute__ ((format (printf, 1, 2)));
+
+int bench_rollout_policies(void);
+int bench_reachability(void);
+int bench_default_board(void);
+int bench_simd_rollouts(void);
+int bench_batch_rollouts(void);
+int bench_rollout_kernel(void);
@@ -1,13 +1,27 @@
 void test_fail(const char * const fmt, ...) __attribute__ ((format (printf, 1, 2)));
 
+/* Heap allocations counted by wrapped malloc, calloc and realloc */
+extern unsigned int qallocs;
+
 int test_multialloc(void);
 int test_parser(void);
 int test_std_geometry(void);
 int test_hockey_geometry(void);
+int test_geometry_tables(void);
+int test_symmetry(void);
+int test_reachability(void);
+int test_position(void);
 int test_step(void);
 int test_history(void);
 int test_random_ai(void);
 int test_rollout(void);
+int test_adjudication(void);
+int test_evaluation(void);
+int test_rollout_policies(void);
+int test_default_board(void);
+int test_simd_rollouts(void);
+int test_batch_rollouts(void);
+int test_zero_alloc_go(void);
 int test_node_cache(void);
 int test_mcts_history(void);
 int test_ucb_formula(void);
@@ -15,3 +29,12 @@ int test_simulation(void);
 int test_unstep(void);
 int test_random_ai_unstep(void);
 int test_mcts_ai_unstep(void);
+int test_ai_snapshot(void);
+int test_threads(void);
+int test_ai_stop(void);
+int test_ai_analyze(void);
+int test_ai_pv(void);
+int test_go_slices(void);
+int test_book(void);
+int test_tree_file(void);
+int test_memo(void);
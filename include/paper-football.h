@@ -35,6 +35,7 @@ enum step {
 #define INVALID_STEP QSTEPS
 
 #define BACK(step) ((enum step)((step+4) & 0x07))
+#define MIRROR(x) ((enum step)((10-(x)) & 0x07))
 
 typedef uint32_t steps_t;
 
@@ -57,10 +58,52 @@ static inline enum step extract_step(steps_t * mask)
 
 
 
+/* Variant of SIMD kernels, it is chosen at startup by CPU features */
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HAVE_SIMD_DISPATCH
+#endif
+
+enum simd_variant { SIMD_GENERIC = 0, SIMD_AVX2, SIMD_AVX512 };
+
+extern const char * const simd_names[];
+enum simd_variant simd_variant(void);
+
+
+
+#define UNREACHABLE   0xFF
+
+#define BORDER_SIDE     1
+#define BORDER_GOAL_1   2
+#define BORDER_GOAL_2   4
+
+/*
+ * Derived tables are indexed by point: goal_dists, goal_steps and
+ * closer_steps keep two values (for GOAL_1 and GOAL_2), coords keeps
+ * x and y, edges keeps an edge id for every step (-1 if there is no edge).
+ * Hash keys: step_keys has a key for every point and step (each edge is
+ * keyed only from one end), ball_keys has qpoints+3 keys: ball on a point,
+ * ball in GOAL_1, ball in GOAL_2 and active player 2.
+ * Reach masks are 128 bit bitboards (two words each) of points linked in
+ * NW, N, NE and E directions, points next to GOAL_1 and points next to
+ * GOAL_2, all zero for grids over 128 cells.
+ */
 struct geometry
 {
     uint32_t qpoints;
+    uint32_t qedges;
+    int width;
+    int height;
     const int32_t * connections;
+    const int16_t * coords;
+    const uint8_t * goal_dists;
+    const uint8_t * goal_steps;
+    const uint8_t * closer_steps;
+    const int32_t * edges;
+    const int32_t * mirrors;
+    const uint8_t * borders;
+    const uint64_t * step_keys;
+    const uint64_t * ball_keys;
+    const uint64_t * reach_masks;
 };
 
 struct geometry * create_std_geometry(
@@ -108,6 +151,78 @@ steps_t state_get_steps(const struct state * const me);
 int state_step(struct state * restrict const me, const enum step step);
 int state_unstep(struct state * restrict const me, const enum step step);
 
+/*
+ * Left-right mirror symmetry: canonical orientation is the one with the
+ * smaller hash, state_canonical returns 1 if dest is mirrored.
+ */
+uint64_t state_hash(const struct state * const me);
+uint64_t state_canonical_hash(const struct state * const me, int * restrict const mirrored);
+int state_is_symmetric(const struct state * const me);
+void state_mirror(struct state * restrict const dest, const struct state * const src);
+int state_canonical(struct state * restrict const dest, const struct state * const src);
+
+/*
+ * Position text is a single identifier "pf_<tag>_<active>_<ball>_<edges>":
+ * tag is a hex hash of the board, ball is a point index and edges is a hex
+ * bitmap of used lines, edge i is bit i%4 of digit i/4. Positions with the
+ * ball in a goal cannot be encoded.
+ */
+uint32_t geometry_tag(const struct geometry * const me);
+size_t position_text_sz(const struct geometry * const me);
+int state_encode(const struct state * const me, char * restrict const buf, const size_t sz);
+int state_decode(struct state * restrict const me, const char * const text, const size_t len);
+
+#define REACH_GOAL_1   1
+#define REACH_GOAL_2   2
+
+/*
+ * Flood fill over unused lines from the ball: returns a mask of reachable
+ * goals and fills reachable (if not NULL) with 0/1 for every point. Boards
+ * up to 128 cells use bitboards, larger ones allocate a temporary buffer when
+ * reachable is NULL (-1 is returned if allocation fails).
+ */
+int reachable_goals(
+    const struct geometry * const geometry,
+    const uint8_t * const lines,
+    const int ball,
+    uint8_t * restrict const reachable);
+int state_reachable_goals(const struct state * const me, uint8_t * restrict const reachable);
+
+
+/*
+ * Opening book: file is a header with the board tag and entries sorted by
+ * canonical position hash, steps are for the canonical orientation. Book is
+ * mapped read only in native byte order, so one copy is shared by every
+ * engine and thread. save_book sorts entries in place.
+ */
+struct book_entry
+{
+    uint64_t hash;
+    uint32_t step;
+    uint32_t qgames;
+};
+
+struct book
+{
+    uint32_t tag;
+    uint32_t qentries;
+    const struct book_entry * entries;
+    void * map;
+    size_t map_sz;
+};
+
+int save_book(
+    const char * const path,
+    const uint32_t tag,
+    struct book_entry * restrict const entries,
+    const uint32_t qentries);
+
+int open_book(struct book * restrict const me, const char * const path);
+void close_book(struct book * restrict const me);
+
+/* Returns INVALID_STEP if position is not in the book */
+enum step book_lookup(const struct book * const me, const struct state * const state);
+
 
 
 struct history
@@ -120,14 +235,54 @@ struct history
 void init_history(struct history * restrict const me);
 void free_history(struct history * restrict const me);
 int history_push(struct history * restrict const me, const enum step step);
+int history_copy(struct history * restrict const dest, const struct history * const src);
+
+/*
+ * Engine checkpoint: state and history copies, so restore costs a memcpy of
+ * the board and the steps instead of a reset and a replay of the game.
+ */
+struct ai_snapshot
+{
+    struct state * state;
+    struct history history;
+};
+
+struct ai_snapshot * create_ai_snapshot(const struct geometry * const geometry);
+void destroy_ai_snapshot(struct ai_snapshot * restrict const me);
+
+int ai_snapshot_save(
+    struct ai_snapshot * restrict const me,
+    const struct state * const state,
+    const struct history * const history);
+
+int ai_snapshot_load(
+    const struct ai_snapshot * const me,
+    struct state * restrict const state,
+    struct history * restrict const history);
 
 
 
 struct step_stat
 {
     enum step step;
-    int32_t qgames;
+    int64_t qgames;
+    double score;
+};
+
+#define MAX_PV_LEN   64
+
+/*
+ * Principal variation of one root turn: first qturn steps are the turn of
+ * the active player, the rest is the most visited line after it. Score and
+ * qgames are of the turn, score is for the active player as in step_stat.
+ */
+struct ai_variation
+{
+    int64_t qgames;
     double score;
+    unsigned int qturn;
+    unsigned int qsteps;
+    const enum step * steps;
 };
 
 struct ai_explanation
@@ -136,27 +291,42 @@ struct ai_explanation
     const struct step_stat * stats;
     double time;
     double score;
+    uint64_t qplayouts;
+    uint32_t qnodes;
+
+    /* Best root turns, the most visited goes first */
+    size_t qvariations;
+    const struct ai_variation * variations;
 };
 
+typedef void (*ai_report_func)(void * arg, const struct ai_explanation * explanation);
+
 enum param_type
 {
     NO_TYPE=0,
     I32,
     U32,
     F32,
+    ENUM,
+    U64,
     QPARAM_TYPES
 };
 
-extern size_t param_sizes[QPARAM_TYPES];
+/* U64 is for counters only, it has no size, so it cannot be set */
+extern const size_t param_sizes[QPARAM_TYPES];
 
+/* ENUM value is uint32_t index in NULL terminated names list */
 struct ai_param
 {
     const char * name;
     const void * value;
     enum param_type type;
     size_t offset;
+    const char * const * names;
 };
 
+int find_enum_value(const char * const * names, const char * const name, const size_t len);
+
 struct ai
 {
     void * data;
@@ -179,10 +349,76 @@ struct ai
     int (*undo_step)(struct ai * restrict const ai);
     int (*undo_steps)(struct ai * restrict const ai, const unsigned int qsteps);
 
+    int (*snapshot)(
+        const struct ai * const ai,
+        struct ai_snapshot * restrict const snapshot);
+
+    int (*restore)(
+        struct ai * restrict const ai,
+        const struct ai_snapshot * const snapshot);
+
+    /* Install position directly, history is cleared */
+    int (*set_state)(
+        struct ai * restrict const ai,
+        const struct state * const state);
+
     enum step (*go)(
         struct ai * restrict const ai,
         struct ai_explanation * restrict const explanation);
 
+    /*
+     * May be called from another thread: while the flag is set, go returns
+     * the best step found so far as soon as possible. Flag is kept until
+     * cleared, so all steps of a move are played fast after the stop.
+     */
+    void (*stop)(struct ai * restrict const ai, const int is_stopped);
+
+    /*
+     * Book is consulted by go before search (not by analyze), book of other
+     * board is ignored. Book is not owned, NULL turns it off.
+     */
+    void (*set_book)(struct ai * restrict const ai, const struct book * const book);
+
+    /*
+     * Search tree of the last search in the current position is saved with
+     * the board tag and the position. Loaded tree must be for the current
+     * position, the next go or analyze continues it instead of a new search.
+     * Return 0 or error code, ENOTSUP if AI has no tree.
+     */
+    int (*save_tree)(struct ai * restrict const ai, const char * const path);
+    int (*load_tree)(struct ai * restrict const ai, const char * const path);
+
+    /*
+     * Search in slices, go is the same as go_begin, go_continue without
+     * limit and go_end. go_continue thinks about budget steps and returns
+     * nonzero when search is completed (thinking limit, stop or forced
+     * step). go_peek returns the current best step, go_end returns the
+     * chosen step and finishes the search. A step, a new position or a
+     * new cache between go_begin and go_end cancels the search, go_end
+     * fails then.
+     */
+    int (*go_begin)(struct ai * restrict const ai);
+    int (*go_continue)(struct ai * restrict const ai, const uint32_t budget);
+
+    enum step (*go_peek)(
+        struct ai * restrict const ai,
+        struct ai_explanation * restrict const explanation);
+
+    enum step (*go_end)(
+        struct ai * restrict const ai,
+        struct ai_explanation * restrict const explanation);
+
+    /*
+     * Search without budget until stop, report is called every interval
+     * seconds and once at the end with the tree statistics, the best step
+     * goes first. Returns the best step, state is not changed.
+     */
+    enum step (*analyze)(
+        struct ai * restrict const ai,
+        const double interval,
+        ai_report_func report,
+        void * const arg);
+
     const struct ai_param * (*get_params)(const struct ai * const ai);
 
     int (*set_param)(
@@ -192,6 +428,8 @@ struct ai
 
     const struct state * (*get_state)(const struct ai * const ai);
 
+    const struct ai_param * (*get_stats)(const struct ai * const ai);
+
     void (*free)(struct ai * restrict const ai);
 };
 
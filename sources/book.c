@@ -0,0 +1,324 @@
+#include "paper-football.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char book_magic[8] = { 'p', 'f', 'b', 'o', 'o', 'k', '0', '1' };
+
+/* File header, entries follow it */
+struct book_header
+{
+    char magic[8];
+    uint32_t tag;
+    uint32_t qentries;
+};
+
+static int cmp_entries(const void * const a, const void * const b)
+{
+    const struct book_entry * const ea = a;
+    const struct book_entry * const eb = b;
+    if (ea->hash < eb->hash) return -1;
+    if (ea->hash > eb->hash) return +1;
+    if (ea->qgames > eb->qgames) return -1;
+    if (ea->qgames < eb->qgames) return +1;
+    return 0;
+}
+
+int save_book(
+    const char * const path,
+    const uint32_t tag,
+    struct book_entry * restrict const entries,
+    const uint32_t qentries)
+{
+    /* Entries are sorted in place, only the most searched of equal positions is kept */
+    qsort(entries, qentries, sizeof(struct book_entry), cmp_entries);
+
+    uint32_t qunique = 0;
+    for (uint32_t i=0; i<qentries; ++i) {
+        if (qunique == 0 || entries[qunique-1].hash != entries[i].hash) {
+            entries[qunique++] = entries[i];
+        }
+    }
+
+    struct book_header header;
+    memcpy(header.magic, book_magic, sizeof(book_magic));
+    header.tag = tag;
+    header.qentries = qunique;
+
+    FILE * const file = fopen(path, "wb");
+    if (file == NULL) {
+        return errno;
+    }
+
+    const int is_written = 1
+        && fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(entries, sizeof(struct book_entry), qunique, file) == qunique;
+    const int status = is_written ? 0 : errno ? errno : EIO;
+
+    if (fclose(file) != 0) {
+        return status ? status : errno;
+    }
+
+    return status;
+}
+
+int open_book(
+    struct book * restrict const me,
+    const char * const path)
+{
+    const int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return errno;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        const int status = errno;
+        close(fd);
+        return status;
+    }
+
+    const size_t map_sz = st.st_size;
+    if (map_sz < sizeof(struct book_header)) {
+        close(fd);
+        return EINVAL;
+    }
+
+    /* Pages are shared by every engine and process which uses the book */
+    void * const map = mmap(NULL, map_sz, PROT_READ, MAP_SHARED, fd, 0);
+    const int map_status = map == MAP_FAILED ? errno : 0;
+    close(fd);
+    if (map_status != 0) {
+        return map_status;
+    }
+
+    const struct book_header * const header = map;
+    const size_t entries_sz = (size_t)header->qentries * sizeof(struct book_entry);
+    if (memcmp(header->magic, book_magic, sizeof(book_magic)) != 0 || map_sz != sizeof(struct book_header) + entries_sz) {
+        munmap(map, map_sz);
+        return EINVAL;
+    }
+
+    me->tag = header->tag;
+    me->qentries = header->qentries;
+    me->entries = (const struct book_entry *)(header + 1);
+    me->map = map;
+    me->map_sz = map_sz;
+    return 0;
+}
+
+void close_book(struct book * restrict const me)
+{
+    if (me->map != NULL) {
+        munmap(me->map, me->map_sz);
+    }
+
+    me->qentries = 0;
+    me->entries = NULL;
+    me->map = NULL;
+    me->map_sz = 0;
+}
+
+enum step book_lookup(
+    const struct book * const me,
+    const struct state * const state)
+{
+    int mirrored;
+    const uint64_t hash = state_canonical_hash(state, &mirrored);
+
+    uint32_t lo = 0;
+    uint32_t hi = me->qentries;
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        const uint64_t mid_hash = me->entries[mid].hash;
+        if (mid_hash < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == me->qentries || me->entries[lo].hash != hash) {
+        return INVALID_STEP;
+    }
+
+    const uint32_t step = me->entries[lo].step;
+    if (step >= QSTEPS) {
+        return INVALID_STEP;
+    }
+
+    return mirrored ? MIRROR(step) : (enum step)step;
+}
+
+
+
+#ifdef MAKE_CHECK
+
+#include "insider.h"
+
+static enum step test_book_go(
+    struct ai * restrict const ai,
+    struct ai_explanation * restrict const explanation)
+{
+    const enum step step = ai->go(ai, explanation);
+    if (step == INVALID_STEP) {
+        test_fail("ai->go fails: %s", ai->error);
+    }
+    return step;
+}
+
+int test_book(void)
+{
+    struct geometry * restrict const geometry = create_std_geometry(9, 11, 2);
+    if (geometry == NULL) {
+        test_fail("create_std_geometry(9, 11, 2) fails.");
+    }
+
+    struct state * restrict const start = create_state(geometry);
+    struct state * restrict const east = create_state(geometry);
+    struct state * restrict const west = create_state(geometry);
+    if (start == NULL || east == NULL || west == NULL) {
+        test_fail("create_state fails.");
+    }
+
+    /* After NE and NW positions are mirrored, one entry answers both */
+    state_step(east, NORTH_EAST);
+    state_step(west, NORTH_WEST);
+
+    int mirrored;
+    struct book_entry entries[3];
+    entries[0].hash = state_canonical_hash(start, NULL);
+    entries[0].step = SOUTH;
+    entries[0].qgames = 100;
+    entries[1].hash = state_canonical_hash(east, &mirrored);
+    entries[1].step = mirrored ? MIRROR(EAST) : EAST;
+    entries[1].qgames = 50;
+    entries[2] = entries[0];
+    entries[2].step = NORTH;
+    entries[2].qgames = 10;
+
+    char path[] = "/tmp/pf-book-XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd == -1) {
+        test_fail("mkstemp fails, errno %d.", errno);
+    }
+    close(fd);
+
+    const uint32_t tag = geometry_tag(geometry);
+    int status = save_book(path, tag, entries, 3);
+    if (status != 0) {
+        test_fail("save_book fails with code %d.", status);
+    }
+
+    struct book book;
+    status = open_book(&book, path);
+    if (status != 0) {
+        test_fail("open_book fails with code %d.", status);
+    }
+
+    if (book.qentries != 2 || book.tag != tag) {
+        test_fail("book has %u entries and tag %08x, 2 and %08x expected.", book.qentries, book.tag, tag);
+    }
+
+    if (book.entries[0].hash >= book.entries[1].hash) {
+        test_fail("book entries are not sorted.");
+    }
+
+    enum step step = book_lookup(&book, start);
+    if (step != SOUTH) {
+        test_fail("start position: book step is %d, S (%d) with the most games expected.", step, SOUTH);
+    }
+
+    step = book_lookup(&book, east);
+    if (step != EAST) {
+        test_fail("position after NE: book step is %d, E (%d) expected.", step, EAST);
+    }
+
+    step = book_lookup(&book, west);
+    if (step != WEST) {
+        test_fail("position after NW: book step is %d, mirrored W (%d) expected.", step, WEST);
+    }
+
+    state_step(east, EAST);
+    step = book_lookup(&book, east);
+    if (step != INVALID_STEP) {
+        test_fail("unknown position: book step is %d, INVALID_STEP expected.", step);
+    }
+
+    /* Engine answers from the book without thinking */
+    struct ai ai;
+    status = init_mcts_ai(&ai, geometry);
+    if (status != 0) {
+        test_fail("init_mcts_ai fails with code %d.", status);
+    }
+
+    ai.set_book(&ai, &book);
+
+    struct ai_explanation explanation;
+    step = test_book_go(&ai, &explanation);
+    if (step != SOUTH) {
+        test_fail("mcts with book: step is %d, book step S (%d) expected.", step, SOUTH);
+    }
+
+    if (explanation.qplayouts != 0) {
+        test_fail("mcts with book: %llu playouts, book hit should not search.", (unsigned long long)explanation.qplayouts);
+    }
+
+    status = ai.do_step(&ai, NORTH_WEST);
+    if (status != 0) {
+        test_fail("ai.do_step(NW) fails with code %d.", status);
+    }
+
+    step = test_book_go(&ai, NULL);
+    if (step != WEST) {
+        test_fail("mcts with book after NW: step is %d, W (%d) expected.", step, WEST);
+    }
+
+    /* Book of another board is ignored */
+    struct geometry * restrict const other = create_std_geometry(7, 9, 2);
+    if (other == NULL) {
+        test_fail("create_std_geometry(7, 9, 2) fails.");
+    }
+
+    status = ai.reset(&ai, other);
+    if (status != 0) {
+        test_fail("ai.reset fails with code %d.", status);
+    }
+
+    const uint32_t qthink = 2000;
+    status = ai.set_param(&ai, "qthink", &qthink);
+    if (status != 0) {
+        test_fail("set qthink fails with code %d.", status);
+    }
+
+    test_book_go(&ai, &explanation);
+    if (explanation.qplayouts == 0) {
+        test_fail("mcts with book of another board: no playouts, search expected.");
+    }
+
+    ai.free(&ai);
+    destroy_geometry(other);
+    close_book(&book);
+
+    /* Truncated file is rejected */
+    if (truncate(path, sizeof(struct book_header) + 1) != 0) {
+        test_fail("truncate fails, errno %d.", errno);
+    }
+
+    status = open_book(&book, path);
+    if (status != EINVAL) {
+        test_fail("truncated book: open_book returns %d, EINVAL expected.", status);
+    }
+
+    unlink(path);
+    destroy_state(start);
+    destroy_state(east);
+    destroy_state(west);
+    destroy_geometry(geometry);
+    return 0;
+}
+
+#endif
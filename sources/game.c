@@ -1,11 +1,61 @@
 #include "paper-football.h"
 
-size_t param_sizes[QPARAM_TYPES] = {
+#include <stdio.h>
+
+#if defined(HAVE_SIMD_DISPATCH)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+const char * const simd_names[] = { "generic", "avx2", "avx512", NULL };
+
+static enum simd_variant cpu_simd = SIMD_GENERIC;
+
+/* CPU features are checked once at startup, before any thread is created */
+__attribute__ ((constructor))
+static void init_cpu_simd(void)
+{
+#ifdef HAVE_SIMD_DISPATCH
+    __builtin_cpu_init();
+    const int has_avx2 = __builtin_cpu_supports("avx2")
+        && __builtin_cpu_supports("bmi2")
+        && __builtin_cpu_supports("popcnt");
+    const int has_avx512 = has_avx2
+        && __builtin_cpu_supports("avx512f")
+        && __builtin_cpu_supports("avx512bw");
+    cpu_simd = has_avx512 ? SIMD_AVX512 : has_avx2 ? SIMD_AVX2 : SIMD_GENERIC;
+#endif
+}
+
+enum simd_variant simd_variant(void)
+{
+    return cpu_simd;
+}
+
+const size_t param_sizes[QPARAM_TYPES] = {
     [U32] = sizeof(uint32_t),
     [I32] = sizeof(int32_t),
     [F32] = sizeof(float),
+    [ENUM] = sizeof(uint32_t),
 };
 
+int find_enum_value(const char * const * names, const char * const name, const size_t len)
+{
+    for (int i=0; names[i] != NULL; ++i) {
+        const int match = 1
+            && strlen(names[i]) == len
+            && strncasecmp(names[i], name, len) == 0
+        ;
+
+        if (match) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
 static inline int check_dim(const int value)
 {
     if (value <= 4) {
@@ -73,6 +123,298 @@ static inline int goal_status(const int width, const int height, const int goal_
     return y2 != -1 ? GOAL_1 : GOAL_2;
 }
 
+struct geometry_tables
+{
+    int32_t * connections;
+    int16_t * coords;
+    uint8_t * goal_dists;
+    uint8_t * goal_steps;
+    uint8_t * closer_steps;
+    int32_t * edges;
+    int32_t * mirrors;
+    uint8_t * borders;
+    uint64_t * step_keys;
+    uint64_t * ball_keys;
+    uint64_t * reach_masks;
+};
+
+static struct geometry * alloc_geometry(
+    const uint32_t width,
+    const uint32_t height,
+    const uint32_t qpoints,
+    struct geometry_tables * restrict const tables)
+{
+    const size_t sizes[12] = {
+        sizeof(struct geometry),
+        qpoints * QSTEPS * sizeof(int32_t),
+        2 * qpoints * sizeof(int16_t),
+        2 * qpoints,
+        2 * qpoints,
+        2 * qpoints,
+        qpoints * QSTEPS * sizeof(int32_t),
+        qpoints * sizeof(int32_t),
+        qpoints,
+        qpoints * QSTEPS * sizeof(uint64_t),
+        (qpoints + 3) * sizeof(uint64_t),
+        12 * sizeof(uint64_t)
+    };
+
+    void * ptrs[12];
+    void * data = multialloc(12, sizes, ptrs, 256);
+
+    if (data == NULL) {
+        return NULL;
+    }
+
+    tables->connections = ptrs[1];
+    tables->coords = ptrs[2];
+    tables->goal_dists = ptrs[3];
+    tables->goal_steps = ptrs[4];
+    tables->closer_steps = ptrs[5];
+    tables->edges = ptrs[6];
+    tables->mirrors = ptrs[7];
+    tables->borders = ptrs[8];
+    tables->step_keys = ptrs[9];
+    tables->ball_keys = ptrs[10];
+    tables->reach_masks = ptrs[11];
+
+    struct geometry * restrict const me = data;
+    me->qpoints = qpoints;
+    me->qedges = 0;
+    me->width = width;
+    me->height = height;
+    me->connections = tables->connections;
+    me->coords = tables->coords;
+    me->goal_dists = tables->goal_dists;
+    me->goal_steps = tables->goal_steps;
+    me->closer_steps = tables->closer_steps;
+    me->edges = tables->edges;
+    me->mirrors = tables->mirrors;
+    me->borders = tables->borders;
+    me->step_keys = tables->step_keys;
+    me->ball_keys = tables->ball_keys;
+    me->reach_masks = tables->reach_masks;
+    return me;
+}
+
+static void init_goal_steps(
+    const struct geometry * const me,
+    uint8_t * restrict const goal_steps)
+{
+    const int32_t * const connections = me->connections;
+    const uint32_t qpoints = me->qpoints;
+
+    for (uint32_t point = 0; point < qpoints; ++point) {
+        uint8_t goal1 = 0;
+        uint8_t goal2 = 0;
+        for (enum step step=0; step<QSTEPS; ++step) {
+            const int32_t next = connections[QSTEPS*point + step];
+            goal1 |= (next == GOAL_1) << step;
+            goal2 |= (next == GOAL_2) << step;
+        }
+        goal_steps[2*point + 0] = goal1;
+        goal_steps[2*point + 1] = goal2;
+    }
+}
+
+/* Backward BFS from goals, lines are ignored, so it is the lower bound */
+static void init_goal_dists(
+    const struct geometry * const me,
+    uint8_t * restrict const goal_dists,
+    int32_t * restrict const queue)
+{
+    const int32_t * const connections = me->connections;
+    const uint8_t * const goal_steps = me->goal_steps;
+    const uint32_t qpoints = me->qpoints;
+
+    for (int goal=0; goal<2; ++goal) {
+        uint32_t qqueue = 0;
+        for (uint32_t point = 0; point < qpoints; ++point) {
+            const int is_near = goal_steps[2*point + goal] != 0;
+            goal_dists[2*point + goal] = is_near ? 1 : UNREACHABLE;
+            if (is_near) {
+                queue[qqueue++] = point;
+            }
+        }
+
+        for (uint32_t i=0; i<qqueue; ++i) {
+            const int32_t point = queue[i];
+            const uint8_t dist = goal_dists[2*point + goal];
+            for (enum step step=0; step<QSTEPS; ++step) {
+                const int32_t prev = connections[QSTEPS*point + step];
+                if (prev < 0 || goal_dists[2*prev + goal] != UNREACHABLE) {
+                    continue;
+                }
+                goal_dists[2*prev + goal] = dist < UNREACHABLE - 1 ? dist + 1 : dist;
+                queue[qqueue++] = prev;
+            }
+        }
+    }
+}
+
+static void init_closer_steps(
+    const struct geometry * const me,
+    uint8_t * restrict const closer_steps)
+{
+    const int32_t * const connections = me->connections;
+    const uint8_t * const goal_dists = me->goal_dists;
+    const uint8_t * const goal_steps = me->goal_steps;
+    const uint32_t qpoints = me->qpoints;
+
+    for (uint32_t point = 0; point < qpoints; ++point)
+    for (int goal=0; goal<2; ++goal) {
+        const uint8_t dist = goal_dists[2*point + goal];
+        uint8_t mask = goal_steps[2*point + goal];
+        for (enum step step=0; step<QSTEPS; ++step) {
+            const int32_t next = connections[QSTEPS*point + step];
+            const int is_closer = next >= 0 && goal_dists[2*next + goal] < dist;
+            mask |= is_closer << step;
+        }
+        closer_steps[2*point + goal] = mask;
+    }
+}
+
+static uint32_t init_edges(
+    const struct geometry * const me,
+    int32_t * restrict const edges)
+{
+    const int32_t * const connections = me->connections;
+    const uint32_t qpoints = me->qpoints;
+
+    uint32_t qedges = 0;
+    for (uint32_t point = 0; point < qpoints; ++point)
+    for (enum step step=0; step<QSTEPS; ++step) {
+        const int32_t next = connections[QSTEPS*point + step];
+        if (next < 0) {
+            edges[QSTEPS*point + step] = -1;
+            continue;
+        }
+
+        if (next < point) {
+            edges[QSTEPS*point + step] = edges[QSTEPS*next + BACK(step)];
+            continue;
+        }
+
+        edges[QSTEPS*point + step] = qedges++;
+    }
+
+    return qedges;
+}
+
+static void init_borders(
+    const struct geometry * const me,
+    uint8_t * restrict const borders)
+{
+    const int32_t * const connections = me->connections;
+    const uint8_t * const goal_steps = me->goal_steps;
+    const uint32_t qpoints = me->qpoints;
+
+    for (uint32_t point = 0; point < qpoints; ++point) {
+        uint8_t flags = 0;
+        for (enum step step=0; step<QSTEPS; ++step) {
+            if (connections[QSTEPS*point + step] == NO_WAY) {
+                flags |= BORDER_SIDE;
+            }
+        }
+        flags |= goal_steps[2*point + 0] ? BORDER_GOAL_1 : 0;
+        flags |= goal_steps[2*point + 1] ? BORDER_GOAL_2 : 0;
+        borders[point] = flags;
+    }
+}
+
+#define SPLITMIX64_GAMMA   0x9E3779B97F4A7C15ull
+
+static inline uint64_t splitmix64(uint64_t * restrict const seed)
+{
+    uint64_t z = (*seed += SPLITMIX64_GAMMA);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+/* Keys are the same from run to run, so hashes may be stored in files */
+static void init_keys(
+    const struct geometry * const me,
+    uint64_t * restrict const step_keys,
+    uint64_t * restrict const ball_keys)
+{
+    const int32_t * const connections = me->connections;
+    const int32_t * const edges = me->edges;
+    const uint32_t qpoints = me->qpoints;
+
+    /* Key of edge i is output i of the sequence, the seed is stepped to it */
+    const uint64_t start = 0x5041504552464F4Full;
+    for (uint32_t point = 0; point < qpoints; ++point)
+    for (enum step step=0; step<QSTEPS; ++step) {
+        const int32_t next = connections[QSTEPS*point + step];
+        uint64_t edge_seed = start + (uint64_t)edges[QSTEPS*point + step] * SPLITMIX64_GAMMA;
+        step_keys[QSTEPS*point + step] = next > (int32_t)point ? splitmix64(&edge_seed) : 0;
+    }
+
+    uint64_t seed = start + (uint64_t)me->qedges * SPLITMIX64_GAMMA;
+    for (uint32_t i=0; i<qpoints+3; ++i) {
+        ball_keys[i] = splitmix64(&seed);
+    }
+}
+
+/*
+ * Points with a line to other point in NW, N, NE and E directions, points
+ * next to GOAL_1 and GOAL_2 as 128 bit bitboards, bit index is y*width + x.
+ */
+static void init_reach_masks(
+    const struct geometry * const me,
+    uint64_t * restrict const masks)
+{
+    memset(masks, 0, 12 * sizeof(uint64_t));
+    if (me->width * me->height > 128) {
+        return;
+    }
+
+    const uint32_t qpoints = me->qpoints;
+    for (uint32_t point = 0; point < qpoints; ++point) {
+        const int bit = me->coords[2*point + 1] * me->width + me->coords[2*point + 0];
+        const uint64_t mask = (uint64_t)1 << (bit % 64);
+        const int word = bit / 64;
+        for (enum step step = NORTH_WEST; step <= EAST; ++step) {
+            const int32_t next = me->connections[QSTEPS*point + step];
+            masks[2*step + word] |= next >= 0 ? mask : 0;
+        }
+        masks[8 + word] |= me->goal_steps[2*point + 0] ? mask : 0;
+        masks[10 + word] |= me->goal_steps[2*point + 1] ? mask : 0;
+    }
+}
+
+/*
+ * Fill all derived tables when connections are ready, coords should be set
+ * before. Cells maps grid cells to points for mirroring, it is NULL when
+ * every cell is a point.
+ */
+static void init_tables(
+    struct geometry * restrict const me,
+    const struct geometry_tables * const tables,
+    const int32_t * const cells)
+{
+    const uint32_t qpoints = me->qpoints;
+    const int width = me->width;
+    const int16_t * const coords = tables->coords;
+
+    for (uint32_t point = 0; point < qpoints; ++point) {
+        const int x = coords[2*point + 0];
+        const int y = coords[2*point + 1];
+        const int32_t cell = y * width + (width - 1 - x);
+        tables->mirrors[point] = cells ? cells[cell] : cell;
+    }
+
+    init_goal_steps(me, tables->goal_steps);
+    /* Edges are not ready yet, so their table is the BFS queue */
+    init_goal_dists(me, tables->goal_dists, tables->edges);
+    init_closer_steps(me, tables->closer_steps);
+    me->qedges = init_edges(me, tables->edges);
+    init_borders(me, tables->borders);
+    init_keys(me, tables->step_keys, tables->ball_keys);
+    init_reach_masks(me, tables->reach_masks);
+}
+
 struct geometry * create_std_geometry(const int width, const int height, const int goal_width)
 {
     const int status = check_std_arg(width, height, goal_width);
@@ -80,23 +422,22 @@ struct geometry * create_std_geometry(const int width, const int height, const i
         return NULL;
     }
 
-    const uint32_t qpoints = (uint32_t)(width) * (uint32_t)(height);
-    const size_t board_map_sz = qpoints * QSTEPS * sizeof(uint32_t);
-    const size_t sizes[2] = { sizeof(struct geometry), board_map_sz };
-    void * ptrs[2];
-    void * data = multialloc(2, sizes, ptrs, 256);
-
-    if (data == NULL) {
+    struct geometry_tables tables;
+    struct geometry * restrict const me = alloc_geometry(width, height, width * height, &tables);
+    if (me == NULL) {
         return NULL;
     }
 
-    struct geometry * restrict const me = data;
+    for (int point = 0; point < width * height; ++point) {
+        tables.coords[2*point + 0] = point % width;
+        tables.coords[2*point + 1] = point / width;
+    }
 
     static const int delta_x[QSTEPS] = { -1,  0, +1, +1, +1,  0, -1, -1 };
     static const int delta_y[QSTEPS] = { +1, +1, +1,  0, -1, -1, -1,  0 };
     int steps[QSTEPS] = { width-1, width, width+1, 1, -width+1, -width, -width-1, -1 };
 
-    int32_t * restrict ptr = ptrs[1];
+    int32_t * restrict ptr = tables.connections;
     for (int32_t offset = 0; offset < width*height; ++offset) {
         for (enum step step=0; step<QSTEPS; ++step)
         {
@@ -116,8 +457,7 @@ struct geometry * create_std_geometry(const int width, const int height, const i
         }
     }
 
-    me->qpoints = qpoints;
-    me->connections = ptrs[1];
+    init_tables(me, &tables, NULL);
     return me;
 }
 
@@ -188,19 +528,13 @@ struct geometry * create_hockey_geometry(
 
     const uint32_t H = (uint32_t)height + 2 * (uint32_t)depth;
     const uint32_t W = (uint32_t)width;
-    const uint32_t qpoints = H * W;
-    const size_t board_map_sz = qpoints * QSTEPS * sizeof(uint32_t);
-    const size_t sizes[2] = { sizeof(struct geometry), board_map_sz };
-    void * ptrs[2];
-    void * data = multialloc(2, sizes, ptrs, 256);
 
-    if (data == NULL) {
+    /* Connections are built on the full grid first, then dead cells are dropped */
+    int32_t * const connections = malloc(W * H * QSTEPS * sizeof(int32_t));
+    if (connections == NULL) {
         return NULL;
     }
 
-    struct geometry * restrict const me = data;
-    int32_t * const connections = ptrs[1];
-
     { /* Everything is possible */
 
         static const int delta_x[QSTEPS] = { -1,  0, +1, +1, +1,  0, -1, -1 };
@@ -359,8 +693,59 @@ struct geometry * create_hockey_geometry(
         }
     }
 
-    me->qpoints = qpoints;
-    me->connections = connections;
+    { /* No one way steps (for example into cut off corners) */
+        for (uint32_t point = 0; point < W*H; ++point)
+        for (enum step step=0; step<QSTEPS; ++step) {
+            const int32_t next = connections[QSTEPS*point + step];
+            if (next >= 0 && connections[QSTEPS*next + BACK(step)] == NO_WAY) {
+                connections[QSTEPS*point + step] = NO_WAY;
+            }
+        }
+    }
+
+    int32_t * const dense = malloc(W * H * sizeof(int32_t));
+    if (dense == NULL) {
+        free(connections);
+        return NULL;
+    }
+
+    uint32_t qpoints = 0;
+
+    { /* Dense index over cells with at least one step */
+        for (uint32_t cell = 0; cell < W*H; ++cell) {
+            int is_live = 0;
+            for (enum step step=0; step<QSTEPS; ++step) {
+                is_live |= connections[QSTEPS*cell + step] != NO_WAY;
+            }
+            dense[cell] = is_live ? qpoints++ : NO_WAY;
+        }
+    }
+
+    struct geometry_tables tables;
+    struct geometry * restrict const me = alloc_geometry(W, H, qpoints, &tables);
+    if (me == NULL) {
+        free(dense);
+        free(connections);
+        return NULL;
+    }
+
+    for (uint32_t cell = 0; cell < W*H; ++cell) {
+        const int32_t point = dense[cell];
+        if (point == NO_WAY) {
+            continue;
+        }
+
+        tables.coords[2*point + 0] = cell % W;
+        tables.coords[2*point + 1] = cell / W;
+        for (enum step step=0; step<QSTEPS; ++step) {
+            const int32_t next = connections[QSTEPS*cell + step];
+            tables.connections[QSTEPS*point + step] = next >= 0 ? dense[next] : next;
+        }
+    }
+
+    free(connections);
+    init_tables(me, &tables, dense);
+    free(dense);
     return me;
 }
 
@@ -502,125 +887,782 @@ int state_step(struct state * restrict const me, const enum step step)
     return next;
 }
 
-int state_unstep(struct state * restrict const me, const enum step step)
+static inline uint8_t mirror_mask(const uint8_t mask)
 {
-    const int ball = me->ball;
-    if (ball < 0) {
-        me->ball = me->ball_before_goal;
-        me->ball_before_goal = NO_WAY;
-        return me->ball;
+    uint8_t result = 0;
+    for (enum step step=0; step<QSTEPS; ++step) {
+        result |= ((mask >> step) & 1) << MIRROR(step);
     }
+    return result;
+}
 
-    const enum step back = BACK(step);
-    const int32_t * const connections = me->geometry->connections;
-    const int prev = connections[QSTEPS*ball + back];
-    if (prev < 0) {
-        return NO_WAY;
+static inline uint32_t ball_key_index(const struct geometry * const geometry, const int ball)
+{
+    if (ball >= 0) {
+        return ball;
     }
+    return ball == GOAL_1 ? geometry->qpoints : geometry->qpoints + 1;
+}
 
-    uint8_t * restrict const lines = me->lines;
-    const uint8_t ball_lines = lines[ball];
-    const uint8_t prev_lines = lines[prev];
+static inline int mirror_point(const struct geometry * const geometry, const int point)
+{
+    return point >= 0 ? geometry->mirrors[point] : point;
+}
 
-    const uint8_t back_mask = 1 << back;
-    const int ball_lines_ok = ball_lines & back_mask;
-    if (!ball_lines_ok) {
-        return NO_WAY;
-    }
+/* Calculate hash and hash of the mirrored state in one pass */
+static void calc_hashes(
+    const struct state * const me,
+    uint64_t * restrict const hash,
+    uint64_t * restrict const mirror_hash)
+{
+    const struct geometry * const geometry = me->geometry;
+    const uint64_t * const step_keys = geometry->step_keys;
+    const uint64_t * const ball_keys = geometry->ball_keys;
+    const int32_t * const mirrors = geometry->mirrors;
+    const uint8_t * const lines = me->lines;
+    const uint32_t qpoints = geometry->qpoints;
 
-    const uint8_t step_mask = 1 << step;
-    const int prev_lines_ok = prev_lines & step_mask;
-    if (!prev_lines_ok) {
-        return NO_WAY;
+    uint64_t direct = 0;
+    uint64_t mirror = 0;
+    for (uint32_t point = 0; point < qpoints; ++point) {
+        steps_t used = lines[point];
+        const uint64_t * const keys = step_keys + QSTEPS * point;
+        const uint64_t * const mirror_keys = step_keys + QSTEPS * mirrors[point];
+        while (used != 0) {
+            const enum step step = extract_step(&used);
+            direct ^= keys[step];
+            mirror ^= mirror_keys[MIRROR(step)];
+        }
     }
 
-    lines[ball] ^= back_mask;
-    lines[prev] ^= step_mask;
-    me->ball = prev;
+    const int ball = me->ball;
+    direct ^= ball_keys[ball_key_index(geometry, ball)];
+    mirror ^= ball_keys[ball_key_index(geometry, mirror_point(geometry, ball))];
 
-    if (lines[ball] == 0) {
-        me->active ^= 3;
+    if (me->active == 2) {
+        direct ^= ball_keys[qpoints + 2];
+        mirror ^= ball_keys[qpoints + 2];
     }
 
-    return prev;
+    *hash = direct;
+    *mirror_hash = mirror;
 }
 
+uint64_t state_hash(const struct state * const me)
+{
+    uint64_t hash, mirror_hash;
+    calc_hashes(me, &hash, &mirror_hash);
+    return hash;
+}
 
+uint64_t state_canonical_hash(const struct state * const me, int * restrict const mirrored)
+{
+    uint64_t hash, mirror_hash;
+    calc_hashes(me, &hash, &mirror_hash);
 
-static int set_capacity(
-    struct history * restrict const me,
-    const unsigned int capacity)
+    const int is_mirrored = mirror_hash < hash;
+    if (mirrored) {
+        *mirrored = is_mirrored;
+    }
+    return is_mirrored ? mirror_hash : hash;
+}
+
+int state_is_symmetric(const struct state * const me)
 {
-    void * new_steps = realloc(me->steps, capacity * sizeof(enum step));
-    if (new_steps == NULL) {
-        return ENOMEM;
+    const struct geometry * const geometry = me->geometry;
+    if (mirror_point(geometry, me->ball) != me->ball) {
+        return 0;
     }
 
-    me->capacity = capacity;
-    me->steps = new_steps;
-    return 0;
+    const int32_t * const mirrors = geometry->mirrors;
+    const uint8_t * const lines = me->lines;
+    const uint32_t qpoints = geometry->qpoints;
+    for (uint32_t point = 0; point < qpoints; ++point) {
+        if (lines[mirrors[point]] != mirror_mask(lines[point])) {
+            return 0;
+        }
+    }
+
+    return 1;
 }
 
-void init_history(struct history * restrict const me)
+void state_mirror(struct state * restrict const dest, const struct state * const src)
 {
-    me->qsteps = 0;
-    me->capacity = 0;
-    me->steps = NULL;
+    const struct geometry * const geometry = src->geometry;
+    const int32_t * const mirrors = geometry->mirrors;
+    const uint32_t qpoints = geometry->qpoints;
+
+    for (uint32_t point = 0; point < qpoints; ++point) {
+        dest->lines[mirrors[point]] = mirror_mask(src->lines[point]);
+    }
+
+    dest->active = src->active;
+    dest->ball = mirror_point(geometry, src->ball);
+    dest->ball_before_goal = mirror_point(geometry, src->ball_before_goal);
 }
 
-void free_history(struct history * restrict const me)
+int state_canonical(struct state * restrict const dest, const struct state * const src)
 {
-    if (me->steps != NULL) {
-        free(me->steps);
+    int mirrored;
+    state_canonical_hash(src, &mirrored);
+
+    if (mirrored) {
+        state_mirror(dest, src);
+    } else {
+        state_copy(dest, src);
+        dest->ball_before_goal = src->ball_before_goal;
     }
+
+    return mirrored;
 }
 
-int history_push(struct history * restrict const me, const enum step step)
+/* Position text */
+
+uint32_t geometry_tag(const struct geometry * const me)
 {
-    if (me->qsteps == me->capacity) {
-        const int status = set_capacity(me, 2 * me->capacity + 128);
-        if (status != 0) {
-            return status;
+    /* FNV-1a over board size and connections */
+    uint32_t hash = 2166136261u;
+    const int32_t head[2] = { me->width, me->height };
+    const int32_t * ptrs[2] = { head, me->connections };
+    const uint32_t lens[2] = { 2, QSTEPS * me->qpoints };
+    for (int i=0; i<2; ++i)
+    for (uint32_t j=0; j<lens[i]; ++j) {
+        const uint32_t value = ptrs[i][j];
+        for (int k=0; k<4; ++k) {
+            hash ^= (value >> (8*k)) & 0xFF;
+            hash *= 16777619u;
         }
     }
 
-    me->steps[me->qsteps++] = step;
-    return 0;
+    return hash;
 }
 
+size_t position_text_sz(const struct geometry * const me)
+{
+    /* "pf_" + tag + "_" + active + "_" + ball + "_" + edges + "\0" */
+    return 3 + 8 + 1 + 1 + 1 + 10 + 1 + (me->qedges + 3) / 4 + 1;
+}
 
+static const char hex_digits[16] = "0123456789abcdef";
 
-#ifdef MAKE_CHECK
-
-#include "insider.h"
+static int hex_value(const char ch)
+{
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    }
 
-#define BW    9
-#define BH   11
-#define GW    2
-#define DEPTH 2
+    if (ch >= 'a' && ch <= 'f') {
+        return ch - 'a' + 10;
+    }
 
-#define STOP  QSTEPS
+    if (ch >= 'A' && ch <= 'F') {
+        return ch - 'A' + 10;
+    }
 
-static int make_point(const int x, const int y)
-{
-    return y * BW + x;
+    return -1;
 }
 
-static void check_steps(
-    const struct geometry * const me,
-    const int x, const int y,
-    const int * const expected)
+int state_encode(
+    const struct state * const me,
+    char * restrict const buf,
+    const size_t sz)
 {
-    const int point = make_point(x, y);
+    const struct geometry * const geometry = me->geometry;
+    if (me->ball < 0) {
+        return EINVAL;
+    }
+
+    if (sz < position_text_sz(geometry)) {
+        return ENOSPC;
+    }
+
+    const int len = sprintf(buf, "pf_%08x_%d_%d_", geometry_tag(geometry), me->active, me->ball);
+
+    const uint32_t qdigits = (geometry->qedges + 3) / 4;
+    uint8_t * restrict const digits = (uint8_t *)buf + len;
+    memset(digits, 0, qdigits);
+
+    const uint32_t qpoints = geometry->qpoints;
+    const int32_t * const edges = geometry->edges;
+    for (uint32_t point = 0; point < qpoints; ++point)
     for (enum step step=0; step<QSTEPS; ++step) {
-        const int next = me->connections[QSTEPS*point + step];
-        if (next != expected[step]) {
-            test_fail("Unexpected step: x=%d, y=%d, step=%d, next=%d, expected next=%d.", x, y, step, next, expected[step]);
+        const int32_t edge = edges[QSTEPS*point + step];
+        if (edge >= 0 && (me->lines[point] & (1 << step))) {
+            digits[edge / 4] |= 1 << (edge % 4);
         }
     }
-}
 
-static int apply_path(
+    for (uint32_t i=0; i<qdigits; ++i) {
+        buf[len + i] = hex_digits[digits[i]];
+    }
+    buf[len + qdigits] = '\0';
+    return 0;
+}
+
+static int read_uint(
+    const char ** ptr,
+    const char * const end,
+    uint32_t * restrict const value)
+{
+    const char * const start = *ptr;
+    uint64_t result = 0;
+    while (*ptr != end && **ptr >= '0' && **ptr <= '9' && *ptr - start < 10) {
+        result = 10 * result + (**ptr - '0');
+        ++*ptr;
+    }
+
+    *value = result;
+    return *ptr != start && result <= UINT32_MAX ? 0 : EINVAL;
+}
+
+int state_decode(
+    struct state * restrict const me,
+    const char * const text,
+    const size_t len)
+{
+    const struct geometry * const geometry = me->geometry;
+    const uint32_t qpoints = geometry->qpoints;
+    const uint32_t qedges = geometry->qedges;
+    const uint32_t qdigits = (qedges + 3) / 4;
+
+    const char * ptr = text;
+    const char * const end = text + len;
+
+    if (len < 12 || strncmp(text, "pf_", 3) != 0 || text[11] != '_') {
+        return EINVAL;
+    }
+
+    uint32_t tag = 0;
+    for (ptr = text + 3; ptr != text + 11; ++ptr) {
+        const int digit = hex_value(*ptr);
+        if (digit < 0) {
+            return EINVAL;
+        }
+        tag = tag << 4 | digit;
+    }
+
+    if (tag != geometry_tag(geometry)) {
+        return EINVAL;
+    }
+
+    ++ptr;
+    uint32_t active, ball;
+    if (read_uint(&ptr, end, &active) != 0 || active < 1 || active > 2) {
+        return EINVAL;
+    }
+
+    if (ptr == end || *ptr++ != '_') {
+        return EINVAL;
+    }
+
+    if (read_uint(&ptr, end, &ball) != 0 || ball >= qpoints) {
+        return EINVAL;
+    }
+
+    if (ptr == end || *ptr++ != '_' || (size_t)(end - ptr) != qdigits) {
+        return EINVAL;
+    }
+
+    /* Check every digit and unused high bits before the state is touched */
+    for (uint32_t i=0; i<qdigits; ++i) {
+        const int digit = hex_value(ptr[i]);
+        if (digit < 0 || (4*i + 4 > qedges && (digit >> (qedges - 4*i)) != 0)) {
+            return EINVAL;
+        }
+    }
+
+    init_lines(geometry, me->lines);
+    const int32_t * const edges = geometry->edges;
+    for (uint32_t point = 0; point < qpoints; ++point)
+    for (enum step step=0; step<QSTEPS; ++step) {
+        const int32_t edge = edges[QSTEPS*point + step];
+        if (edge >= 0 && (hex_value(ptr[edge / 4]) & (1 << (edge % 4)))) {
+            me->lines[point] |= 1 << step;
+        }
+    }
+
+    me->active = active;
+    me->ball = ball;
+    me->ball_before_goal = NO_WAY;
+    return 0;
+}
+
+/*
+ * Reachability bitboards: bit y*width + x is a point, so a step is a shift
+ * by a constant. Only four directions (NW, N, NE, E) are stored, every line
+ * is kept by its lower end and used in both ways. Free steps are masked by
+ * static links, so steps to goals never turn into shifts.
+ */
+typedef unsigned __int128 bitboard_t;
+
+static inline bitboard_t load_bitboard(const uint64_t * const words)
+{
+    return (bitboard_t)words[1] << 64 | words[0];
+}
+
+static void build_open_scalar(
+    const struct geometry * const geometry,
+    const uint8_t * const lines,
+    bitboard_t * restrict const open)
+{
+    const uint32_t qpoints = geometry->qpoints;
+    const int width = geometry->width;
+
+    for (int direction = 0; direction < 4; ++direction) {
+        open[direction] = 0;
+    }
+
+    for (uint32_t point = 0; point < qpoints; ++point) {
+        const int bit = geometry->coords[2*point + 1] * width + geometry->coords[2*point + 0];
+        const uint8_t free = lines[point] ^ 0xFF;
+        for (int direction = 0; direction < 4; ++direction) {
+            open[direction] |= (bitboard_t)((free >> direction) & 1) << bit;
+        }
+    }
+}
+
+/*
+ * Vector builders work on full grids only (point index is a bit index):
+ * bit d of every byte goes to bit 7 and is collected by movemask.
+ */
+#ifdef __SSE2__
+static void build_open_sse2(
+    const uint8_t * const lines,
+    const uint32_t qpoints,
+    bitboard_t * restrict const open)
+{
+    const uint32_t qchunks = (qpoints + 15) / 16;
+    uint8_t buf[128] __attribute__ ((aligned (16)));
+    memcpy(buf, lines, qpoints);
+    memset(buf + qpoints, 0xFF, 16*qchunks - qpoints);
+
+    uint16_t planes[4][8] __attribute__ ((aligned (16))) = { { 0 } };
+    for (uint32_t chunk = 0; chunk < qchunks; ++chunk) {
+        const __m128i free = ~_mm_load_si128((const __m128i *)(buf + 16*chunk));
+        planes[NORTH_WEST][chunk] = _mm_movemask_epi8(_mm_slli_epi64(free, 7 - NORTH_WEST));
+        planes[NORTH][chunk] = _mm_movemask_epi8(_mm_slli_epi64(free, 7 - NORTH));
+        planes[NORTH_EAST][chunk] = _mm_movemask_epi8(_mm_slli_epi64(free, 7 - NORTH_EAST));
+        planes[EAST][chunk] = _mm_movemask_epi8(_mm_slli_epi64(free, 7 - EAST));
+    }
+
+    memcpy(open, planes, sizeof(planes));
+}
+#endif
+
+#ifdef HAVE_SIMD_DISPATCH
+__attribute__ ((target ("avx2")))
+static void build_open_avx2(
+    const uint8_t * const lines,
+    const uint32_t qpoints,
+    bitboard_t * restrict const open)
+{
+    const uint32_t qchunks = (qpoints + 31) / 32;
+    uint8_t buf[128] __attribute__ ((aligned (32)));
+    memcpy(buf, lines, qpoints);
+    memset(buf + qpoints, 0xFF, 32*qchunks - qpoints);
+
+    uint32_t planes[4][4] __attribute__ ((aligned (32))) = { { 0 } };
+    for (uint32_t chunk = 0; chunk < qchunks; ++chunk) {
+        const __m256i used = _mm256_load_si256((const __m256i *)(buf + 32*chunk));
+        const __m256i free = _mm256_xor_si256(used, _mm256_set1_epi8(-1));
+        planes[NORTH_WEST][chunk] = _mm256_movemask_epi8(_mm256_slli_epi64(free, 7 - NORTH_WEST));
+        planes[NORTH][chunk] = _mm256_movemask_epi8(_mm256_slli_epi64(free, 7 - NORTH));
+        planes[NORTH_EAST][chunk] = _mm256_movemask_epi8(_mm256_slli_epi64(free, 7 - NORTH_EAST));
+        planes[EAST][chunk] = _mm256_movemask_epi8(_mm256_slli_epi64(free, 7 - EAST));
+    }
+
+    memcpy(open, planes, sizeof(planes));
+}
+
+/* AVX-512 tests bits directly: testn gives a mask of bytes with bit d clear */
+__attribute__ ((target ("avx512f,avx512bw")))
+static void build_open_avx512(
+    const uint8_t * const lines,
+    const uint32_t qpoints,
+    bitboard_t * restrict const open)
+{
+    const uint32_t qchunks = (qpoints + 63) / 64;
+    uint8_t buf[128] __attribute__ ((aligned (64)));
+    memcpy(buf, lines, qpoints);
+    memset(buf + qpoints, 0xFF, 64*qchunks - qpoints);
+
+    uint64_t planes[4][2] __attribute__ ((aligned (64))) = { { 0 } };
+    for (uint32_t chunk = 0; chunk < qchunks; ++chunk) {
+        const __m512i used = _mm512_load_si512((const void *)(buf + 64*chunk));
+        planes[NORTH_WEST][chunk] = _mm512_testn_epi8_mask(used, _mm512_set1_epi8(1 << NORTH_WEST));
+        planes[NORTH][chunk] = _mm512_testn_epi8_mask(used, _mm512_set1_epi8(1 << NORTH));
+        planes[NORTH_EAST][chunk] = _mm512_testn_epi8_mask(used, _mm512_set1_epi8(1 << NORTH_EAST));
+        planes[EAST][chunk] = _mm512_testn_epi8_mask(used, _mm512_set1_epi8(1 << EAST));
+    }
+
+    memcpy(open, planes, sizeof(planes));
+}
+#endif
+
+static void build_open_bitboards(
+    const struct geometry * const geometry,
+    const uint8_t * const lines,
+    bitboard_t * restrict const open)
+{
+    const uint32_t qpoints = geometry->qpoints;
+    const int is_full_grid = qpoints == (uint32_t)(geometry->width * geometry->height);
+    if (!is_full_grid) {
+        build_open_scalar(geometry, lines, open);
+        return;
+    }
+
+    switch (cpu_simd) {
+#ifdef HAVE_SIMD_DISPATCH
+        case SIMD_AVX512:
+            build_open_avx512(lines, qpoints, open);
+            return;
+        case SIMD_AVX2:
+            build_open_avx2(lines, qpoints, open);
+            return;
+#endif
+        default:
+#ifdef __SSE2__
+            build_open_sse2(lines, qpoints, open);
+#else
+            build_open_scalar(geometry, lines, open);
+#endif
+            return;
+    }
+}
+
+static int reach_bitboards(
+    const struct geometry * const geometry,
+    const uint8_t * const lines,
+    const int ball,
+    uint8_t * restrict const reachable)
+{
+    const int width = geometry->width;
+    const int16_t * const coords = geometry->coords;
+    const uint64_t * const masks = geometry->reach_masks;
+    const bitboard_t goal1 = load_bitboard(masks + 8);
+    const bitboard_t goal2 = load_bitboard(masks + 10);
+
+    bitboard_t open[4];
+    build_open_bitboards(geometry, lines, open);
+    for (int direction = 0; direction < 4; ++direction) {
+        open[direction] &= load_bitboard(masks + 2*direction);
+    }
+
+    bitboard_t reach = (bitboard_t)1 << (coords[2*ball + 1] * width + coords[2*ball + 0]);
+    for (;;) {
+        bitboard_t next = reach;
+        next |= (reach & open[NORTH_WEST]) << (width - 1);
+        next |= (reach & open[NORTH]) << width;
+        next |= (reach & open[NORTH_EAST]) << (width + 1);
+        next |= (reach & open[EAST]) << 1;
+        next |= open[NORTH_WEST] & (reach >> (width - 1));
+        next |= open[NORTH] & (reach >> width);
+        next |= open[NORTH_EAST] & (reach >> (width + 1));
+        next |= open[EAST] & (reach >> 1);
+
+        if (next == reach) {
+            break;
+        }
+        reach = next;
+    }
+
+    if (reachable) {
+        const uint32_t qpoints = geometry->qpoints;
+        for (uint32_t point = 0; point < qpoints; ++point) {
+            const int bit = coords[2*point + 1] * width + coords[2*point + 0];
+            reachable[point] = (reach >> bit) & 1;
+        }
+    }
+
+    int result = 0;
+    result |= (reach & goal1) != 0 ? REACH_GOAL_1 : 0;
+    result |= (reach & goal2) != 0 ? REACH_GOAL_2 : 0;
+    return result;
+}
+
+/* Plain sweeps over all points until nothing changes, used for large boards */
+static int reach_sweep(
+    const struct geometry * const geometry,
+    const uint8_t * const lines,
+    const int ball,
+    uint8_t * restrict const reachable)
+{
+    const uint32_t qpoints = geometry->qpoints;
+    const int32_t * const connections = geometry->connections;
+
+    memset(reachable, 0, qpoints);
+    reachable[ball] = 1;
+
+    int result = 0;
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (uint32_t point = 0; point < qpoints; ++point) {
+            if (!reachable[point]) {
+                continue;
+            }
+
+            steps_t free = lines[point] ^ 0xFF;
+            while (free) {
+                const enum step step = extract_step(&free);
+                const int32_t next = connections[QSTEPS*point + step];
+                if (next == GOAL_1) {
+                    result |= REACH_GOAL_1;
+                } else if (next == GOAL_2) {
+                    result |= REACH_GOAL_2;
+                } else if (next >= 0 && !reachable[next]) {
+                    reachable[next] = 1;
+                    changed = 1;
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+int reachable_goals(
+    const struct geometry * const geometry,
+    const uint8_t * const lines,
+    const int ball,
+    uint8_t * restrict const reachable)
+{
+    if (ball == GOAL_1) {
+        return REACH_GOAL_1;
+    }
+
+    if (ball == GOAL_2) {
+        return REACH_GOAL_2;
+    }
+
+    const int is_small = geometry->width * geometry->height <= 128;
+    if (is_small) {
+        return reach_bitboards(geometry, lines, ball, reachable);
+    }
+
+    if (reachable) {
+        return reach_sweep(geometry, lines, ball, reachable);
+    }
+
+    uint8_t * restrict const tmp = malloc(geometry->qpoints);
+    if (tmp == NULL) {
+        return -1;
+    }
+
+    const int result = reach_sweep(geometry, lines, ball, tmp);
+    free(tmp);
+    return result;
+}
+
+int state_reachable_goals(const struct state * const me, uint8_t * restrict const reachable)
+{
+    return reachable_goals(me->geometry, me->lines, me->ball, reachable);
+}
+
+int state_unstep(struct state * restrict const me, const enum step step)
+{
+    const int ball = me->ball;
+    if (ball < 0) {
+        me->ball = me->ball_before_goal;
+        me->ball_before_goal = NO_WAY;
+        return me->ball;
+    }
+
+    const enum step back = BACK(step);
+    const int32_t * const connections = me->geometry->connections;
+    const int prev = connections[QSTEPS*ball + back];
+    if (prev < 0) {
+        return NO_WAY;
+    }
+
+    uint8_t * restrict const lines = me->lines;
+    const uint8_t ball_lines = lines[ball];
+    const uint8_t prev_lines = lines[prev];
+
+    const uint8_t back_mask = 1 << back;
+    const int ball_lines_ok = ball_lines & back_mask;
+    if (!ball_lines_ok) {
+        return NO_WAY;
+    }
+
+    const uint8_t step_mask = 1 << step;
+    const int prev_lines_ok = prev_lines & step_mask;
+    if (!prev_lines_ok) {
+        return NO_WAY;
+    }
+
+    lines[ball] ^= back_mask;
+    lines[prev] ^= step_mask;
+    me->ball = prev;
+
+    if (lines[ball] == 0) {
+        me->active ^= 3;
+    }
+
+    return prev;
+}
+
+
+
+static int set_capacity(
+    struct history * restrict const me,
+    const unsigned int capacity)
+{
+    void * new_steps = realloc(me->steps, capacity * sizeof(enum step));
+    if (new_steps == NULL) {
+        return ENOMEM;
+    }
+
+    me->capacity = capacity;
+    me->steps = new_steps;
+    return 0;
+}
+
+void init_history(struct history * restrict const me)
+{
+    me->qsteps = 0;
+    me->capacity = 0;
+    me->steps = NULL;
+}
+
+void free_history(struct history * restrict const me)
+{
+    if (me->steps != NULL) {
+        free(me->steps);
+    }
+}
+
+int history_push(struct history * restrict const me, const enum step step)
+{
+    if (me->qsteps == me->capacity) {
+        const int status = set_capacity(me, 2 * me->capacity + 128);
+        if (status != 0) {
+            return status;
+        }
+    }
+
+    me->steps[me->qsteps++] = step;
+    return 0;
+}
+
+int history_copy(
+    struct history * restrict const dest,
+    const struct history * const src)
+{
+    if (dest->capacity < src->qsteps) {
+        const int status = set_capacity(dest, src->qsteps + 128);
+        if (status != 0) {
+            return status;
+        }
+    }
+
+    if (src->qsteps > 0) {
+        memcpy(dest->steps, src->steps, src->qsteps * sizeof(enum step));
+    }
+    dest->qsteps = src->qsteps;
+    return 0;
+}
+
+
+
+/* AI snapshots */
+
+struct ai_snapshot * create_ai_snapshot(const struct geometry * const geometry)
+{
+    struct ai_snapshot * restrict const me = malloc(sizeof(struct ai_snapshot));
+    if (me == NULL) {
+        return NULL;
+    }
+
+    me->state = create_state(geometry);
+    if (me->state == NULL) {
+        free(me);
+        return NULL;
+    }
+
+    init_history(&me->history);
+    return me;
+}
+
+void destroy_ai_snapshot(struct ai_snapshot * restrict const me)
+{
+    free_history(&me->history);
+    destroy_state(me->state);
+    free(me);
+}
+
+int ai_snapshot_save(
+    struct ai_snapshot * restrict const me,
+    const struct state * const state,
+    const struct history * const history)
+{
+    const int status = state_copy(me->state, state);
+    if (status != 0) {
+        return status;
+    }
+
+    me->state->ball_before_goal = state->ball_before_goal;
+    return history_copy(&me->history, history);
+}
+
+int ai_snapshot_load(
+    const struct ai_snapshot * const me,
+    struct state * restrict const state,
+    struct history * restrict const history)
+{
+    if (state->geometry != me->state->geometry) {
+        return EINVAL;
+    }
+
+    /* History goes first: it is the only part which may fail on allocation */
+    const int status = history_copy(history, &me->history);
+    if (status != 0) {
+        return status;
+    }
+
+    state_copy(state, me->state);
+    state->ball_before_goal = me->state->ball_before_goal;
+    return 0;
+}
+
+
+
+#ifdef MAKE_CHECK
+
+#include "insider.h"
+
+#define BW    9
+#define BH   11
+#define GW    2
+#define DEPTH 2
+
+#define STOP  QSTEPS
+
+static int make_point(const struct geometry * const me, const int x, const int y)
+{
+    for (uint32_t point = 0; point < me->qpoints; ++point) {
+        if (me->coords[2*point + 0] == x && me->coords[2*point + 1] == y) {
+            return point;
+        }
+    }
+    return NO_WAY;
+}
+
+static void check_steps(
+    const struct geometry * const me,
+    const int x, const int y,
+    const int * const expected)
+{
+    const int point = make_point(me, x, y);
+    for (enum step step=0; step<QSTEPS; ++step) {
+        const int next = me->connections[QSTEPS*point + step];
+        if (next != expected[step]) {
+            test_fail("Unexpected step: x=%d, y=%d, step=%d, next=%d, expected next=%d.", x, y, step, next, expected[step]);
+        }
+    }
+}
+
+static int apply_path(
     const struct geometry * const me,
     int point, const enum step path[])
 {
@@ -651,40 +1693,40 @@ int test_std_geometry(void)
             BW, BH, GW, errno);
     }
 
-    const int center = make_point(BW/2, BH/2);
+    const int center = make_point(me, BW/2, BH/2);
 
     const int expected_from_center[QSTEPS] = {
-        make_point(3, 6), make_point(4, 6), make_point(5, 6), make_point(5, 5),
-        make_point(5, 4), make_point(4, 4), make_point(3, 4), make_point(3, 5)
+        make_point(me, 3, 6), make_point(me, 4, 6), make_point(me, 5, 6), make_point(me, 5, 5),
+        make_point(me, 5, 4), make_point(me, 4, 4), make_point(me, 3, 4), make_point(me, 3, 5)
     };
     check_steps(me, 4, 5, expected_from_center);
 
     const int nw_corner[QSTEPS] = {
-        NO_WAY, NO_WAY, NO_WAY, NO_WAY, make_point(1, 9), NO_WAY, NO_WAY, NO_WAY
+        NO_WAY, NO_WAY, NO_WAY, NO_WAY, make_point(me, 1, 9), NO_WAY, NO_WAY, NO_WAY
     };
     check_steps(me, 0, 10, nw_corner);
 
     const int right_side[QSTEPS] = {
-        make_point(7, 7), NO_WAY, NO_WAY, NO_WAY, NO_WAY, NO_WAY,
-        make_point(7, 5), make_point(7, 6)
+        make_point(me, 7, 7), NO_WAY, NO_WAY, NO_WAY, NO_WAY, NO_WAY,
+        make_point(me, 7, 5), make_point(me, 7, 6)
     };
     check_steps(me, 8, 6, right_side);
 
     const int bottom_side[QSTEPS] = {
-        make_point(0, 1), make_point(1, 1), make_point(2, 1),
+        make_point(me, 0, 1), make_point(me, 1, 1), make_point(me, 2, 1),
         NO_WAY, NO_WAY, NO_WAY, NO_WAY, NO_WAY
     };
     check_steps(me, 1, 0, bottom_side);
 
     const int goal_post[QSTEPS] = {
-        GOAL_1, NO_WAY, NO_WAY, NO_WAY, make_point(6, 9),
-        make_point(5, 9), make_point(4, 9), make_point(4, 10)
+        GOAL_1, NO_WAY, NO_WAY, NO_WAY, make_point(me, 6, 9),
+        make_point(me, 5, 9), make_point(me, 4, 9), make_point(me, 4, 10)
     };
     check_steps(me, 5, 10, goal_post);
 
     const int goal_line[QSTEPS] = {
-        make_point(3, 1), make_point(4, 1), make_point(5, 1),
-        make_point(5, 0), GOAL_2, GOAL_2, GOAL_2, make_point(3, 0)
+        make_point(me, 3, 1), make_point(me, 4, 1), make_point(me, 5, 1),
+        make_point(me, 5, 0), GOAL_2, GOAL_2, GOAL_2, make_point(me, 3, 0)
     };
     check_steps(me, 4, 0, goal_line);
 
@@ -715,70 +1757,77 @@ int test_hockey_geometry(void)
     }
 
     const int expected_from_center[QSTEPS] = {
-        make_point(3, 8), make_point(4, 8), make_point(5, 8), make_point(5, 7),
-        make_point(5, 6), make_point(4, 6), make_point(3, 6), make_point(3, 7)
+        make_point(me, 3, 8), make_point(me, 4, 8), make_point(me, 5, 8), make_point(me, 5, 7),
+        make_point(me, 5, 6), make_point(me, 4, 6), make_point(me, 3, 6), make_point(me, 3, 7)
     };
     check_steps(me, 4, 7, expected_from_center);
 
     const int nw_corner1[QSTEPS] = {
-        NO_WAY, NO_WAY, NO_WAY, make_point(1, 12), make_point(1, 11), NO_WAY, NO_WAY, NO_WAY
+        NO_WAY, NO_WAY, NO_WAY, make_point(me, 1, 12), make_point(me, 1, 11), NO_WAY, NO_WAY, NO_WAY
     };
     check_steps(me, 0, 12, nw_corner1);
 
     const int ne_corner2[QSTEPS] = {
-        make_point(5, 14), make_point(6, 14), make_point(7, 14), make_point(7, 13),
-        make_point(7, 12), make_point(6, 12), make_point(5, 12), make_point(5, 13)
+        make_point(me, 5, 14), make_point(me, 6, 14), NO_WAY, make_point(me, 7, 13),
+        make_point(me, 7, 12), make_point(me, 6, 12), make_point(me, 5, 12), make_point(me, 5, 13)
     };
     check_steps(me, 6, 13, ne_corner2);
 
     const int se_corner3[QSTEPS] = {
-        make_point(6, 2), make_point(7, 2), NO_WAY, NO_WAY,
-        NO_WAY, NO_WAY, NO_WAY, make_point(6, 1)
+        make_point(me, 6, 2), make_point(me, 7, 2), NO_WAY, NO_WAY,
+        NO_WAY, NO_WAY, NO_WAY, make_point(me, 6, 1)
     };
     check_steps(me, 7, 1, se_corner3);
 
-    const int sw_corner4[QSTEPS] = {
-        NO_WAY, NO_WAY, NO_WAY, NO_WAY, NO_WAY, NO_WAY, NO_WAY, NO_WAY
-    };
-    check_steps(me, 1, 0, sw_corner4);
+    /* Cut off corners have no points */
+    if (make_point(me, 1, 0) != NO_WAY || make_point(me, 0, 0) != NO_WAY) {
+        test_fail("Unexpected points in cut off corner.");
+    }
+
+    if (me->qpoints >= (BH + 2*DEPTH) * BW) {
+        test_fail("Hockey geometry has %u points, dead cells are not dropped.", me->qpoints);
+    }
 
     const int right_side[QSTEPS] = {
-        make_point(7, 7), NO_WAY, NO_WAY, NO_WAY, NO_WAY, NO_WAY,
-        make_point(7, 5), make_point(7, 6)
+        make_point(me, 7, 7), NO_WAY, NO_WAY, NO_WAY, NO_WAY, NO_WAY,
+        make_point(me, 7, 5), make_point(me, 7, 6)
     };
     check_steps(me, 8, 6, right_side);
 
     const int bottom_side[QSTEPS] = {
-        make_point(2, 1), make_point(3, 1), make_point(4, 1),
+        make_point(me, 2, 1), make_point(me, 3, 1), make_point(me, 4, 1),
         NO_WAY, NO_WAY, NO_WAY, NO_WAY, NO_WAY
     };
     check_steps(me, 3, 0, bottom_side);
 
     const int goal_post[QSTEPS] = {
-        GOAL_1, NO_WAY, make_point(6, 13), make_point(6, 12),
-        make_point(6, 11), make_point(5, 11), make_point(4, 11), make_point(4, 12)
+        GOAL_1, NO_WAY, make_point(me, 6, 13), make_point(me, 6, 12),
+        make_point(me, 6, 11), make_point(me, 5, 11), make_point(me, 4, 11), make_point(me, 4, 12)
     };
     check_steps(me, 5, 12, goal_post);
 
     const int goal_line[QSTEPS] = {
-        make_point(3, 3), make_point(4, 3), make_point(5, 3),
-        make_point(5, 2), GOAL_2, GOAL_2, GOAL_2, make_point(3, 2)
+        make_point(me, 3, 3), make_point(me, 4, 3), make_point(me, 5, 3),
+        make_point(me, 5, 2), GOAL_2, GOAL_2, GOAL_2, make_point(me, 3, 2)
     };
     check_steps(me, 4, 2, goal_line);
 
     const int behind_post[QSTEPS] = {
-        make_point(2, 14), make_point(3, 14), make_point(4, 14), NO_WAY,
-        NO_WAY, NO_WAY, make_point(2, 12), make_point(2, 13)
+        make_point(me, 2, 14), make_point(me, 3, 14), make_point(me, 4, 14), NO_WAY,
+        NO_WAY, NO_WAY, make_point(me, 2, 12), make_point(me, 2, 13)
     };
     check_steps(me, 3, 13, behind_post);
 
     const int behind_goal_lines[QSTEPS] = {
-        NO_WAY, NO_WAY, NO_WAY, NO_WAY, make_point(5, 0),
-        make_point(4, 0), make_point(3, 0), NO_WAY
+        NO_WAY, NO_WAY, NO_WAY, NO_WAY, make_point(me, 5, 0),
+        make_point(me, 4, 0), make_point(me, 3, 0), NO_WAY
     };
     check_steps(me, 4, 1, behind_goal_lines);
 
-    const int center = make_point(BW/2, BH/2 + DEPTH);
+    const int center = make_point(me, BW/2, BH/2 + DEPTH);
+    if (center != me->qpoints / 2) {
+        test_fail("Center point is %d, start position is %u.", center, me->qpoints / 2);
+    }
 
     static enum step cycle[] = {
         SOUTH_WEST, WEST, NORTH_WEST, SOUTH, EAST, NORTH, NORTH_EAST, SOUTH_EAST, STOP
@@ -798,6 +1847,448 @@ int test_hockey_geometry(void)
     return 0;
 }
 
+static void check_tables(const struct geometry * const me)
+{
+    const uint32_t qpoints = me->qpoints;
+    const int32_t * const connections = me->connections;
+
+    uint32_t qedge_refs = 0;
+    for (uint32_t point = 0; point < qpoints; ++point) {
+        const int x = me->coords[2*point + 0];
+        const int y = me->coords[2*point + 1];
+        const int is_inside = x >= 0 && x < me->width && y >= 0 && y < me->height;
+        if (!is_inside || make_point(me, x, y) != point) {
+            test_fail("Unexpected coords (%d, %d) for point %u.", x, y, point);
+        }
+
+        const int32_t mirror = me->mirrors[point];
+        if (me->mirrors[mirror] != point) {
+            test_fail("Mirror of mirror of point %u is %d.", point, me->mirrors[mirror]);
+        }
+
+        for (enum step step=0; step<QSTEPS; ++step) {
+            const int32_t next = connections[QSTEPS*point + step];
+            const int32_t mirror_next = connections[QSTEPS*mirror + MIRROR(step)];
+            const int32_t expected = next >= 0 ? me->mirrors[next] : next;
+            if (mirror_next != expected) {
+                test_fail("Point %u, step %d: mirror next is %d, expected %d.", point, step, mirror_next, expected);
+            }
+
+            const int32_t edge = me->edges[QSTEPS*point + step];
+            if (next < 0) {
+                if (edge != -1) {
+                    test_fail("Point %u, step %d: edge %d for no connection.", point, step, edge);
+                }
+                continue;
+            }
+
+            ++qedge_refs;
+            if (edge < 0 || edge >= me->qedges) {
+                test_fail("Point %u, step %d: invalid edge %d, qedges is %u.", point, step, edge, me->qedges);
+            }
+
+            if (me->edges[QSTEPS*next + BACK(step)] != edge) {
+                test_fail("Point %u, step %d: back edge mismatch.", point, step);
+            }
+
+            const int32_t next_dist = me->goal_dists[2*next];
+            const int32_t dist = me->goal_dists[2*point];
+            if (next_dist + 1 < dist) {
+                test_fail("Point %u, step %d: goal distance %d, but neighbour distance %d.", point, step, dist, next_dist);
+            }
+
+            const int is_closer = (me->closer_steps[2*point] >> step) & 1;
+            if (is_closer != (next_dist < dist)) {
+                test_fail("Point %u, step %d: invalid closer_steps mask.", point, step);
+            }
+        }
+
+        const int has_goal_step = me->goal_steps[2*point] != 0;
+        if (has_goal_step != (me->goal_dists[2*point] == 1)) {
+            test_fail("Point %u: goal_steps and goal_dists mismatch.", point);
+        }
+
+        const int is_goal_border = (me->borders[point] & BORDER_GOAL_1) != 0;
+        if (has_goal_step != is_goal_border) {
+            test_fail("Point %u: goal_steps and borders mismatch.", point);
+        }
+    }
+
+    if (qedge_refs != 2 * me->qedges) {
+        test_fail("Every edge should be referenced twice, but %u references for %u edges.", qedge_refs, me->qedges);
+    }
+}
+
+int test_geometry_tables(void)
+{
+    struct geometry * restrict const std = create_std_geometry(BW, BH, GW);
+    if (std == NULL) {
+        test_fail("create_std_geometry(%d, %d, %d) fails, return value is NULL, errno is %d.",
+            BW, BH, GW, errno);
+    }
+
+    check_tables(std);
+
+    const int center = make_point(std, BW/2, BH/2);
+    if (std->goal_dists[2*center] != BH/2 + 1 || std->goal_dists[2*center+1] != BH/2 + 1) {
+        test_fail("Unexpected goal distances from center: %u and %u.", std->goal_dists[2*center], std->goal_dists[2*center+1]);
+    }
+
+    if (std->mirrors[make_point(std, 0, 10)] != make_point(std, 8, 10)) {
+        test_fail("Unexpected mirror point %d for (0, 10).", std->mirrors[make_point(std, 0, 10)]);
+    }
+
+    if (std->borders[center] != 0 || std->borders[make_point(std, 0, 3)] != BORDER_SIDE) {
+        test_fail("Unexpected border flags.");
+    }
+
+    destroy_geometry(std);
+
+    struct geometry * restrict const hockey = create_hockey_geometry(BW, BH, GW, DEPTH);
+    if (hockey == NULL) {
+        test_fail("create_hockey_geometry(%d, %d, %d, %d) fails, return value is NULL, errno is %d.",
+            BW, BH, GW, DEPTH, errno);
+    }
+
+    check_tables(hockey);
+    destroy_geometry(hockey);
+    return 0;
+}
+
+int test_symmetry(void)
+{
+    struct geometry * restrict const geometry = create_std_geometry(BW, BH, GW);
+    if (geometry == NULL) {
+        test_fail("create_std_geometry(%d, %d, %d) failed, errno = %d.", BW, BH, GW, errno);
+    }
+
+    struct state * restrict const east = create_state(geometry);
+    struct state * restrict const west = create_state(geometry);
+    struct state * restrict const tmp = create_state(geometry);
+    if (east == NULL || west == NULL || tmp == NULL) {
+        test_fail("create_state(geometry) failed, errno = %d.", errno);
+    }
+
+    if (!state_is_symmetric(east)) {
+        test_fail("Start position is not symmetric.");
+    }
+
+    state_step(east, NORTH);
+    state_step(west, NORTH);
+    if (!state_is_symmetric(east)) {
+        test_fail("Position after NORTH step is not symmetric.");
+    }
+
+    state_step(east, NORTH_EAST);
+    state_step(west, NORTH_WEST);
+    if (state_is_symmetric(east) || state_is_symmetric(west)) {
+        test_fail("Position after diagonal step is symmetric.");
+    }
+
+    if (state_hash(east) == state_hash(west)) {
+        test_fail("Mirrored positions have the same direct hash.");
+    }
+
+    int east_mirrored, west_mirrored;
+    const uint64_t east_hash = state_canonical_hash(east, &east_mirrored);
+    const uint64_t west_hash = state_canonical_hash(west, &west_mirrored);
+    if (east_hash != west_hash) {
+        test_fail("Canonical hashes of mirrored positions differ: %016lx and %016lx.",
+            (unsigned long)east_hash, (unsigned long)west_hash);
+    }
+
+    if (east_mirrored == west_mirrored) {
+        test_fail("Exactly one of mirrored positions should be flipped to canonical form.");
+    }
+
+    state_mirror(tmp, east);
+    if (state_hash(tmp) != state_hash(west)) {
+        test_fail("Mirror of east position does not match west position.");
+    }
+
+    if (tmp->ball != west->ball || tmp->active != west->active) {
+        test_fail("Mirror of east position has ball %d, active %d; expected ball %d, active %d.",
+            tmp->ball, tmp->active, west->ball, west->active);
+    }
+
+    state_canonical(tmp, west);
+    if (state_hash(tmp) != east_hash) {
+        test_fail("Canonical state hash %016lx does not match canonical hash %016lx.",
+            (unsigned long)state_hash(tmp), (unsigned long)east_hash);
+    }
+
+    destroy_state(tmp);
+    destroy_state(west);
+    destroy_state(east);
+    destroy_geometry(geometry);
+    return 0;
+}
+
+static void check_reachability(const struct state * const state)
+{
+    const struct geometry * const geometry = state->geometry;
+    const uint32_t qpoints = geometry->qpoints;
+    uint8_t fast[qpoints];
+    uint8_t slow[qpoints];
+
+    const int fast_goals = reach_bitboards(geometry, state->lines, state->ball, fast);
+    const int slow_goals = reach_sweep(geometry, state->lines, state->ball, slow);
+    if (fast_goals != slow_goals) {
+        test_fail("Reachable goals mismatch for ball %d: bitboards %d, sweep %d.",
+            state->ball, fast_goals, slow_goals);
+    }
+
+    for (uint32_t point = 0; point < qpoints; ++point) {
+        if (fast[point] != slow[point]) {
+            test_fail("Reachability mismatch for point %u (ball %d): bitboards %d, sweep %d.",
+                point, state->ball, fast[point], slow[point]);
+        }
+    }
+    const int is_full_grid = qpoints == (uint32_t)(geometry->width * geometry->height);
+    if (!is_full_grid) {
+        return;
+    }
+
+    /* Every vector builder supported by CPU should match scalar one */
+    bitboard_t expected[4], open[4];
+    build_open_scalar(geometry, state->lines, expected);
+
+    for (enum simd_variant simd = SIMD_GENERIC; simd <= simd_variant(); ++simd) {
+        memset(open, 0xFF, sizeof(open));
+        switch (simd) {
+#ifdef HAVE_SIMD_DISPATCH
+            case SIMD_AVX512:
+                build_open_avx512(state->lines, qpoints, open);
+                break;
+            case SIMD_AVX2:
+                build_open_avx2(state->lines, qpoints, open);
+                break;
+#endif
+            default:
+#ifdef __SSE2__
+                build_open_sse2(state->lines, qpoints, open);
+#else
+                build_open_scalar(geometry, state->lines, open);
+#endif
+                break;
+        }
+
+        for (int direction = 0; direction < 4; ++direction) {
+            if (open[direction] != expected[direction]) {
+                test_fail("Open bitboards of %s builder differ from scalar ones, direction %d.",
+                    simd_names[simd], direction);
+            }
+        }
+    }
+}
+
+static void check_reachability_games(struct geometry * restrict const geometry, const int qgames)
+{
+    struct state * restrict const state = create_state(geometry);
+    if (state == NULL) {
+        test_fail("create_state(geometry) failed, errno = %d.", errno);
+    }
+
+    if (state_reachable_goals(state, NULL) != (REACH_GOAL_1 | REACH_GOAL_2)) {
+        test_fail("Both goals should be reachable at start.");
+    }
+
+    int qlimited = 0;
+    for (int i=0; i<qgames; ++i) {
+        init_lines(geometry, state->lines);
+        state->ball = geometry->qpoints / 2;
+        state->active = 1;
+
+        while (state_status(state) == IN_PROGRESS) {
+            check_reachability(state);
+            qlimited += state_reachable_goals(state, NULL) != (REACH_GOAL_1 | REACH_GOAL_2);
+
+            steps_t steps = state_get_steps(state);
+            steps_t safe = steps;
+            for (steps_t tmp = steps; tmp; ) {
+                const enum step step = extract_step(&tmp);
+                if (geometry->connections[QSTEPS*state->ball + step] < 0) {
+                    safe &= ~(1 << step);
+                }
+            }
+
+            steps = safe ? safe : steps;
+            const int index = rand() % step_count(steps);
+            for (int j=0; j<index; ++j) {
+                steps &= steps - 1;
+            }
+            state_step(state, first_step(steps));
+        }
+    }
+
+    if (qlimited == 0) {
+        test_fail("No position with an unreachable goal in %d games.", qgames);
+    }
+
+    destroy_state(state);
+}
+
+int test_reachability(void)
+{
+    struct geometry * restrict const std = create_std_geometry(BW, BH, GW);
+    if (std == NULL) {
+        test_fail("create_std_geometry(%d, %d, %d) failed, errno = %d.", BW, BH, GW, errno);
+    }
+
+    check_reachability_games(std, 200);
+    destroy_geometry(std);
+
+    /* Hockey board should fit in 128 bit bitboards */
+    struct geometry * restrict const hockey = create_hockey_geometry(BW-2, BH, GW, DEPTH);
+    if (hockey == NULL) {
+        test_fail("create_hockey_geometry(%d, %d, %d, %d) fails, return value is NULL, errno is %d.",
+            BW-2, BH, GW, DEPTH, errno);
+    }
+
+    check_reachability_games(hockey, 200);
+    destroy_geometry(hockey);
+
+    struct geometry * restrict const big = create_std_geometry(21, 31, 6);
+    if (big == NULL) {
+        test_fail("create_std_geometry(21, 31, 6) failed, errno = %d.", errno);
+    }
+
+    struct state * restrict const state = create_state(big);
+    if (state == NULL) {
+        test_fail("create_state(big) failed, errno = %d.", errno);
+    }
+
+    if (state_reachable_goals(state, NULL) != (REACH_GOAL_1 | REACH_GOAL_2)) {
+        test_fail("Both goals should be reachable at start on the big board.");
+    }
+
+    destroy_state(state);
+    destroy_geometry(big);
+    return 0;
+}
+
+static void check_position_games(
+    const struct geometry * const geometry,
+    const struct geometry * const other,
+    const int qgames)
+{
+    struct state * restrict const state = create_state(geometry);
+    struct state * restrict const decoded = create_state(geometry);
+    struct state * restrict const other_state = create_state(other);
+    if (state == NULL || decoded == NULL || other_state == NULL) {
+        test_fail("create_state failed, errno = %d.", errno);
+    }
+
+    const size_t sz = position_text_sz(geometry);
+    char text[sz];
+
+    for (int i=0; i<qgames; ++i) {
+        init_lines(geometry, state->lines);
+        state->ball = geometry->qpoints / 2;
+        state->active = 1;
+
+        while (state_status(state) == IN_PROGRESS) {
+            if (state_encode(state, text, sz) != 0) {
+                test_fail("state_encode fails in progress.");
+            }
+
+            const size_t len = strlen(text);
+            if (len >= sz) {
+                test_fail("Position text \"%s\" has length %zu, buffer size is %zu.", text, len, sz);
+            }
+
+            if (state_decode(decoded, text, len) != 0) {
+                test_fail("state_decode fails for \"%s\".", text);
+            }
+
+            if (decoded->active != state->active || decoded->ball != state->ball) {
+                test_fail("Decoded active %d, ball %d, but %d, %d expected.",
+                    decoded->active, decoded->ball, state->active, state->ball);
+            }
+
+            if (memcmp(decoded->lines, state->lines, geometry->qpoints) != 0) {
+                test_fail("Decoded lines mismatch for \"%s\".", text);
+            }
+
+            if (state_decode(other_state, text, len) == 0) {
+                test_fail("Position \"%s\" is accepted for another board.", text);
+            }
+
+            steps_t steps = state_get_steps(state);
+            const int index = rand() % step_count(steps);
+            for (int j=0; j<index; ++j) {
+                steps &= steps - 1;
+            }
+            state_step(state, first_step(steps));
+        }
+
+        if (state->ball < 0 && state_encode(state, text, sz) == 0) {
+            test_fail("Ball in a goal is encoded.");
+        }
+    }
+
+    destroy_state(other_state);
+    destroy_state(decoded);
+    destroy_state(state);
+}
+
+int test_position(void)
+{
+    struct geometry * restrict const std = create_std_geometry(BW, BH, GW);
+    struct geometry * restrict const hockey = create_hockey_geometry(BW, BH, GW, DEPTH);
+    if (std == NULL || hockey == NULL) {
+        test_fail("create geometry failed, errno = %d.", errno);
+    }
+
+    if (geometry_tag(std) == geometry_tag(hockey)) {
+        test_fail("Standard and hockey boards have the same tag.");
+    }
+
+    check_position_games(std, hockey, 50);
+    check_position_games(hockey, std, 50);
+
+    /* Broken texts are rejected and the state is not touched */
+    struct state * restrict const state = create_state(std);
+    const size_t sz = position_text_sz(std);
+    char text[sz];
+    state_step(state, NORTH);
+    state_encode(state, text, sz);
+    const size_t len = strlen(text);
+    const int ball = state->ball;
+
+    char broken[sz];
+    const char * const cases[] = { "bad digit", "truncated", "high bit", "active", "prefix" };
+    for (int i=0; i<5; ++i) {
+        memcpy(broken, text, sz);
+        size_t broken_len = len;
+        switch (i) {
+            case 0: broken[len-1] = 'g'; break;
+            case 1: --broken_len; break;
+            case 2: broken[len-1] = 'f'; break;
+            case 3: broken[12] = '3'; break;
+            case 4: broken[0] = 'q'; break;
+        }
+
+        /* qedges of the standard board is not a multiple of 4, so the last digit has spare bits */
+        if (i == 2 && std->qedges % 4 == 0) {
+            continue;
+        }
+
+        if (state_decode(state, broken, broken_len) == 0) {
+            test_fail("Broken position (%s) \"%.*s\" is accepted.", cases[i], (int)broken_len, broken);
+        }
+
+        if (state->ball != ball) {
+            test_fail("Broken position (%s) changes the state.", cases[i]);
+        }
+    }
+
+    destroy_state(state);
+    destroy_geometry(hockey);
+    destroy_geometry(std);
+    return 0;
+}
+
 int test_step(void)
 {
     struct geometry * restrict const geometry = create_std_geometry(BW, BH, GW);
@@ -872,7 +2363,7 @@ int test_step(void)
                 }
             }
         } else {
-            const int expected = make_point(test_step->x, test_step->y);
+            const int expected = make_point(geometry, test_step->x, test_step->y);
             if (next != expected) {
                 test_fail("state_step on move %d: %d is returned, but %d expected.", index, next, expected);
             }
@@ -1034,3 +2525,90 @@ int test_unstep(void)
 }
 
 #endif
+
+
+
+#ifdef MAKE_BENCH
+
+#include <stdio.h>
+#include <time.h>
+
+#include "bench.h"
+
+#define BENCH_BW           9
+#define BENCH_BH          11
+#define BENCH_GW           2
+#define BENCH_QPOSITIONS 256
+#define BENCH_QPASSES   4096
+
+static void random_position(struct state * restrict const state, int qsteps)
+{
+    while (qsteps-- > 0) {
+        steps_t steps = state_get_steps(state);
+        for (steps_t tmp = steps; tmp; ) {
+            const enum step step = extract_step(&tmp);
+            if (state->geometry->connections[QSTEPS*state->ball + step] < 0) {
+                steps &= ~(1 << step);
+            }
+        }
+
+        if (steps == 0) {
+            return;
+        }
+
+        const int index = rand() % step_count(steps);
+        for (int i=0; i<index; ++i) {
+            steps &= steps - 1;
+        }
+        state_step(state, first_step(steps));
+    }
+}
+
+/* Nanoseconds per reachability call on middle game positions */
+int bench_reachability(void)
+{
+    struct geometry * restrict const geometry = create_std_geometry(BENCH_BW, BENCH_BH, BENCH_GW);
+    if (geometry == NULL) {
+        bench_fail("create_std_geometry failed, errno is %d.", errno);
+    }
+
+    struct state * states[BENCH_QPOSITIONS];
+    for (int i=0; i<BENCH_QPOSITIONS; ++i) {
+        states[i] = create_state(geometry);
+        if (states[i] == NULL) {
+            bench_fail("bad alloc.");
+        }
+        random_position(states[i], 10 + rand() % 80);
+    }
+
+    uint8_t reachable[BENCH_BW * BENCH_BH];
+    const char * const names[2] = { "bitboards", "sweep" };
+
+    printf("%12s %12s %12s\n", "method", "ns/call", "limited");
+    for (int method = 0; method < 2; ++method) {
+        int qlimited = 0;
+        const double start = clock();
+        for (int pass = 0; pass < BENCH_QPASSES; ++pass) {
+            for (int i=0; i<BENCH_QPOSITIONS; ++i) {
+                const struct state * const state = states[i];
+                const int goals = method == 0
+                    ? reach_bitboards(geometry, state->lines, state->ball, NULL)
+                    : reach_sweep(geometry, state->lines, state->ball, reachable);
+                qlimited += goals != (REACH_GOAL_1 | REACH_GOAL_2);
+            }
+        }
+        const double finish = clock();
+        const double elapsed = (finish - start) / CLOCKS_PER_SEC;
+        const double qcalls = (double)BENCH_QPASSES * BENCH_QPOSITIONS;
+
+        printf("%12s %12.1f %12d\n", names[method], 1e9 * elapsed / qcalls, qlimited / BENCH_QPASSES);
+    }
+
+    for (int i=0; i<BENCH_QPOSITIONS; ++i) {
+        destroy_state(states[i]);
+    }
+    destroy_geometry(geometry);
+    return 0;
+}
+
+#endif
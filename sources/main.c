@@ -2,7 +2,17 @@
 #include "paper-football.h"
 #include "parser.h"
 
+#include <ctype.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 #define KW_QUIT             1
 #define KW_PING             2
@@ -19,6 +29,13 @@
 #define KW_TIME            13
 #define KW_SCORE           14
 #define KW_STEPS           15
+#define KW_POSITION        16
+#define KW_STOP            17
+#define KW_ANALYZE         18
+#define KW_PV              19
+#define KW_SAVE            20
+#define KW_LOAD            21
+#define KW_TREE            22
 
 #define ITEM(name) { #name, KW_##name }
 struct keyword_desc keywords[] = {
@@ -38,6 +55,13 @@ struct keyword_desc keywords[] = {
     ITEM(TIME),
     ITEM(SCORE),
     ITEM(STEPS),
+    ITEM(POSITION),
+    ITEM(STOP),
+    ITEM(ANALYZE),
+    ITEM(PV),
+    ITEM(SAVE),
+    ITEM(LOAD),
+    ITEM(TREE),
     { NULL, 0 }
 };
 
@@ -47,7 +71,7 @@ const char * step_names[QSTEPS] = {
     "NW", "N", "NE", "E", "SE", "S", "SW", "W"
 };
 
-enum ai_go_flags { EXPLAIN_TIME, EXPLAIN_SCORE, EXPLAIN_STEPS };
+enum ai_go_flags { EXPLAIN_TIME, EXPLAIN_SCORE, EXPLAIN_STEPS, EXPLAIN_PV };
 
 struct ai_desc
 {
@@ -62,6 +86,9 @@ struct ai_desc ai_list[] = {
     { NULL, NULL, NULL }
 };
 
+/* Opening book is mapped once at startup (--book PATH), all engines share it */
+static struct book opening_book = { 0, 0, NULL, NULL, 0 };
+
 struct cmd_parser
 {
     struct line_parser line_parser;
@@ -82,22 +109,39 @@ struct cmd_parser
     struct ai * ai;
     const struct ai_desc * ai_desc;
     struct ai ai_storage;
+    struct ai_snapshot * ai_snapshot;
+
+    FILE * out;
+    FILE * err;
+
+    /* AI may be stopped from another thread, so it is replaced under the lock */
+    pthread_mutex_t ai_mutex;
+    int is_interrupted;
+
+    /* AI GO runs in background thread, other commands wait for it (or stop AI ANALYZE) */
+    int is_async;
+    int is_searching;
+    int is_analyzing;
+    unsigned int search_flags;
+    double analyze_interval;
+    pthread_t search_thread;
 };
 
 
 
-static void error(struct line_parser * restrict const lp, const char * fmt, ...) __attribute__ ((format (printf, 2, 3)));
+static void error(struct cmd_parser * restrict const me, const char * fmt, ...) __attribute__ ((format (printf, 2, 3)));
 
-static void error(struct line_parser * restrict const lp, const char * fmt, ...)
+static void error(struct cmd_parser * restrict const me, const char * fmt, ...)
 {
+    const struct line_parser * const lp = &me->line_parser;
     va_list args;
     va_start(args, fmt);
-    fprintf(stderr, "Parsing error: ");
-    vfprintf(stderr, fmt, args);
+    fprintf(me->err, "Parsing error: ");
+    vfprintf(me->err, fmt, args);
     va_end(args);
 
     int offset = lp->lexem_start - lp->line;
-    fprintf(stderr, "\n> %s> %*s^\n", lp->line, offset, "");
+    fprintf(me->err, "\n> %s> %*s^\n", lp->line, offset, "");
 }
 
 static int read_keyword(struct cmd_parser * restrict const me)
@@ -107,10 +151,146 @@ static int read_keyword(struct cmd_parser * restrict const me)
     return parser_read_keyword(lp, me->tracker);
 }
 
+/*
+ * Geometries are read only, so all games (and all daemon sessions) on the
+ * same board share one reference counted instance.
+ */
+
+struct shared_geometry
+{
+    struct shared_geometry * next;
+    struct geometry * geometry;
+    unsigned int qrefs;
+
+    enum board_shape board_shape;
+    int width;
+    int height;
+    int goal_width;
+    int depth;
+};
+
+static struct shared_geometry * shared_geometries = NULL;
+static pthread_mutex_t shared_geometries_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct geometry * create_geometry(
+    FILE * const err,
+    enum board_shape board_shape,
+    const int width,
+    const int height,
+    const int goal_width,
+    const int depth)
+{
+    struct geometry * geometry;
+
+    switch (board_shape) {
+
+        case SOCCER:
+            geometry = create_std_geometry(width, height, goal_width);
+            if (geometry != NULL) {
+                return geometry;
+            }
+            fprintf(err, "create_std_geometry(%d, %d, %d) failed with code %d: %s.\n", width, height, goal_width, errno, strerror(errno));
+            return NULL;
+
+        case HOCKEY:
+            geometry = create_hockey_geometry(width, height, goal_width, depth);
+            if (geometry != NULL) {
+                return geometry;
+            }
+            fprintf(err, "create_hockey_geometry(%d, %d, %d, %d) failed with code %d: %s.\n", width, height, goal_width, depth, errno, strerror(errno));
+            return NULL;
+
+        default:
+            fprintf(err, "Internal error: invalid board shape %d.\n", board_shape);
+            errno = EINVAL;
+            return NULL;
+    }
+}
+
+static struct geometry * acquire_geometry(
+    FILE * const err,
+    enum board_shape board_shape,
+    const int width,
+    const int height,
+    const int goal_width,
+    const int depth)
+{
+    struct geometry * geometry = NULL;
+    pthread_mutex_lock(&shared_geometries_mutex);
+
+    struct shared_geometry * ptr = shared_geometries;
+    for (; ptr != NULL; ptr = ptr->next) {
+        const int is_same = 1
+            && ptr->board_shape == board_shape
+            && ptr->width == width
+            && ptr->height == height
+            && ptr->goal_width == goal_width
+            && ptr->depth == depth
+        ;
+
+        if (is_same) {
+            ++ptr->qrefs;
+            geometry = ptr->geometry;
+            goto done;
+        }
+    }
+
+    ptr = malloc(sizeof(struct shared_geometry));
+    if (ptr == NULL) {
+        fprintf(err, "Cannot allocate shared geometry.\n");
+        errno = ENOMEM;
+        goto done;
+    }
+
+    geometry = create_geometry(err, board_shape, width, height, goal_width, depth);
+    if (geometry == NULL) {
+        const int saved_errno = errno;
+        free(ptr);
+        errno = saved_errno;
+        goto done;
+    }
+
+    ptr->geometry = geometry;
+    ptr->qrefs = 1;
+    ptr->board_shape = board_shape;
+    ptr->width = width;
+    ptr->height = height;
+    ptr->goal_width = goal_width;
+    ptr->depth = depth;
+    ptr->next = shared_geometries;
+    shared_geometries = ptr;
+
+done:
+    pthread_mutex_unlock(&shared_geometries_mutex);
+    return geometry;
+}
+
+static void release_geometry(struct geometry * const geometry)
+{
+    pthread_mutex_lock(&shared_geometries_mutex);
+
+    struct shared_geometry ** link = &shared_geometries;
+    for (; *link != NULL; link = &(*link)->next) {
+        struct shared_geometry * const ptr = *link;
+        if (ptr->geometry != geometry) {
+            continue;
+        }
+
+        if (--ptr->qrefs == 0) {
+            *link = ptr->next;
+            destroy_geometry(ptr->geometry);
+            free(ptr);
+        }
+        break;
+    }
+
+    pthread_mutex_unlock(&shared_geometries_mutex);
+}
+
 static void destroy_game(const struct cmd_parser * const me)
 {
     if (me->geometry) {
-        destroy_geometry(me->geometry);
+        release_geometry(me->geometry);
     }
 
     if (me->state) {
@@ -122,13 +302,31 @@ static void destroy_game(const struct cmd_parser * const me)
     }
 }
 
+static void free_ai_snapshot(struct cmd_parser * restrict const me)
+{
+    if (me->ai_snapshot) {
+        destroy_ai_snapshot(me->ai_snapshot);
+        me->ai_snapshot = NULL;
+    }
+}
+
 static void free_ai(struct cmd_parser * restrict const me)
 {
+    pthread_mutex_lock(&me->ai_mutex);
     if (me->ai) {
         me->ai->free(me->ai);
         me->ai = NULL;
         me->ai_desc = NULL;
     }
+    pthread_mutex_unlock(&me->ai_mutex);
+}
+
+/* Called with locked ai_mutex: interrupted session stops every new AI too */
+static void keep_interrupted(struct cmd_parser * restrict const me)
+{
+    if (me->is_interrupted && me->ai) {
+        me->ai->stop(me->ai, 1);
+    }
 }
 
 static int new_game(
@@ -147,7 +345,10 @@ static int new_game(
     }
 
     if (me->ai) {
+        pthread_mutex_lock(&me->ai_mutex);
         const int status = me->ai->reset(me->ai, geometry);
+        keep_interrupted(me);
+        pthread_mutex_unlock(&me->ai_mutex);
         if (status != 0) {
             destroy_state(state);
             destroy_state(backup);
@@ -156,6 +357,7 @@ static int new_game(
     }
 
     destroy_game(me);
+    free_ai_snapshot(me);
 
     me->geometry = geometry;
     me->state = state;
@@ -213,13 +415,15 @@ static const struct ai_param * find_ai_param(
 }
 
 static int read_value(
-    struct line_parser * restrict const lp,
+    struct cmd_parser * restrict const me,
     void * const buf,
-    const int type)
+    const struct ai_param * const param)
 {
+    struct line_parser * restrict const lp = &me->line_parser;
+    const int type = param->type;
     const size_t value_sz = param_sizes[type];
     if (value_sz == 0) {
-        error(lp, "Parameter cannot be set.");
+        error(me, "Parameter cannot be set.");
         return EINVAL;
     }
 
@@ -228,7 +432,7 @@ static int read_value(
         const unsigned char * const lexem = lp->current;
         const int status = parser_read_last_int(lp, &value);
         if (status != 0) {
-            error(lp, "Single integer parameter value expected.");
+            error(me, "Single integer parameter value expected.");
             return EINVAL;
         }
 
@@ -239,7 +443,7 @@ static int read_value(
         if (type == U32) {
             if (value < 0) {
                 lp->lexem_start = lexem;
-                error(lp, "Parameter value might be positive.");
+                error(me, "Parameter value might be positive.");
                 return EINVAL;
             }
             *(uint32_t*)buf = (uint32_t)value;
@@ -250,13 +454,35 @@ static int read_value(
         float value;
         const int status = parser_read_float(lp, &value);
         if (status != 0) {
-            error(lp, "Single float parameter expected.");
+            error(me, "Single float parameter expected.");
             return EINVAL;
         }
 
         *(float*)buf = value;
     }
 
+    if (type == ENUM) {
+        const int status = parser_read_id(lp);
+        if (status != 0) {
+            error(me, "Parameter value name expected.");
+            return EINVAL;
+        }
+
+        const size_t len = lp->current - lp->lexem_start;
+        const int value = find_enum_value(param->names, (const char *)lp->lexem_start, len);
+        if (value < 0) {
+            error(me, "Invalid parameter value.");
+            return EINVAL;
+        }
+
+        if (!parser_check_eol(lp)) {
+            error(me, "End of line expected after parameter value.");
+            return EINVAL;
+        }
+
+        *(uint32_t*)buf = (uint32_t)value;
+    }
+
     return 0;
 }
 
@@ -269,19 +495,25 @@ static void set_ai(
 
     status = ai_desc->init_ai(&storage, me->geometry);
     if (status != 0) {
-        fprintf(stderr, "Cannot set AI: init failed with code %d.\n", status);
+        fprintf(me->err, "Cannot set AI: init failed with code %d.\n", status);
         return;
     }
 
-    if (me->history.qsteps > 0) {
-        status = storage.do_steps(&storage, me->history.qsteps, me->history.steps);
-        if (status != 0) {
-            fprintf(stderr, "Cannot set AI: cannot apply history, status = %d.\n", status);
-            storage.free(&storage);
-            return;
-        }
+    storage.set_book(&storage, opening_book.map ? &opening_book : NULL);
+
+    /* Position is installed directly, history is copied only to allow undo */
+    status = storage.set_state(&storage, me->state);
+    if (status == 0) {
+        status = history_copy(&storage.history, &me->history);
+    }
+
+    if (status != 0) {
+        fprintf(me->err, "Cannot set AI: cannot set position, status = %d.\n", status);
+        storage.free(&storage);
+        return;
     }
 
+    pthread_mutex_lock(&me->ai_mutex);
     if (me->ai) {
         me->ai->free(me->ai);
     }
@@ -289,6 +521,8 @@ static void set_ai(
     me->ai_storage = storage;
     me->ai = &me->ai_storage;
     me->ai_desc = ai_desc;
+    keep_interrupted(me);
+    pthread_mutex_unlock(&me->ai_mutex);
 }
 
 static struct ai * get_ai(struct cmd_parser * restrict const me)
@@ -301,30 +535,66 @@ static struct ai * get_ai(struct cmd_parser * restrict const me)
     return me->ai;
 }
 
+/* Snapshot is allocated once per game, returns NULL if AI cannot be checkpointed */
+static struct ai_snapshot * save_ai(struct cmd_parser * restrict const me)
+{
+    if (me->ai_snapshot == NULL) {
+        me->ai_snapshot = create_ai_snapshot(me->geometry);
+        if (me->ai_snapshot == NULL) {
+            return NULL;
+        }
+    }
+
+    const int status = me->ai->snapshot(me->ai, me->ai_snapshot);
+    return status == 0 ? me->ai_snapshot : NULL;
+}
+
 static void restore_ai(
     struct cmd_parser * restrict const me,
-    const unsigned int history_qsteps)
+    const unsigned int history_qsteps,
+    const struct ai_snapshot * const snapshot)
 {
     int status;
     struct ai * restrict const ai = me->ai;
     restore_backup(me, history_qsteps);
 
+    if (snapshot != NULL && ai->restore(ai, snapshot) == 0) {
+        return;
+    }
+
+    /* No snapshot: rebuild AI from scratch */
+    pthread_mutex_lock(&me->ai_mutex);
     status = ai->reset(ai, me->geometry);
+    keep_interrupted(me);
+    pthread_mutex_unlock(&me->ai_mutex);
     if (status != 0) {
-        fprintf(stderr, "Cannot reset AI, AI turned off.\n");
+        fprintf(me->err, "Cannot reset AI, AI turned off.\n");
         free_ai(me);
         return;
     }
 
     status = ai->do_steps(ai, me->history.qsteps, me->history.steps);
     if (status != 0) {
-        fprintf(stderr, "Cannot apply history to AI, AI turned off.\n");
+        fprintf(me->err, "Cannot apply history to AI, AI turned off.\n");
         free_ai(me);
         return;
     }
 }
 
+/* Turn steps and the rest of the line are split by separator */
+static void print_variation(
+    FILE * const out,
+    const struct ai_variation * const variation,
+    const char * const separator)
+{
+    for (unsigned int i = 0; i < variation->qsteps; ++i) {
+        const char * const prefix = i == 0 ? "" : i == variation->qturn ? separator : " ";
+        fprintf(out, "%s%s", prefix, step_names[variation->steps[i]]);
+    }
+}
+
 static void explain_step(
+    FILE * const out,
     const enum step step,
     const unsigned int flags,
     const struct ai_explanation * const explanation)
@@ -336,81 +606,106 @@ static void explain_step(
     const unsigned int time_mask = 1 << EXPLAIN_TIME;
     const unsigned int score_mask = 1 << EXPLAIN_SCORE;
     const unsigned int step_mask = 1 << EXPLAIN_STEPS;
+    const unsigned int pv_mask = 1 << EXPLAIN_PV;
+
+    /* Background search shares output with the command loop */
+    flockfile(out);
 
     const unsigned int line_mask = time_mask | score_mask;
     if (flags & line_mask) {
-        printf("  %2s", step_names[step]);
+        fprintf(out, "  %2s", step_names[step]);
         if (flags & time_mask) {
-            printf(" in %.3fs", explanation->time);
+            fprintf(out, " in %.3fs", explanation->time);
         }
         if (flags & score_mask) {
             const double score = explanation->score;
             if (score >= 0.0 && score <= 1.0) {
-                printf(" score %5.1f%%", 100.0 * score);
+                fprintf(out, " score %5.1f%%", 100.0 * score);
             } else {
-                printf(" score N/A");
+                fprintf(out, " score N/A");
             }
         }
-        printf("\n");
+        fprintf(out, "\n");
     }
 
     if (flags & step_mask) {
         const struct step_stat * ptr = explanation->stats;
         const struct step_stat * const end = ptr + explanation->qstats;
         for (; ptr != end; ++ptr) {
-            printf("        %2s %5.1f%%", step_names[ptr->step], 100 * ptr->score);
+            fprintf(out, "        %2s %5.1f%%", step_names[ptr->step], 100 * ptr->score);
             if (ptr->qgames > 0) {
-                printf(" %6d\n", ptr->qgames);
+                fprintf(out, " %6lld\n", (long long)ptr->qgames);
             } else {
-                printf("    N/A\n");
+                fprintf(out, "    N/A\n");
             }
         }
     }
+
+    if (flags & pv_mask) {
+        const struct ai_variation * ptr = explanation->variations;
+        const struct ai_variation * const end = ptr + explanation->qvariations;
+        for (; ptr != end; ++ptr) {
+            fprintf(out, "        pv %5.1f%% %6lld ", 100 * ptr->score, (long long)ptr->qgames);
+            print_variation(out, ptr, " | ");
+            fprintf(out, "\n");
+        }
+    }
+
+    funlockfile(out);
 }
 
-static void ai_go(
+/* AI plays a whole move, new steps are appended to history, returns 0 or error code */
+static int ai_play(
     struct cmd_parser * restrict const me,
     const unsigned int flags)
 {
     struct ai_explanation explanation;
 
     if (state_status(me->state) != IN_PROGRESS) {
-        fprintf(stderr, "Game over, no moves possible.\n");
-        return;
+        fprintf(me->err, "Game over, no moves possible.\n");
+        return EINVAL;
     }
 
     struct ai * restrict const ai = get_ai(me);
+    if (ai == NULL) {
+        return EINVAL;
+    }
+
     struct state * restrict const state = me->state;
     const int active = state->active;
 
+    /* Explanation lines are open on output when an error happens */
+    const char * const eol = flags ? "\n" : "";
+
     enum step step = ai->go(ai, flags ? &explanation : NULL);
     if (step == INVALID_STEP) {
-        fprintf(stderr, "AI move: invalid step.\n");
-        return;
+        fprintf(me->err, "AI move: invalid step.\n");
+        return EINVAL;
     }
 
     state_copy(me->backup, state);
     const unsigned int history_qsteps = me->history.qsteps;
+    const struct ai_snapshot * const snapshot = save_ai(me);
 
     for (;;) {
         const int ball = state_step(state, step);
         if (ball == NO_WAY) {
-            printf("\n");
-            fprintf(stderr, "ai_go: game state cannot follow step %s.\n", step_names[step]);
-            restore_ai(me, history_qsteps);
-            return;
+            fprintf(me->out, "%s", eol);
+            fprintf(me->err, "ai_go: game state cannot follow step %s.\n", step_names[step]);
+            restore_ai(me, history_qsteps, snapshot);
+            return EINVAL;
         }
 
         const int status = me->ai->do_step(me->ai, step);
         if (status != 0) {
-            printf("\n");
-            fprintf(stderr, "ai_go: AI cannot follow himself on step %s.\n", step_names[step]);
-            restore_ai(me, history_qsteps);
-            return;
+            fprintf(me->out, "%s", eol);
+            fprintf(me->err, "ai_go: AI cannot follow himself on step %s.\n", step_names[step]);
+            restore_ai(me, history_qsteps, snapshot);
+            return status;
         }
 
         history_push(&me->history, step);
-        explain_step(step, flags, &explanation);
+        explain_step(me->out, step, flags, &explanation);
 
         const int is_done = 0
             || state_status(state) != IN_PROGRESS
@@ -423,44 +718,180 @@ static void ai_go(
 
         step = ai->go(ai, flags ? &explanation : NULL);
         if (step == INVALID_STEP) {
-            printf("\n");
-            fprintf(stderr, "AI move: invalid step.\n");
-            restore_ai(me, history_qsteps);
-            return;
+            fprintf(me->out, "%s", eol);
+            fprintf(me->err, "AI move: invalid step.\n");
+            restore_ai(me, history_qsteps, snapshot);
+            return EINVAL;
         }
     }
 
+    return 0;
+}
+
+static void ai_go(
+    struct cmd_parser * restrict const me,
+    const unsigned int flags)
+{
+    const unsigned int history_qsteps = me->history.qsteps;
+    const int status = ai_play(me, flags);
+    if (status != 0) {
+        return;
+    }
+
     const enum step * step_ptr = me->history.steps + history_qsteps;
     const enum step * const end = me->history.steps + me->history.qsteps;
     const char * separator = "";
+    flockfile(me->out);
     for (; step_ptr != end; step_ptr++) {
-        printf("%s%s", separator, step_names[*step_ptr]);
+        fprintf(me->out, "%s%s", separator, step_names[*step_ptr]);
         separator = " ";
     }
-    printf("\n");
+    fprintf(me->out, "\n");
+    funlockfile(me->out);
 }
 
-static void ai_info(struct cmd_parser * restrict const me)
+static void * search_thread(void * arg)
 {
-    get_ai(me);
-    if (me->ai_desc == NULL) {
+    struct cmd_parser * restrict const me = arg;
+    ai_go(me, me->search_flags);
+
+    /* Nobody else flushes while the command loop waits for input */
+    fflush(me->out);
+    fflush(me->err);
+    return NULL;
+}
+
+/* Machine readable analysis line, steps are listed as in explanation */
+static void report_analysis(void * arg, const struct ai_explanation * explanation)
+{
+    struct cmd_parser * restrict const me = arg;
+    FILE * const out = me->out;
+    const double time = explanation->time;
+    const double pps = time > 0.0 ? explanation->qplayouts / time : 0.0;
+
+    flockfile(out);
+    fprintf(out, "info time %.3f playouts %llu pps %.0f nodes %u", time, (unsigned long long)explanation->qplayouts, pps, explanation->qnodes);
+
+    if (explanation->qstats > 0) {
+        fprintf(out, " best %s", step_names[explanation->stats[0].step]);
+        if (explanation->score >= 0.0 && explanation->score <= 1.0) {
+            fprintf(out, " score %.4f", explanation->score);
+        } else {
+            fprintf(out, " score N/A");
+        }
+    }
+
+    const struct step_stat * ptr = explanation->stats;
+    const struct step_stat * const end = ptr + explanation->qstats;
+    for (; ptr != end; ++ptr) {
+        if (ptr->qgames > 0) {
+            fprintf(out, " step %s %lld %.4f", step_names[ptr->step], (long long)ptr->qgames, ptr->score);
+        } else {
+            fprintf(out, " step %s 0 N/A", step_names[ptr->step]);
+        }
+    }
+
+    fprintf(out, "\n");
+
+    /* One line per root turn, pv lists turn steps and then the answer */
+    for (size_t i = 0; i < explanation->qvariations; ++i) {
+        const struct ai_variation * const variation = explanation->variations + i;
+        fprintf(out, "info multipv %zu games %lld score %.4f turn %u pv ",
+            i + 1, (long long)variation->qgames, variation->score, variation->qturn);
+        print_variation(out, variation, " ");
+        fprintf(out, "\n");
+    }
+
+    fflush(out);
+    funlockfile(out);
+}
+
+static void * analyze_thread(void * arg)
+{
+    struct cmd_parser * restrict const me = arg;
+    struct ai * restrict const ai = me->ai;
+
+    const enum step step = ai->analyze(ai, me->analyze_interval, report_analysis, me);
+    if (step == INVALID_STEP) {
+        fprintf(me->err, "AI analyze failed: %s\n", ai->error ? ai->error : "invalid step");
+    } else {
+        flockfile(me->out);
+        fprintf(me->out, "best %s\n", step_names[step]);
+        funlockfile(me->out);
+    }
+
+    fflush(me->out);
+    fflush(me->err);
+    return NULL;
+}
+
+static void start_search(
+    struct cmd_parser * restrict const me,
+    void * (*routine)(void *))
+{
+    /* AI is created here, so command loop may stop it while searching */
+    struct ai * restrict const ai = get_ai(me);
+    if (ai == NULL) {
+        return;
+    }
+
+    ai->stop(ai, 0);
+    const int status = pthread_create(&me->search_thread, NULL, routine, me);
+    if (status != 0) {
+        fprintf(me->err, "Cannot start search thread, code %d: %s.\n", status, strerror(status));
         return;
     }
+    me->is_searching = 1;
+    me->is_analyzing = routine == analyze_thread;
+}
+
+/* Wait until background AI GO is completed, the game is not touched after */
+static void wait_search(struct cmd_parser * restrict const me)
+{
+    if (me->is_searching) {
+        pthread_join(me->search_thread, NULL);
+        me->is_searching = 0;
+        me->is_analyzing = 0;
+    }
+}
+
+/* Background AI GO plays the best move found so far */
+static void stop_search(struct cmd_parser * restrict const me)
+{
+    if (me->is_searching) {
+        me->ai->stop(me->ai, 1);
+        wait_search(me);
+    }
+}
 
-    printf("%12s\t%12s\n", "name", me->ai_desc->name);
-    printf("%12s\t%12.12s\n", "hash", me->ai_desc->sha512);
+/* AI GO is waited for, AI ANALYZE never finishes itself, so it is stopped */
+static void finish_search(struct cmd_parser * restrict const me)
+{
+    if (me->is_analyzing) {
+        stop_search(me);
+    } else {
+        wait_search(me);
+    }
+}
 
-    const struct ai_param * ptr = me->ai->get_params(me->ai);
+static void print_ai_params(FILE * const out, const struct ai_param * ptr)
+{
     for (; ptr->name != NULL; ++ptr) {
         switch (ptr->type) {
             case I32:
-                printf("%12s\t%12d\n", ptr->name, *(int32_t*)ptr->value);
+                fprintf(out, "%12s\t%12d\n", ptr->name, *(int32_t*)ptr->value);
                 break;
             case U32:
-                printf("%12s\t%12u\n", ptr->name, *(uint32_t*)ptr->value);
+                fprintf(out, "%12s\t%12u\n", ptr->name, *(uint32_t*)ptr->value);
                 break;
             case F32:
-                printf("%12s\t%12f\n", ptr->name, *(float*)ptr->value);
+                fprintf(out, "%12s\t%12f\n", ptr->name, *(float*)ptr->value);
+                break;
+            case ENUM:
+                fprintf(out, "%12s\t%12s\n", ptr->name, ptr->names[*(uint32_t*)ptr->value]);
+                break;
+            case U64:
+                fprintf(out, "%12s\t%12llu\n", ptr->name, (unsigned long long)*(uint64_t*)ptr->value);
                 break;
             default:
                 break;
@@ -468,60 +899,69 @@ static void ai_info(struct cmd_parser * restrict const me)
     }
 }
 
+static void ai_info(struct cmd_parser * restrict const me)
+{
+    get_ai(me);
+    if (me->ai_desc == NULL) {
+        return;
+    }
+
+    fprintf(me->out, "%12s\t%12s\n", "name", me->ai_desc->name);
+    fprintf(me->out, "%12s\t%12.12s\n", "hash", me->ai_desc->sha512);
+    if (opening_book.map) {
+        fprintf(me->out, "%12s\t%12u\n", "book", opening_book.qentries);
+    }
+
+    print_ai_params(me->out, me->ai->get_params(me->ai));
+    print_ai_params(me->out, me->ai->get_stats(me->ai));
+}
+
 
 
 void free_cmd_parser(struct cmd_parser * restrict const me)
 {
+    finish_search(me);
+
     if (me->tracker) {
         destroy_keyword_tracker(me->tracker);
     }
 
     destroy_game(me);
     free_ai(me);
+    free_ai_snapshot(me);
 
     free_history(&me->history);
+    pthread_mutex_destroy(&me->ai_mutex);
 }
 
-static struct geometry * create_geometry(
-    enum board_shape board_shape,
-    const int width,
-    const int height,
-    const int goal_width,
-    const int depth)
+/* Stops AI GO of the session from another thread, every next search is stopped too */
+void interrupt_cmd_parser(struct cmd_parser * restrict const me)
 {
-    struct geometry * geometry;
-
-    switch (board_shape) {
-
-        case SOCCER:
-            geometry = create_std_geometry(width, height, goal_width);
-            if (geometry != NULL) {
-                return geometry;
-            }
-            fprintf(stderr, "create_std_geometry(%d, %d, %d) failed with code %d: %s.\n", width, height, goal_width, errno, strerror(errno));
-            return NULL;
-
-        case HOCKEY:
-            geometry = create_hockey_geometry(width, height, goal_width, depth);
-            if (geometry != NULL) {
-                return geometry;
-            }
-            fprintf(stderr, "create_hockey_geometry(%d, %d, %d, %d) failed with code %d: %s.\n", width, height, goal_width, depth, errno, strerror(errno));
-            return NULL;
-
-        default:
-            fprintf(stderr, "Internal error: invalid board shape %d.\n", board_shape);
-            return NULL;
-    }
+    pthread_mutex_lock(&me->ai_mutex);
+    me->is_interrupted = 1;
+    keep_interrupted(me);
+    pthread_mutex_unlock(&me->ai_mutex);
 }
 
-int init_cmd_parser(struct cmd_parser * restrict const me)
+int init_cmd_parser(
+    struct cmd_parser * restrict const me,
+    FILE * const out,
+    FILE * const err)
 {
+    me->out = out;
+    me->err = err;
     me->tracker = NULL;
     me->geometry = NULL;
     me->state = NULL;
     me->backup = NULL;
     me->ai = NULL;
+    me->ai_snapshot = NULL;
+    pthread_mutex_init(&me->ai_mutex, NULL);
+    me->is_interrupted = 0;
+    me->is_async = 0;
+    me->is_searching = 0;
+    me->is_analyzing = 0;
+    init_history(&me->history);
 
     me->board_shape = SOCCER;
     me->width = 9;
@@ -535,7 +975,7 @@ int init_cmd_parser(struct cmd_parser * restrict const me)
         return ENOMEM;
     }
 
-    struct geometry * restrict geometry = create_geometry(
+    struct geometry * restrict geometry = acquire_geometry(me->err,
         me->board_shape, me->width, me->height, me->goal_width, me->depth);
     if (geometry == NULL) {
         free_cmd_parser(me);
@@ -544,12 +984,11 @@ int init_cmd_parser(struct cmd_parser * restrict const me)
 
     const int status = new_game(me, geometry);
     if (status != 0) {
+        release_geometry(geometry);
         free_cmd_parser(me);
         return status;
     }
 
-    init_history(&me->history);
-
     return 0;
 }
 
@@ -559,7 +998,7 @@ int process_quit(struct cmd_parser * restrict const me)
 {
     struct line_parser * restrict const lp = &me->line_parser;
     if (!parser_check_eol(lp)) {
-        error(lp, "End of line expected (QUIT command is parsed), but someting was found.");
+        error(me, "End of line expected (QUIT command is parsed), but someting was found.");
         return 0;
     }
     return 1;
@@ -569,7 +1008,7 @@ void process_status(struct cmd_parser * restrict const me)
 {
     struct line_parser * restrict const lp = &me->line_parser;
     if (!parser_check_eol(lp)) {
-        error(lp, "End of line expected (STATUS command is parsed), but someting was found.");
+        error(me, "End of line expected (STATUS command is parsed), but someting was found.");
         return;
     }
 
@@ -580,25 +1019,26 @@ void process_status(struct cmd_parser * restrict const me)
 
     switch (board_shape) {
         case SOCCER:
-            printf("Board shape:      soccer\n");
+            fprintf(me->out, "Board shape:      soccer\n");
             break;
         case HOCKEY:
-            printf("Board shape:      hockey\n");
+            fprintf(me->out, "Board shape:      hockey\n");
             break;
         default:
-            printf("Board shape:      unknown with code %d\n", board_shape);
+            fprintf(me->out, "Board shape:      unknown with code %d\n", board_shape);
             break;
     }
-    printf("Board width:   %4d\n", me->width);
-    printf("Board height:  %4d\n", me->height);
+    fprintf(me->out, "Board width:   %4d\n", me->width);
+    fprintf(me->out, "Board height:  %4d\n", me->height);
     if (board_shape == HOCKEY) {
-        printf("Board depth:   %4d\n", me->depth);
+        fprintf(me->out, "Board depth:   %4d\n", me->depth);
     }
 
-    printf("Goal width:    %4d\n", me->goal_width);
-    printf("Active player: %4d\n", active);
+    fprintf(me->out, "Goal width:    %4d\n", me->goal_width);
+    fprintf(me->out, "Active player: %4d\n", active);
     if (ball >= 0) {
-        printf("Ball position: %4d, %d\n", ball % me->width, ball / me->width);
+        const int16_t * const coords = state->geometry->coords;
+        fprintf(me->out, "Ball position: %4d, %d\n", coords[2*ball], coords[2*ball+1]);
     }
 
     static const char * status_strs[3] = {
@@ -606,7 +1046,7 @@ void process_status(struct cmd_parser * restrict const me)
         [WIN_1]       = "player 1 win",
         [WIN_2]       = "player 2 win",
     };
-    printf("Status:           %s\n", status_strs[state_status(state)]);
+    fprintf(me->out, "Status:           %s\n", status_strs[state_status(state)]);
 }
 
 void process_new(struct cmd_parser * restrict const me)
@@ -627,7 +1067,7 @@ void process_new(struct cmd_parser * restrict const me)
                 board_shape = HOCKEY;
                 break;
             default:
-                error(lp, "Invalid game type.");
+                error(me, "Invalid game type.");
                 return;
         }
         parser_skip_spaces(lp);
@@ -635,56 +1075,56 @@ void process_new(struct cmd_parser * restrict const me)
 
     status = parser_try_int(lp, &width);
     if (status != 0) {
-        error(lp, "Board width integer constant expected in NEW command.");
+        error(me, "Board width integer constant expected in NEW command.");
         return;
     }
 
     if (width % 2 != 1) {
-        error(lp, "Board width integer constant should be odd number.");
+        error(me, "Board width integer constant should be odd number.");
         return;
     }
 
     if (width <= 4) {
-        error(lp, "Board width integer constant should be at least 5 or more.");
+        error(me, "Board width integer constant should be at least 5 or more.");
         return;
     }
 
     parser_skip_spaces(lp);
     status = parser_try_int(lp, &height);
     if (status != 0) {
-        error(lp, "Board height integer constant expected in NEW command.");
+        error(me, "Board height integer constant expected in NEW command.");
         return;
     }
 
     if (height % 2 != 1) {
-        error(lp, "Board height integer constant should be odd number.");
+        error(me, "Board height integer constant should be odd number.");
         return;
     }
 
     if (height <= 4) {
-        error(lp, "Board height integer constant should be at least 5 or more.");
+        error(me, "Board height integer constant should be at least 5 or more.");
         return;
     }
 
     parser_skip_spaces(lp);
     status = parser_try_int(lp, &goal_width);
     if (status != 0) {
-        error(lp, "Board goal width integer constant expected in NEW command.");
+        error(me, "Board goal width integer constant expected in NEW command.");
         return;
     }
 
     if (goal_width % 2 != 0) {
-        error(lp, "Goal width integer constant should be even number.");
+        error(me, "Goal width integer constant should be even number.");
         return;
     }
 
     if (goal_width <= 1) {
-        error(lp, "Goal height integer constant should be at least 2 or more.");
+        error(me, "Goal height integer constant should be at least 2 or more.");
         return;
     }
 
     if (goal_width + 3 > width) {
-        error(lp, "Goal height integer constant should be less than width-1 = %d.", width-1);
+        error(me, "Goal height integer constant should be less than width-1 = %d.", width-1);
         return;
     }
 
@@ -692,17 +1132,17 @@ void process_new(struct cmd_parser * restrict const me)
         parser_skip_spaces(lp);
         status = parser_try_int(lp, &depth);
         if (status != 0) {
-            error(lp, "Board depth integer constant expected in NEW command.");
+            error(me, "Board depth integer constant expected in NEW command.");
             return;
         }
 
         if (depth < 2) {
-            error(lp, "Board depth integer constant should be at least 2 or more.");
+            error(me, "Board depth integer constant should be at least 2 or more.");
             return;
         }
 
         if (depth >= width/2) {
-            error(lp, "Board depth integer constant should be less than width/2 = %d.", width/2);
+            error(me, "Board depth integer constant should be less than width/2 = %d.", width/2);
             return;
         }
     } else {
@@ -710,11 +1150,11 @@ void process_new(struct cmd_parser * restrict const me)
     }
 
     if (!parser_check_eol(lp)) {
-        error(lp, "End of line expected (NEW command is completed), but someting was found.");
+        error(me, "End of line expected (NEW command is completed), but someting was found.");
         return;
     }
 
-    struct geometry * restrict geometry = create_geometry(board_shape, width, height, goal_width, depth);
+    struct geometry * restrict geometry = acquire_geometry(me->err, board_shape, width, height, goal_width, depth);
     if (geometry == NULL) {
         return;
     }
@@ -727,8 +1167,8 @@ void process_new(struct cmd_parser * restrict const me)
         me->goal_width = goal_width;
         me->depth = depth;
     } else {
-        destroy_geometry(geometry);
-        fprintf(stderr, "New game failed with code %d, %s.\n", status, strerror(status));
+        release_geometry(geometry);
+        fprintf(me->err, "New game failed with code %d, %s.\n", status, strerror(status));
     }
 }
 
@@ -740,12 +1180,12 @@ void process_step(struct cmd_parser * restrict const me)
         steps_t steps = state_get_steps(me->state);
         if (steps > 0) {
             const enum step step = extract_step(&steps);
-            printf("%s", step_names[step]);
+            fprintf(me->out, "%s", step_names[step]);
             while (steps != 0) {
                 const enum step step = extract_step(&steps);
-                printf(" %s", step_names[step]);
+                fprintf(me->out, " %s", step_names[step]);
             }
-            printf("\n");
+            fprintf(me->out, "\n");
         }
     } else {
         state_copy(me->backup, me->state);
@@ -753,25 +1193,25 @@ void process_step(struct cmd_parser * restrict const me)
         do {
             int status = parser_read_id(lp);
             if (status != 0) {
-                error(lp, "Step direction expected.");
+                error(me, "Step direction expected.");
                 return restore_backup(me, history_qsteps);
             }
 
             enum step step = find_step(lp->lexem_start, lp->current - lp->lexem_start);
             if (step == QSTEPS) {
-                error(lp, "Invalid step direction, only NW, N, NE, E, SE, S, SW are supported.");
+                error(me, "Invalid step direction, only NW, N, NE, E, SE, S, SW are supported.");
                 return restore_backup(me, history_qsteps);
             }
 
             const int ball = state_step(me->state, step);
             if (ball == NO_WAY) {
-                error(lp, "Direction occupied.");
+                error(me, "Direction occupied.");
                 return restore_backup(me, history_qsteps);
             }
 
             status = history_push(&me->history, step);
             if (status != 0) {
-                error(lp, "history_push failed with code %d.", status);
+                error(me, "history_push failed with code %d.", status);
                 return restore_backup(me, history_qsteps);
             }
 
@@ -783,7 +1223,7 @@ void process_step(struct cmd_parser * restrict const me)
             const enum step * const new_steps = me->history.steps + history_qsteps;
             const int status = me->ai->do_steps(me->ai, qnew_steps, new_steps);
             if (status != 0) {
-                error(lp, "AI applying step sequence failed with code %d.", status);
+                error(me, "AI applying step sequence failed with code %d.", status);
                 return restore_backup(me, history_qsteps);
             }
         }
@@ -794,7 +1234,7 @@ void process_history(struct cmd_parser * restrict const me)
 {
     struct line_parser * restrict const lp = &me->line_parser;
     if (!parser_check_eol(lp)) {
-        error(lp, "End of line expected (HISTORY command is parsed), but someting was found.");
+        error(me, "End of line expected (HISTORY command is parsed), but someting was found.");
         return;
     }
 
@@ -804,26 +1244,76 @@ void process_history(struct cmd_parser * restrict const me)
 
     const enum step * ptr = me->history.steps;
     const enum step * const end = ptr + me->history.qsteps;
-    printf("%s", step_names[*ptr++]);
+    fprintf(me->out, "%s", step_names[*ptr++]);
     while (ptr != end) {
-        printf(" %s", step_names[*ptr++]);
+        fprintf(me->out, " %s", step_names[*ptr++]);
     }
-    printf("\n");
+    fprintf(me->out, "\n");
 }
 
-void process_set_ai_param(struct cmd_parser * restrict const me)
+void process_position(struct cmd_parser * restrict const me)
 {
-    int status;
     struct line_parser * restrict const lp = &me->line_parser;
     parser_skip_spaces(lp);
 
-    status = parser_read_id(lp);
+    if (parser_check_eol(lp)) {
+        char buf[position_text_sz(me->geometry)];
+        const int status = state_encode(me->state, buf, sizeof(buf));
+        if (status != 0) {
+            fprintf(me->err, "Position with the ball in a goal cannot be encoded.\n");
+            return;
+        }
+        fprintf(me->out, "%s\n", buf);
+        return;
+    }
+
+    const int status = parser_read_id(lp);
     if (status != 0) {
-        error(lp, "AI parameter name expected.");
+        error(me, "Position text expected.");
         return;
     }
 
-    const size_t id_len = lp->current - lp->lexem_start;
+    const char * const text = (const char *)lp->lexem_start;
+    const size_t len = lp->current - lp->lexem_start;
+    if (!parser_check_eol(lp)) {
+        error(me, "End of line expected after position.");
+        return;
+    }
+
+    state_copy(me->backup, me->state);
+    const unsigned int history_qsteps = me->history.qsteps;
+
+    if (state_decode(me->state, text, len) != 0) {
+        lp->lexem_start = (const unsigned char *)text;
+        error(me, "Invalid position or position for another board.");
+        return restore_backup(me, history_qsteps);
+    }
+
+    /* Loaded position is a new start, steps before it cannot be undone */
+    me->history.qsteps = 0;
+
+    if (me->ai) {
+        const int status = me->ai->set_state(me->ai, me->state);
+        if (status != 0) {
+            fprintf(me->err, "AI cannot set position: %s\n", me->ai->error);
+            return restore_backup(me, history_qsteps);
+        }
+    }
+}
+
+void process_set_ai_param(struct cmd_parser * restrict const me)
+{
+    int status;
+    struct line_parser * restrict const lp = &me->line_parser;
+    parser_skip_spaces(lp);
+
+    status = parser_read_id(lp);
+    if (status != 0) {
+        error(me, "AI parameter name expected.");
+        return;
+    }
+
+    const size_t id_len = lp->current - lp->lexem_start;
     struct ai * restrict const ai = get_ai(me);
     if (ai == NULL) {
         return;
@@ -831,7 +1321,7 @@ void process_set_ai_param(struct cmd_parser * restrict const me)
 
     const struct ai_param * const param = find_ai_param(ai, lp->lexem_start, id_len);
     if (param == NULL) {
-        error(lp, "Param is not found.");
+        error(me, "Param is not found.");
         return;
     }
 
@@ -843,14 +1333,14 @@ void process_set_ai_param(struct cmd_parser * restrict const me)
 
     const size_t value_sz = param_sizes[param->type];
     char buf[value_sz];
-    status = read_value(lp, buf, param->type);
+    status = read_value(me, buf, param);
     if (status != 0) {
         return;
     }
 
     status = ai->set_param(ai, param->name, buf);
     if (status != 0) {
-        fprintf(stderr, "%s\n", ai->error);
+        fprintf(me->err, "%s\n", ai->error);
     }
 }
 
@@ -862,7 +1352,7 @@ void process_set_ai(struct cmd_parser * restrict const me)
     if (parser_check_eol(lp)) {
         const struct ai_desc * restrict ptr = ai_list;
         for (; ptr->name; ++ptr) {
-            printf("%s\n", ptr->name);
+            fprintf(me->out, "%s\n", ptr->name);
         }
         return;
     }
@@ -875,13 +1365,13 @@ void process_set_ai(struct cmd_parser * restrict const me)
     const unsigned char * const ai_name = lp->current;
     const int status = parser_read_id(lp);
     if (status != 0) {
-        error(lp, "Invalid AI name, valid identifier expected.");
+        error(me, "Invalid AI name, valid identifier expected.");
         return;
     }
     const size_t len = lp->current - ai_name;
 
     if (!parser_check_eol(lp)) {
-        error(lp, "End of line expected but something was found in SET AI command.");
+        error(me, "End of line expected but something was found in SET AI command.");
         return;
     }
 
@@ -897,16 +1387,15 @@ void process_set_ai(struct cmd_parser * restrict const me)
         }
     }
 
-    error(lp, "AI not found.");
+    error(me, "AI not found.");
 }
 
 void process_set(struct cmd_parser * restrict const me)
 {
-    struct line_parser * restrict const lp = &me->line_parser;
     const int keyword = read_keyword(me);
 
     if (keyword == -1) {
-        error(lp, "Invalid lexem in SET command.");
+        error(me, "Invalid lexem in SET command.");
         return;
     }
 
@@ -915,7 +1404,7 @@ void process_set(struct cmd_parser * restrict const me)
             return process_set_ai(me);
     }
 
-    error(lp, "Invalid option name in SET command.");
+    error(me, "Invalid option name in SET command.");
 }
 
 void process_ai_go(struct cmd_parser * restrict const me)
@@ -926,7 +1415,7 @@ void process_ai_go(struct cmd_parser * restrict const me)
     while (!parser_check_eol(lp)) {
         const int keyword = read_keyword(me);
         if (keyword == -1) {
-            error(lp, "Invalid lexem in AI GO command.");
+            error(me, "Invalid lexem in AI GO command.");
             return;
         }
 
@@ -940,8 +1429,11 @@ void process_ai_go(struct cmd_parser * restrict const me)
             case KW_STEPS:
                 flags |= 1 << EXPLAIN_STEPS;
                 break;
+            case KW_PV:
+                flags |= 1 << EXPLAIN_PV;
+                break;
             default:
-                error(lp, "Invalid explain flag in AI GO command.");
+                error(me, "Invalid explain flag in AI GO command.");
                 return;
         }
 
@@ -952,27 +1444,104 @@ void process_ai_go(struct cmd_parser * restrict const me)
         }
     }
 
-    ai_go(me, flags);
+    if (me->is_async) {
+        me->search_flags = flags;
+        start_search(me, search_thread);
+    } else {
+        ai_go(me, flags);
+    }
 }
 
 void process_ai_info(struct cmd_parser * restrict const me)
 {
     struct line_parser * restrict const lp = &me->line_parser;
     if (!parser_check_eol(lp)) {
-        error(lp, "End of line expected (AI INFO command is parsed), but someting was found.");
+        error(me, "End of line expected (AI INFO command is parsed), but someting was found.");
         return;
     }
 
     ai_info(me);
 }
 
-void process_ai(struct cmd_parser * restrict const me)
+/* AI SAVE-TREE FILE and AI LOAD-TREE FILE, file name is the rest of the line */
+void process_ai_tree(struct cmd_parser * restrict const me, const int keyword)
+{
+    struct line_parser * restrict const lp = &me->line_parser;
+    if (*lp->current != '-') {
+        error(me, "Dash expected, SAVE-TREE or LOAD-TREE is supported.");
+        return;
+    }
+
+    ++lp->current;
+    if (read_keyword(me) != KW_TREE) {
+        error(me, "TREE expected, SAVE-TREE or LOAD-TREE is supported.");
+        return;
+    }
+
+    parser_skip_spaces(lp);
+    const char * const path = (const char *)lp->current;
+    size_t len = strlen(path);
+    while (len > 0 && isspace((unsigned char)path[len-1])) {
+        --len;
+    }
+
+    if (len == 0) {
+        error(me, "File name expected.");
+        return;
+    }
+
+    struct ai * restrict const ai = get_ai(me);
+    if (ai == NULL) {
+        return;
+    }
+
+    /* Command line is not limited, so the name is on the heap */
+    char * const file_name = strndup(path, len);
+    if (file_name == NULL) {
+        error(me, "Out of memory.");
+        return;
+    }
+
+    const int status = keyword == KW_SAVE ? ai->save_tree(ai, file_name) : ai->load_tree(ai, file_name);
+    if (status != 0) {
+        fprintf(me->err, "AI %s tree failed: %s\n", keyword == KW_SAVE ? "save" : "load", ai->error);
+    }
+    free(file_name);
+}
+
+void process_ai_analyze(struct cmd_parser * restrict const me)
 {
     struct line_parser * restrict const lp = &me->line_parser;
+
+    int interval = 1000;
+    if (!parser_check_eol(lp)) {
+        const int status = parser_read_last_int(lp, &interval);
+        if (status != 0 || interval <= 0) {
+            error(me, "Positive report interval in milliseconds expected in AI ANALYZE command.");
+            return;
+        }
+    }
+
+    if (!me->is_async) {
+        fprintf(me->err, "AI analyze runs until STOP, it is not supported in this mode.\n");
+        return;
+    }
+
+    if (state_status(me->state) != IN_PROGRESS) {
+        fprintf(me->err, "Game over, nothing to analyze.\n");
+        return;
+    }
+
+    me->analyze_interval = 0.001 * interval;
+    start_search(me, analyze_thread);
+}
+
+void process_ai(struct cmd_parser * restrict const me)
+{
     const int keyword = read_keyword(me);
 
     if (keyword == -1) {
-        error(lp, "Invalid lexem in AI command.");
+        error(me, "Invalid lexem in AI command.");
         return;
     }
 
@@ -981,9 +1550,14 @@ void process_ai(struct cmd_parser * restrict const me)
             return process_ai_go(me);
         case KW_INFO:
             return process_ai_info(me);
+        case KW_ANALYZE:
+            return process_ai_analyze(me);
+        case KW_SAVE:
+        case KW_LOAD:
+            return process_ai_tree(me, keyword);
     }
 
-    error(lp, "Invalid action in AI command.");
+    error(me, "Invalid action in AI command.");
 }
 
 int process_cmd(struct cmd_parser * restrict const me, const char * const line)
@@ -997,24 +1571,39 @@ int process_cmd(struct cmd_parser * restrict const me, const char * const line)
 
     const int keyword = read_keyword(me);
     if (keyword == -1) {
-        error(lp, "Invalid lexem at the begginning of the line.");
+        error(me, "Invalid lexem at the begginning of the line.");
         return 0;
     }
 
     if (keyword == 0) {
-        error(lp, "Invalid keyword at the begginning of the line.");
+        error(me, "Invalid keyword at the begginning of the line.");
         return 0;
     }
 
     if (keyword == KW_QUIT) {
+        stop_search(me);
         return process_quit(me);
     }
 
+    /* Only PING and STOP are answered while AI is thinking */
+    if (keyword != KW_PING && keyword != KW_STOP) {
+        finish_search(me);
+    }
+
     switch (keyword) {
         case KW_PING:
-            printf("pong%s", lp->current);
-            fflush(stdout);
-            fflush(stderr);
+            flockfile(me->out);
+            fprintf(me->out, "pong%s", lp->current);
+            fflush(me->out);
+            funlockfile(me->out);
+            fflush(me->err);
+            break;
+        case KW_STOP:
+            if (!parser_check_eol(lp)) {
+                error(me, "End of line expected (STOP command is parsed), but someting was found.");
+                break;
+            }
+            stop_search(me);
             break;
         case KW_STATUS:
             process_status(me);
@@ -1028,6 +1617,9 @@ int process_cmd(struct cmd_parser * restrict const me, const char * const line)
         case KW_HISTORY:
             process_history(me);
             break;
+        case KW_POSITION:
+            process_position(me);
+            break;
         case KW_SET:
             process_set(me);
             break;
@@ -1035,40 +1627,1869 @@ int process_cmd(struct cmd_parser * restrict const me, const char * const line)
             process_ai(me);
             break;
         default:
-            error(lp, "Unexpected keyword at the begginning of the line.");
+            error(me, "Unexpected keyword at the begginning of the line.");
             break;
     }
 
     return 0;
 }
 
-int main()
+/*
+ * Binary protocol
+ *
+ * Request:  u32 length, u8 op, payload (length counts op and payload).
+ * Response: u32 length, u8 op, u8 status (0 or errno), payload.
+ * Integers are little endian, step lists are u16 count and 3 bit step codes
+ * packed from the lowest bit. Responses are buffered, op | BIN_FLUSH asks to
+ * flush stdout after the response, it is flushed at exit as well.
+ */
+
+#define BIN_NEW         1
+#define BIN_STEP        2
+#define BIN_GO          3
+#define BIN_STATUS      4
+#define BIN_FLUSH    0x80
+
+#define BIN_MAX_FRAME   (2 + 3 * 65535 / 8 + 16)
+
+struct bin_frame
 {
-    struct cmd_parser cmd_parser;
-    const int status = init_cmd_parser(&cmd_parser);
+    uint32_t len;
+    uint8_t data[BIN_MAX_FRAME];
+};
+
+static uint32_t read_u32(const uint8_t * const ptr)
+{
+    return (uint32_t)ptr[0] | (uint32_t)ptr[1] << 8 | (uint32_t)ptr[2] << 16 | (uint32_t)ptr[3] << 24;
+}
+
+static void write_u32(uint8_t * restrict const ptr, const uint32_t value)
+{
+    ptr[0] = value;
+    ptr[1] = value >> 8;
+    ptr[2] = value >> 16;
+    ptr[3] = value >> 24;
+}
+
+static size_t packed_steps_sz(const unsigned int qsteps)
+{
+    return (3 * qsteps + 7) / 8;
+}
+
+static void pack_steps(
+    uint8_t * restrict const ptr,
+    const unsigned int qsteps,
+    const enum step * const steps)
+{
+    memset(ptr, 0, packed_steps_sz(qsteps));
+    for (unsigned int i=0; i<qsteps; ++i) {
+        const unsigned int bit = 3 * i;
+        const unsigned int code = steps[i] << (bit % 8);
+        ptr[bit / 8] |= code;
+        if (bit % 8 > 5) {
+            ptr[bit / 8 + 1] |= code >> 8;
+        }
+    }
+}
+
+static enum step unpack_step(const uint8_t * const ptr, const unsigned int i)
+{
+    const unsigned int bit = 3 * i;
+    unsigned int code = ptr[bit / 8] >> (bit % 8);
+    if (bit % 8 > 5) {
+        code |= ptr[bit / 8 + 1] << (8 - bit % 8);
+    }
+    return code & 0x07;
+}
+
+static int bin_new(
+    struct cmd_parser * restrict const me,
+    const struct bin_frame * const request)
+{
+    if (request->len != 6) {
+        return EINVAL;
+    }
+
+    const uint8_t * const args = request->data + 1;
+    const enum board_shape board_shape = args[0];
+    if (board_shape != SOCCER && board_shape != HOCKEY) {
+        return EINVAL;
+    }
+
+    const int depth = board_shape == HOCKEY ? args[4] : 0;
+    struct geometry * restrict geometry = acquire_geometry(me->err, board_shape, args[1], args[2], args[3], depth);
+    if (geometry == NULL) {
+        return EINVAL;
+    }
+
+    const int status = new_game(me, geometry);
     if (status != 0) {
+        release_geometry(geometry);
         return status;
     }
 
-    char * line = 0;
-    size_t len = 0;
-    for (;; ) {
-        const ssize_t has_read = getline(&line, &len, stdin);
-        if (has_read == -1) {
-            break;
+    me->board_shape = board_shape;
+    me->width = args[1];
+    me->height = args[2];
+    me->goal_width = args[3];
+    me->depth = depth;
+    return 0;
+}
+
+static int bin_step(
+    struct cmd_parser * restrict const me,
+    const struct bin_frame * const request)
+{
+    if (request->len < 3) {
+        return EINVAL;
+    }
+
+    const uint8_t * const args = request->data + 1;
+    const unsigned int qsteps = args[0] | args[1] << 8;
+    if (request->len != 3 + packed_steps_sz(qsteps)) {
+        return EINVAL;
+    }
+
+    state_copy(me->backup, me->state);
+    const unsigned int history_qsteps = me->history.qsteps;
+    for (unsigned int i=0; i<qsteps; ++i) {
+        const enum step step = unpack_step(args + 2, i);
+        const int ball = state_step(me->state, step);
+        if (ball == NO_WAY) {
+            restore_backup(me, history_qsteps);
+            return EINVAL;
         }
 
-        const int is_quit = process_cmd(&cmd_parser, line);
-        if (is_quit) {
-            break;
+        const int status = history_push(&me->history, step);
+        if (status != 0) {
+            restore_backup(me, history_qsteps);
+            return status;
         }
     }
 
-    free_cmd_parser(&cmd_parser);
+    if (me->ai) {
+        const enum step * const new_steps = me->history.steps + history_qsteps;
+        const int status = me->ai->do_steps(me->ai, qsteps, new_steps);
+        if (status != 0) {
+            restore_backup(me, history_qsteps);
+            return status;
+        }
+    }
 
-    if (line) {
-        free(line);
+    return 0;
+}
+
+static int bin_go(
+    struct cmd_parser * restrict const me,
+    struct bin_frame * restrict const response)
+{
+    const unsigned int history_qsteps = me->history.qsteps;
+    const int status = ai_play(me, 0);
+    if (status != 0) {
+        return status;
+    }
+
+    const unsigned int qsteps = me->history.qsteps - history_qsteps;
+    uint8_t * restrict const ptr = response->data + response->len;
+    ptr[0] = qsteps;
+    ptr[1] = qsteps >> 8;
+    pack_steps(ptr + 2, qsteps, me->history.steps + history_qsteps);
+    response->len += 2 + packed_steps_sz(qsteps);
+    return 0;
+}
+
+/* Status payload: u8 game status, u8 active, u8 possible steps mask, i16 ball x and y (-1 in goal) */
+static int bin_status(
+    struct cmd_parser * restrict const me,
+    struct bin_frame * restrict const response)
+{
+    const struct state * const state = me->state;
+    const int ball = state->ball;
+    const int16_t x = ball >= 0 ? state->geometry->coords[2*ball + 0] : -1;
+    const int16_t y = ball >= 0 ? state->geometry->coords[2*ball + 1] : -1;
+
+    uint8_t * restrict const ptr = response->data + response->len;
+    ptr[0] = state_status(state);
+    ptr[1] = state->active;
+    ptr[2] = state_get_steps(state);
+    ptr[3] = x;
+    ptr[4] = (uint16_t)x >> 8;
+    ptr[5] = y;
+    ptr[6] = (uint16_t)y >> 8;
+    response->len += 7;
+    return 0;
+}
+
+static int read_frame(struct bin_frame * restrict const frame)
+{
+    uint8_t header[4];
+    if (fread(header, 1, 4, stdin) != 4) {
+        return EOF;
+    }
+
+    /* Too long frames are skipped and answered with an error */
+    const uint32_t len = read_u32(header);
+    const uint32_t qread = len <= BIN_MAX_FRAME ? len : 0;
+    if (fread(frame->data, 1, qread, stdin) != qread) {
+        return EOF;
+    }
+
+    for (uint32_t i = qread; i < len; ++i) {
+        if (getchar() == EOF) {
+            return EOF;
+        }
+    }
+
+    frame->len = qread;
+    return 0;
+}
+
+static int process_bin(struct cmd_parser * restrict const me)
+{
+    static struct bin_frame request, response;
+
+    /* Responses are flushed only on request, stdout buffer keeps a batch */
+    static char out_buf[1 << 16];
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+
+    while (read_frame(&request) == 0) {
+        const uint8_t op = request.len > 0 ? request.data[0] : 0;
+        response.data[0] = op;
+        response.len = 2;
+
+        int status = EINVAL;
+        switch (op & ~BIN_FLUSH) {
+            case BIN_NEW:
+                status = bin_new(me, &request);
+                break;
+            case BIN_STEP:
+                status = bin_step(me, &request);
+                break;
+            case BIN_GO:
+                status = request.len == 1 ? bin_go(me, &response) : EINVAL;
+                break;
+            case BIN_STATUS:
+                status = request.len == 1 ? bin_status(me, &response) : EINVAL;
+                break;
+        }
+
+        if (status != 0) {
+            response.len = 2;
+        }
+        response.data[1] = status;
+
+        uint8_t header[4];
+        write_u32(header, response.len);
+        fwrite(header, 1, 4, stdout);
+        fwrite(response.data, 1, response.len, stdout);
+
+        if (op & BIN_FLUSH) {
+            fflush(stdout);
+        }
     }
 
+    fflush(stdout);
     return 0;
 }
+
+/*
+ * Daemon mode
+ *
+ * paper-football --daemon PATH [WORKERS] listens on Unix domain socket PATH,
+ * every connection is a session with own game speaking the text protocol.
+ * Main thread polls idle sessions and buffers input, complete lines are
+ * executed by a fixed pool of worker threads. One session is handled by one
+ * worker at a time, so commands of a session keep their order, but a long
+ * AI GO does not block other sessions. Sessions share board geometries.
+ * SIGINT or SIGTERM stops the daemon, the socket file is removed on exit.
+ */
+
+#define SESSION_MAX_LINE  (1 << 16)
+
+struct session
+{
+    struct session * next;
+    struct session * next_job;
+    int fd;
+
+    /* Queued or executed by a worker: buffer belongs to the worker */
+    int is_busy;
+    int is_eof;
+    int is_quit;
+
+    /* Room for the line feed added to the last line and terminator */
+    size_t qbuf;
+    char buf[SESSION_MAX_LINE + 2];
+
+    struct cmd_parser cmd_parser;
+};
+
+struct daemon
+{
+    int listen_fd;
+    int wake_fds[2];
+
+    pthread_mutex_t mutex;
+    pthread_cond_t has_job;
+    struct session * first_job;
+    struct session * last_job;
+    int is_stopping;
+
+    unsigned int qworkers;
+    pthread_t * workers;
+
+    struct session * sessions;
+    unsigned int qsessions;
+};
+
+static volatile sig_atomic_t daemon_stop_signal = 0;
+static int daemon_wake_fd = -1;
+
+/* Self-pipe: poll wakes up even if the signal comes just before it */
+static void on_daemon_stop(int signum)
+{
+    const int saved_errno = errno;
+    daemon_stop_signal = signum;
+
+    const char wake = 0;
+    if (daemon_wake_fd != -1 && write(daemon_wake_fd, &wake, 1) == -1) {
+        /* Pipe is full, main thread is going to wake up anyway */
+    }
+    errno = saved_errno;
+}
+
+static struct session * create_session(const int fd)
+{
+    struct session * restrict const me = malloc(sizeof(struct session));
+    if (me == NULL) {
+        return NULL;
+    }
+
+    const int out_fd = dup(fd);
+    FILE * const out = out_fd == -1 ? NULL : fdopen(out_fd, "w");
+    if (out == NULL) {
+        if (out_fd != -1) {
+            close(out_fd);
+        }
+        free(me);
+        return NULL;
+    }
+
+    /* Errors are sent to the client in order with regular output */
+    const int status = init_cmd_parser(&me->cmd_parser, out, out);
+    if (status != 0) {
+        fclose(out);
+        free(me);
+        return NULL;
+    }
+
+    me->next = NULL;
+    me->next_job = NULL;
+    me->fd = fd;
+    me->is_busy = 0;
+    me->is_eof = 0;
+    me->is_quit = 0;
+    me->qbuf = 0;
+    return me;
+}
+
+static void destroy_session(struct session * restrict const me)
+{
+    FILE * const out = me->cmd_parser.out;
+    free_cmd_parser(&me->cmd_parser);
+    fclose(out);
+    close(me->fd);
+    free(me);
+}
+
+/* Worker side: execute all complete lines in the buffer */
+static void run_session(struct session * restrict const me)
+{
+    char * line = me->buf;
+    char * const end = me->buf + me->qbuf;
+
+    while (!me->is_quit) {
+        char * const eol = memchr(line, '\n', end - line);
+        if (eol == NULL) {
+            break;
+        }
+
+        /* Keep line feed, the text protocol expects it at the end of line */
+        const char saved = eol[1];
+        eol[1] = '\0';
+        me->is_quit = process_cmd(&me->cmd_parser, line);
+        eol[1] = saved;
+        line = eol + 1;
+    }
+
+    me->qbuf = end - line;
+    memmove(me->buf, line, me->qbuf);
+    fflush(me->cmd_parser.out);
+}
+
+static void * daemon_worker(void * arg)
+{
+    struct daemon * restrict const me = arg;
+
+    pthread_mutex_lock(&me->mutex);
+    for (;;) {
+        while (me->first_job == NULL && !me->is_stopping) {
+            pthread_cond_wait(&me->has_job, &me->mutex);
+        }
+
+        struct session * restrict const session = me->first_job;
+        if (session == NULL) {
+            break;
+        }
+
+        me->first_job = session->next_job;
+        if (me->first_job == NULL) {
+            me->last_job = NULL;
+        }
+        pthread_mutex_unlock(&me->mutex);
+
+        run_session(session);
+
+        pthread_mutex_lock(&me->mutex);
+        session->is_busy = 0;
+        const char wake = 0;
+        if (write(me->wake_fds[1], &wake, 1) == -1) {
+            /* Pipe is full, main thread is going to wake up anyway */
+        }
+    }
+    pthread_mutex_unlock(&me->mutex);
+
+    return NULL;
+}
+
+/* Main thread side, called with unlocked mutex */
+static void queue_session(
+    struct daemon * restrict const me,
+    struct session * restrict const session)
+{
+    pthread_mutex_lock(&me->mutex);
+    session->is_busy = 1;
+    session->next_job = NULL;
+    if (me->last_job) {
+        me->last_job->next_job = session;
+    } else {
+        me->first_job = session;
+    }
+    me->last_job = session;
+    pthread_cond_signal(&me->has_job);
+    pthread_mutex_unlock(&me->mutex);
+}
+
+static void read_session(
+    struct daemon * restrict const me,
+    struct session * restrict const session)
+{
+    char * const buf = session->buf;
+    const size_t space = SESSION_MAX_LINE - session->qbuf;
+    const ssize_t qread = read(session->fd, buf + session->qbuf, space);
+
+    if (qread <= 0) {
+        session->is_eof = 1;
+        if (session->qbuf == 0) {
+            return;
+        }
+        /* Last line without line feed */
+        buf[session->qbuf++] = '\n';
+        queue_session(me, session);
+        return;
+    }
+
+    const size_t old_qbuf = session->qbuf;
+    session->qbuf += qread;
+    if (memchr(buf + old_qbuf, '\n', qread) != NULL) {
+        queue_session(me, session);
+        return;
+    }
+
+    if (session->qbuf == SESSION_MAX_LINE) {
+        fprintf(session->cmd_parser.err, "Line is too long, at most %d bytes are supported.\n", SESSION_MAX_LINE);
+        fflush(session->cmd_parser.err);
+        session->is_eof = 1;
+        session->qbuf = 0;
+    }
+}
+
+static void accept_session(struct daemon * restrict const me)
+{
+    const int fd = accept(me->listen_fd, NULL, NULL);
+    if (fd == -1) {
+        return;
+    }
+
+    struct session * restrict const session = create_session(fd);
+    if (session == NULL) {
+        fprintf(stderr, "Cannot create session, connection is closed.\n");
+        close(fd);
+        return;
+    }
+
+    session->next = me->sessions;
+    me->sessions = session;
+    ++me->qsessions;
+}
+
+/* Remove finished sessions, returns number of sessions to poll */
+static unsigned int collect_sessions(struct daemon * restrict const me)
+{
+    unsigned int qidle = 0;
+
+    pthread_mutex_lock(&me->mutex);
+    struct session ** link = &me->sessions;
+    while (*link != NULL) {
+        struct session * const session = *link;
+        if (session->is_busy) {
+            link = &session->next;
+            continue;
+        }
+
+        if (session->is_eof || session->is_quit) {
+            *link = session->next;
+            --me->qsessions;
+            destroy_session(session);
+            continue;
+        }
+
+        ++qidle;
+        link = &session->next;
+    }
+    pthread_mutex_unlock(&me->mutex);
+
+    return qidle;
+}
+
+static int open_daemon_socket(const char * const path)
+{
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long.\n", path);
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    /* Socket left by a killed daemon */
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        fprintf(stderr, "socket failed with code %d: %s.\n", errno, strerror(errno));
+        return -1;
+    }
+
+    if (bind(fd, (const struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "Cannot listen %s, code %d: %s.\n", path, errno, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static int start_workers(struct daemon * restrict const me)
+{
+    /* Stop signals are handled by main thread, workers inherit the mask */
+    sigset_t stop_signals, old_mask;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &old_mask);
+
+    me->workers = malloc(me->qworkers * sizeof(pthread_t));
+    if (me->workers == NULL) {
+        pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+        return ENOMEM;
+    }
+
+    int status = 0;
+    unsigned int i = 0;
+    for (; i < me->qworkers; ++i) {
+        status = pthread_create(me->workers + i, NULL, daemon_worker, me);
+        if (status != 0) {
+            break;
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    me->qworkers = i;
+    return status;
+}
+
+static void stop_workers(struct daemon * restrict const me)
+{
+    pthread_mutex_lock(&me->mutex);
+    me->is_stopping = 1;
+    pthread_cond_broadcast(&me->has_job);
+
+    /* AI GO in progress plays the best step found so far */
+    for (struct session * ptr = me->sessions; ptr != NULL; ptr = ptr->next) {
+        if (ptr->is_busy) {
+            interrupt_cmd_parser(&ptr->cmd_parser);
+        }
+    }
+    pthread_mutex_unlock(&me->mutex);
+
+    for (unsigned int i = 0; i < me->qworkers; ++i) {
+        pthread_join(me->workers[i], NULL);
+    }
+    free(me->workers);
+}
+
+static int daemon_loop(struct daemon * restrict const me)
+{
+    struct pollfd * fds = NULL;
+    struct session ** polled = NULL;
+    unsigned int capacity = 0;
+
+    while (daemon_stop_signal == 0) {
+        const unsigned int qidle = collect_sessions(me);
+        if (qidle + 2 > capacity) {
+            capacity = 2 * (qidle + 2);
+            struct pollfd * const new_fds = realloc(fds, capacity * sizeof(struct pollfd));
+            if (new_fds != NULL) {
+                fds = new_fds;
+            }
+            struct session ** const new_polled = realloc(polled, capacity * sizeof(struct session *));
+            if (new_polled != NULL) {
+                polled = new_polled;
+            }
+            if (new_fds == NULL || new_polled == NULL) {
+                fprintf(stderr, "Cannot allocate poll set.\n");
+                break;
+            }
+        }
+
+        fds[0].fd = me->listen_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = me->wake_fds[0];
+        fds[1].events = POLLIN;
+
+        /* Busy flags are cleared only by workers, so idle sessions stay idle */
+        nfds_t qfds = 2;
+        pthread_mutex_lock(&me->mutex);
+        for (struct session * ptr = me->sessions; ptr != NULL; ptr = ptr->next) {
+            if (!ptr->is_busy) {
+                fds[qfds].fd = ptr->fd;
+                fds[qfds].events = POLLIN;
+                polled[qfds] = ptr;
+                ++qfds;
+            }
+        }
+        pthread_mutex_unlock(&me->mutex);
+
+        const int qready = poll(fds, qfds, -1);
+        if (qready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "poll failed with code %d: %s.\n", errno, strerror(errno));
+            break;
+        }
+
+        if (fds[1].revents) {
+            char buf[256];
+            if (read(me->wake_fds[0], buf, sizeof(buf)) == -1) {
+                /* Nothing to drain */
+            }
+        }
+
+        for (nfds_t i = 2; i < qfds; ++i) {
+            if (fds[i].revents) {
+                read_session(me, polled[i]);
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            accept_session(me);
+        }
+    }
+
+    free(fds);
+    free(polled);
+    return 0;
+}
+
+static int run_daemon(const char * const path, const unsigned int qworkers)
+{
+    struct daemon daemon;
+    struct daemon * restrict const me = &daemon;
+
+    me->first_job = NULL;
+    me->last_job = NULL;
+    me->is_stopping = 0;
+    me->qworkers = qworkers;
+    me->workers = NULL;
+    me->sessions = NULL;
+    me->qsessions = 0;
+
+    if (pipe(me->wake_fds) != 0) {
+        fprintf(stderr, "pipe failed with code %d: %s.\n", errno, strerror(errno));
+        return errno;
+    }
+    fcntl(me->wake_fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(me->wake_fds[1], F_SETFL, O_NONBLOCK);
+
+    /* Clients may disconnect any time, write errors are enough */
+    daemon_wake_fd = me->wake_fds[1];
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_daemon_stop);
+    signal(SIGTERM, on_daemon_stop);
+
+    me->listen_fd = open_daemon_socket(path);
+    if (me->listen_fd == -1) {
+        daemon_wake_fd = -1;
+        close(me->wake_fds[0]);
+        close(me->wake_fds[1]);
+        return EINVAL;
+    }
+
+    pthread_mutex_init(&me->mutex, NULL);
+    pthread_cond_init(&me->has_job, NULL);
+
+    int status = start_workers(me);
+    if (status != 0) {
+        fprintf(stderr, "Cannot start workers, code %d: %s.\n", status, strerror(status));
+    } else {
+        status = daemon_loop(me);
+    }
+
+    stop_workers(me);
+
+    while (me->sessions != NULL) {
+        struct session * const session = me->sessions;
+        me->sessions = session->next;
+        destroy_session(session);
+    }
+
+    pthread_cond_destroy(&me->has_job);
+    pthread_mutex_destroy(&me->mutex);
+    close(me->listen_fd);
+    daemon_wake_fd = -1;
+    close(me->wake_fds[0]);
+    close(me->wake_fds[1]);
+    unlink(path);
+    return status;
+}
+
+static int daemon_main(const int argc, char * argv[])
+{
+    if (argc < 1 || argc > 2) {
+        fprintf(stderr, "Usage: paper-football --daemon PATH [WORKERS]\n");
+        return EINVAL;
+    }
+
+    long qworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (argc == 2) {
+        char * end;
+        qworkers = strtol(argv[1], &end, 10);
+        if (*end != '\0' || qworkers < 1 || qworkers > 1024) {
+            fprintf(stderr, "Invalid number of workers %s, integer from 1 to 1024 expected.\n", argv[1]);
+            return EINVAL;
+        }
+    }
+
+    if (qworkers < 1) {
+        qworkers = 1;
+    }
+
+    return run_daemon(argv[0], qworkers);
+}
+
+/*
+ * Batch analysis
+ *
+ * paper-football --analyze-batch [WORKERS] reads positions from stdin, one
+ * per line: a position text (see POSITION command) or a list of steps from
+ * the start. NEW and SET lines before the first position set the board and
+ * AI parameters of all engines. Empty lines and lines starting with # are
+ * skipped. For every position AI move is printed to stdout in input order:
+ *     move STEP ... score S
+ *     error MESSAGE
+ * Positions are split into contiguous ranges between WORKERS threads, every
+ * worker has own engine and steals the second half of the largest range
+ * left when its own range is exhausted. AI random generator is reseeded for
+ * every position, so results do not depend on the number of workers.
+ */
+
+struct batch_job
+{
+    char * line;
+    char * result;
+    int is_done;
+};
+
+struct batch_worker
+{
+    struct batch * batch;
+    pthread_t thread;
+    struct cmd_parser cmd_parser;
+
+    /* Memory stream keeps command output and errors of one position */
+    FILE * log;
+    char * log_buf;
+    size_t log_sz;
+
+    /* Jobs [first, last) are left, owner takes the first, thieves take the tail */
+    pthread_mutex_t mutex;
+    size_t first;
+    size_t last;
+};
+
+/* Worker side: result line for a job, collect is called in input order */
+typedef char * (*batch_analyze_func)(struct batch_worker * restrict const worker, const char * const line);
+typedef void (*batch_collect_func)(struct batch * restrict const me, const size_t index, const int is_next_ready);
+
+struct batch
+{
+    struct batch_job * jobs;
+    size_t qjobs;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t has_result;
+
+    unsigned int qworkers;
+    struct batch_worker * workers;
+
+    batch_analyze_func analyze;
+    void * context;
+};
+
+static int init_batch_worker(struct batch_worker * restrict const me)
+{
+    me->log_buf = NULL;
+    me->log_sz = 0;
+    me->log = open_memstream(&me->log_buf, &me->log_sz);
+    if (me->log == NULL) {
+        return errno;
+    }
+
+    const int status = init_cmd_parser(&me->cmd_parser, me->log, me->log);
+    if (status != 0) {
+        fclose(me->log);
+        free(me->log_buf);
+        return status;
+    }
+
+    pthread_mutex_init(&me->mutex, NULL);
+    me->first = 0;
+    me->last = 0;
+    return 0;
+}
+
+static void free_batch_worker(struct batch_worker * restrict const me)
+{
+    pthread_mutex_destroy(&me->mutex);
+    free_cmd_parser(&me->cmd_parser);
+    fclose(me->log);
+    free(me->log_buf);
+}
+
+/* Returns text written to the log since the last call, NULL if nothing */
+static const char * take_log(struct batch_worker * restrict const me)
+{
+    fflush(me->log);
+    const long len = ftell(me->log);
+    fseek(me->log, 0, SEEK_SET);
+    if (len <= 0) {
+        return NULL;
+    }
+
+    me->log_buf[len] = '\0';
+    return me->log_buf;
+}
+
+static int take_job(struct batch_worker * restrict const me, size_t * restrict const index)
+{
+    pthread_mutex_lock(&me->mutex);
+    const int has_job = me->first < me->last;
+    if (has_job) {
+        *index = me->first++;
+    }
+    pthread_mutex_unlock(&me->mutex);
+    return has_job;
+}
+
+static int steal_jobs(struct batch_worker * restrict const me)
+{
+    struct batch * restrict const batch = me->batch;
+
+    /* Victim range may shrink after the choice, it is checked again */
+    struct batch_worker * victim = NULL;
+    size_t max_left = 0;
+    for (unsigned int i = 0; i < batch->qworkers; ++i) {
+        struct batch_worker * const other = batch->workers + i;
+        if (other == me) {
+            continue;
+        }
+
+        pthread_mutex_lock(&other->mutex);
+        const size_t left = other->last > other->first ? other->last - other->first : 0;
+        pthread_mutex_unlock(&other->mutex);
+
+        if (left > max_left) {
+            max_left = left;
+            victim = other;
+        }
+    }
+
+    if (victim == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&victim->mutex);
+    const size_t left = victim->last > victim->first ? victim->last - victim->first : 0;
+    const size_t qstolen = (left + 1) / 2;
+    const size_t last = victim->last;
+    victim->last -= qstolen;
+    pthread_mutex_unlock(&victim->mutex);
+
+    if (qstolen == 0) {
+        return 1;
+    }
+
+    pthread_mutex_lock(&me->mutex);
+    me->first = last - qstolen;
+    me->last = last;
+    pthread_mutex_unlock(&me->mutex);
+    return 1;
+}
+
+/* AI plays a move in the position, result is a line without line feed */
+static char * batch_play(struct batch_worker * restrict const me)
+{
+    struct cmd_parser * restrict const parser = &me->cmd_parser;
+    struct state * restrict const state = parser->state;
+
+    struct ai * restrict const ai = get_ai(parser);
+    if (ai == NULL) {
+        return NULL;
+    }
+
+    if (state_status(state) != IN_PROGRESS) {
+        fprintf(me->log, "Game over, no moves possible.\n");
+        return NULL;
+    }
+
+    char * result = NULL;
+    size_t result_sz = 0;
+    FILE * const out = open_memstream(&result, &result_sz);
+    if (out == NULL) {
+        fprintf(me->log, "Cannot open result stream.\n");
+        return NULL;
+    }
+
+    fprintf(out, "move");
+    const int active = state->active;
+    double score = -1.0;
+    int is_first = 1;
+
+    while (state_status(state) == IN_PROGRESS && state->active == active) {
+        struct ai_explanation explanation;
+        const enum step step = ai->go(ai, is_first ? &explanation : NULL);
+        if (step == INVALID_STEP) {
+            fprintf(me->log, "AI move failed: %s\n", ai->error ? ai->error : "invalid step");
+            break;
+        }
+
+        if (is_first) {
+            score = explanation.score;
+            is_first = 0;
+        }
+
+        if (state_step(state, step) == NO_WAY || ai->do_step(ai, step) != 0) {
+            fprintf(me->log, "Invalid AI step %s.\n", step_names[step]);
+            break;
+        }
+
+        fprintf(out, " %s", step_names[step]);
+    }
+
+    if (score >= 0.0 && score <= 1.0) {
+        fprintf(out, " score %.4f", score);
+    } else {
+        fprintf(out, " score N/A");
+    }
+
+    fclose(out);
+    return result;
+}
+
+static char * batch_error(const char * const log)
+{
+    const size_t len = strcspn(log, "\n");
+    char * const result = malloc(len + 7);
+    if (result != NULL) {
+        memcpy(result, "error ", 6);
+        memcpy(result + 6, log, len);
+        result[len + 6] = '\0';
+    }
+    return result;
+}
+
+/* Sets up a new game in the position, returns NULL or error result */
+static char * batch_setup(
+    struct batch_worker * restrict const me,
+    const char * const line)
+{
+    struct cmd_parser * restrict const parser = &me->cmd_parser;
+
+    /*
+     * Every position starts a new game on the same board with the same AI
+     * seed and an empty memo, so results do not depend on the worker
+     */
+    struct geometry * restrict const geometry = acquire_geometry(parser->err,
+        parser->board_shape, parser->width, parser->height, parser->goal_width, parser->depth);
+    if (geometry == NULL || new_game(parser, geometry) != 0) {
+        if (geometry != NULL) {
+            release_geometry(geometry);
+        }
+        return batch_error("Cannot start new game.");
+    }
+
+    struct ai * restrict const ai = get_ai(parser);
+    const struct ai_param * const seed = ai ? find_ai_param(ai, "seed", 4) : NULL;
+    if (seed != NULL) {
+        ai->set_param(ai, "seed", seed->value);
+    }
+
+    const struct ai_param * const memo = ai ? find_ai_param(ai, "memo", 4) : NULL;
+    if (memo != NULL) {
+        ai->set_param(ai, "memo", memo->value);
+    }
+
+    /* Batch lines are not limited, so the command is on the heap */
+    const char * const cmd = strncmp(line, "pf_", 3) == 0 ? "position " : "step ";
+    char * const cmd_line = malloc(strlen(cmd) + strlen(line) + 2);
+    if (cmd_line == NULL) {
+        return batch_error("Out of memory.");
+    }
+
+    sprintf(cmd_line, "%s%s\n", cmd, line);
+    process_cmd(parser, cmd_line);
+    free(cmd_line);
+
+    const char * const log = take_log(me);
+    return log != NULL ? batch_error(log) : NULL;
+}
+
+static char * batch_analyze(
+    struct batch_worker * restrict const me,
+    const char * const line)
+{
+    char * const error = batch_setup(me, line);
+    if (error != NULL) {
+        return error;
+    }
+
+    char * const result = batch_play(me);
+    const char * const log = take_log(me);
+    if (log != NULL) {
+        free(result);
+        return batch_error(log);
+    }
+
+    return result;
+}
+
+static void * batch_worker(void * arg)
+{
+    struct batch_worker * restrict const me = arg;
+    struct batch * restrict const batch = me->batch;
+
+    for (;;) {
+        size_t index;
+        if (!take_job(me, &index)) {
+            if (steal_jobs(me)) {
+                continue;
+            }
+            break;
+        }
+
+        struct batch_job * restrict const job = batch->jobs + index;
+        char * const result = batch->analyze(me, job->line);
+
+        pthread_mutex_lock(&batch->mutex);
+        job->result = result;
+        job->is_done = 1;
+        pthread_cond_signal(&batch->has_result);
+        pthread_mutex_unlock(&batch->mutex);
+    }
+
+    return NULL;
+}
+
+static int is_batch_skip(const char * const line)
+{
+    return line[0] == '\0' || line[0] == '#';
+}
+
+static int is_batch_header(const char * const line)
+{
+    return strncasecmp(line, "new", 3) == 0 || strncasecmp(line, "set", 3) == 0;
+}
+
+/* Reads all lines, trailing spaces are cut */
+static int read_batch(struct batch * restrict const me, FILE * const input)
+{
+    size_t capacity = 0;
+
+    char * line = NULL;
+    size_t len = 0;
+    ssize_t qread;
+    while ((qread = getline(&line, &len, input)) != -1) {
+        while (qread > 0 && isspace((unsigned char)line[qread-1])) {
+            line[--qread] = '\0';
+        }
+
+        if (me->qjobs == capacity) {
+            capacity = capacity ? 2 * capacity : 1024;
+            struct batch_job * const jobs = realloc(me->jobs, capacity * sizeof(struct batch_job));
+            if (jobs == NULL) {
+                free(line);
+                return ENOMEM;
+            }
+            me->jobs = jobs;
+        }
+
+        me->jobs[me->qjobs].line = line;
+        me->jobs[me->qjobs].result = NULL;
+        me->jobs[me->qjobs].is_done = 0;
+        ++me->qjobs;
+        line = NULL;
+        len = 0;
+    }
+
+    free(line);
+    return 0;
+}
+
+/* Header lines are applied to every engine and removed with skipped lines */
+static int apply_batch_header(struct batch * restrict const me)
+{
+    size_t start = 0;
+    for (; start < me->qjobs; ++start) {
+        const char * const line = me->jobs[start].line;
+        if (is_batch_skip(line)) {
+            continue;
+        }
+
+        if (!is_batch_header(line)) {
+            break;
+        }
+
+        char * const cmd_line = malloc(strlen(line) + 2);
+        if (cmd_line == NULL) {
+            fprintf(stderr, "Cannot apply header: out of memory.\n");
+            return ENOMEM;
+        }
+
+        sprintf(cmd_line, "%s\n", line);
+        for (unsigned int i = 0; i < me->qworkers; ++i) {
+            struct batch_worker * restrict const worker = me->workers + i;
+            process_cmd(&worker->cmd_parser, cmd_line);
+            const char * const log = take_log(worker);
+            if (log != NULL) {
+                fprintf(stderr, "%s", log);
+                free(cmd_line);
+                return EINVAL;
+            }
+        }
+        free(cmd_line);
+    }
+
+    /* Only positions are left, they have results */
+    for (size_t i = 0; i < start; ++i) {
+        free(me->jobs[i].line);
+    }
+
+    size_t qjobs = 0;
+    for (size_t i = start; i < me->qjobs; ++i) {
+        if (!is_batch_skip(me->jobs[i].line)) {
+            me->jobs[qjobs++] = me->jobs[i];
+        } else {
+            free(me->jobs[i].line);
+        }
+    }
+    me->qjobs = qjobs;
+    return 0;
+}
+
+static int run_batch_jobs(struct batch * restrict const me, batch_collect_func collect)
+{
+    const size_t qjobs = me->qjobs;
+    for (unsigned int i = 0; i < me->qworkers; ++i) {
+        struct batch_worker * restrict const worker = me->workers + i;
+        worker->first = qjobs * i / me->qworkers;
+        worker->last = qjobs * (i + 1) / me->qworkers;
+    }
+
+    unsigned int qstarted = 0;
+    for (; qstarted < me->qworkers; ++qstarted) {
+        struct batch_worker * restrict const worker = me->workers + qstarted;
+        if (pthread_create(&worker->thread, NULL, batch_worker, worker) != 0) {
+            break;
+        }
+    }
+
+    if (qstarted == 0) {
+        fprintf(stderr, "Cannot start batch workers.\n");
+        return EAGAIN;
+    }
+
+    /* Results are collected in input order as soon as they are ready */
+    for (size_t i = 0; i < qjobs; ++i) {
+        pthread_mutex_lock(&me->mutex);
+        while (!me->jobs[i].is_done) {
+            pthread_cond_wait(&me->has_result, &me->mutex);
+        }
+        const int is_next_ready = i + 1 < qjobs && me->jobs[i+1].is_done;
+        pthread_mutex_unlock(&me->mutex);
+
+        collect(me, i, is_next_ready);
+    }
+
+    for (unsigned int i = 0; i < qstarted; ++i) {
+        pthread_join(me->workers[i].thread, NULL);
+    }
+
+    return 0;
+}
+
+/* Results are streamed to stdout, output is flushed when the next one is not ready */
+static void print_batch_result(
+    struct batch * restrict const me,
+    const size_t index,
+    const int is_next_ready)
+{
+    const char * const result = me->jobs[index].result;
+    printf("%s\n", result ? result : "error Out of memory.");
+    if (!is_next_ready) {
+        fflush(stdout);
+    }
+}
+
+static void free_batch_jobs(struct batch * restrict const me)
+{
+    for (size_t i = 0; i < me->qjobs; ++i) {
+        free(me->jobs[i].line);
+        free(me->jobs[i].result);
+    }
+    free(me->jobs);
+    me->jobs = NULL;
+    me->qjobs = 0;
+}
+
+/* Engines are created before the input is read, so header lines are applied at once */
+static int init_batch(
+    struct batch * restrict const me,
+    const unsigned int qworkers,
+    batch_analyze_func analyze,
+    void * const context)
+{
+    me->jobs = NULL;
+    me->qjobs = 0;
+    me->analyze = analyze;
+    me->context = context;
+    me->qworkers = 0;
+    pthread_mutex_init(&me->mutex, NULL);
+    pthread_cond_init(&me->has_result, NULL);
+
+    me->workers = malloc(qworkers * sizeof(struct batch_worker));
+    if (me->workers == NULL) {
+        fprintf(stderr, "Cannot allocate batch workers.\n");
+        return ENOMEM;
+    }
+
+    for (; me->qworkers < qworkers; ++me->qworkers) {
+        struct batch_worker * restrict const worker = me->workers + me->qworkers;
+        worker->batch = me;
+        const int status = init_batch_worker(worker);
+        if (status != 0) {
+            fprintf(stderr, "Cannot create engine for batch worker, code %d: %s.\n", status, strerror(status));
+            return status;
+        }
+    }
+
+    return 0;
+}
+
+static void free_batch(struct batch * restrict const me)
+{
+    free_batch_jobs(me);
+
+    for (unsigned int i = 0; i < me->qworkers; ++i) {
+        free_batch_worker(me->workers + i);
+    }
+    free(me->workers);
+
+    pthread_cond_destroy(&me->has_result);
+    pthread_mutex_destroy(&me->mutex);
+}
+
+/* Number of workers or other count argument, default if arg is NULL */
+static int read_count(
+    const char * const arg,
+    const char * const name,
+    const long max,
+    long * restrict const value)
+{
+    if (arg == NULL) {
+        return 0;
+    }
+
+    char * end;
+    *value = strtol(arg, &end, 10);
+    if (*end != '\0' || *value < 1 || *value > max) {
+        fprintf(stderr, "Invalid %s %s, integer from 1 to %ld expected.\n", name, arg, max);
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+static long default_qworkers(void)
+{
+    const long qworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    return qworkers < 1 ? 1 : qworkers;
+}
+
+static int batch_main(const int argc, char * argv[])
+{
+    if (argc > 1) {
+        fprintf(stderr, "Usage: paper-football --analyze-batch [WORKERS] < positions\n");
+        return EINVAL;
+    }
+
+    long qworkers = default_qworkers();
+    if (read_count(argc == 1 ? argv[0] : NULL, "number of workers", 1024, &qworkers) != 0) {
+        return EINVAL;
+    }
+
+    struct batch batch;
+    struct batch * restrict const me = &batch;
+    int status = init_batch(me, qworkers, batch_analyze, NULL);
+
+    if (status == 0) {
+        status = read_batch(me, stdin);
+        if (status != 0) {
+            fprintf(stderr, "Cannot read positions, code %d: %s.\n", status, strerror(status));
+        }
+    }
+
+    if (status == 0) {
+        status = apply_batch_header(me);
+    }
+
+    if (status == 0) {
+        status = run_batch_jobs(me, print_batch_result);
+    }
+
+    free_batch(me);
+    return status;
+}
+
+/*
+ * Opening book build
+ *
+ * paper-football --book-build PATH [TURNS [WIDTH [WORKERS]]] reads NEW and
+ * SET lines and root positions from stdin as --analyze-batch does, the start
+ * position is the root if there are none. Positions are searched level by
+ * level with the batch pool, every position gives a book entry with the AI
+ * step. Positions after the AI step and WIDTH-1 other most visited steps
+ * are searched next if they are less than TURNS turns after the root.
+ * Positions are merged up to mirror, so every one is searched once.
+ */
+
+#define BOOK_MAX_TURNS   64
+
+struct book_child
+{
+    uint64_t hash;
+    unsigned int depth;
+    char * line;
+};
+
+struct book_builder
+{
+    unsigned int qturns;
+    unsigned int width;
+    int status;
+    size_t qerrors;
+
+    size_t qentries;
+    size_t entries_capacity;
+    struct book_entry * entries;
+
+    /* Turns from the root for every job of the level */
+    unsigned int * depths;
+
+    size_t qchildren;
+    size_t children_capacity;
+    struct book_child * children;
+};
+
+static int cmp_stats_by_games(const void * const a, const void * const b)
+{
+    const struct step_stat * const sa = a;
+    const struct step_stat * const sb = b;
+    if (sa->qgames > sb->qgames) return -1;
+    if (sa->qgames < sb->qgames) return +1;
+    return 0;
+}
+
+/*
+ * Worker result: "HASH STEP QGAMES" for the position (step for the canonical
+ * orientation), then "HASH TURN POSITION" for every next position, TURN is 1
+ * if the other player is active after the step.
+ */
+static char * book_search(
+    struct batch_worker * restrict const me,
+    const char * const line)
+{
+    const struct book_builder * const builder = me->batch->context;
+    struct cmd_parser * restrict const parser = &me->cmd_parser;
+
+    char * const error = batch_setup(me, line);
+    if (error != NULL) {
+        return error;
+    }
+
+    const struct state * const state = parser->state;
+    if (state_status(state) != IN_PROGRESS) {
+        return batch_error("Game over, no moves possible.");
+    }
+
+    struct ai * restrict const ai = get_ai(parser);
+    if (ai == NULL) {
+        const char * const log = take_log(me);
+        return batch_error(log ? log : "Cannot create AI.");
+    }
+
+    struct ai_explanation explanation;
+    const enum step step = ai->go(ai, &explanation);
+    if (step == INVALID_STEP) {
+        return batch_error(ai->error ? ai->error : "AI search failed.");
+    }
+
+    /* AI step goes first, other steps are sorted by visits */
+    struct step_stat stats[QSTEPS];
+    size_t qstats = explanation.qstats;
+    if (qstats == 0) {
+        stats[0].step = step;
+        stats[0].qgames = 0;
+        qstats = 1;
+    } else {
+        memcpy(stats, explanation.stats, qstats * sizeof(struct step_stat));
+        qsort(stats + 1, qstats - 1, sizeof(struct step_stat), cmp_stats_by_games);
+    }
+
+    char * result = NULL;
+    size_t result_sz = 0;
+    FILE * const out = open_memstream(&result, &result_sz);
+    if (out == NULL) {
+        return batch_error("Cannot open result stream.");
+    }
+
+    int mirrored;
+    const uint64_t hash = state_canonical_hash(state, &mirrored);
+    fprintf(out, "%016llx %d %lld", (unsigned long long)hash, mirrored ? MIRROR(step) : step, (long long)stats[0].qgames);
+
+    /* Backup state is not used between commands */
+    struct state * restrict const next = parser->backup;
+    char text[position_text_sz(state->geometry)];
+    /* Mirrored steps of a symmetric position give the same position, it is counted once */
+    uint64_t next_hashes[QSTEPS];
+    unsigned int qnext = 0;
+    for (size_t i = 0; i < qstats && qnext < builder->width; ++i) {
+        if (i > 0 && stats[i].qgames <= 0) {
+            break;
+        }
+
+        state_copy(next, state);
+        next->ball_before_goal = state->ball_before_goal;
+        if (state_step(next, stats[i].step) == NO_WAY || state_status(next) != IN_PROGRESS) {
+            continue;
+        }
+
+        if (state_encode(next, text, sizeof(text)) != 0) {
+            continue;
+        }
+
+        const uint64_t next_hash = state_canonical_hash(next, NULL);
+        int is_repeated = 0;
+        for (unsigned int j = 0; j < qnext; ++j) {
+            is_repeated |= next_hashes[j] == next_hash;
+        }
+
+        if (is_repeated) {
+            continue;
+        }
+
+        next_hashes[qnext++] = next_hash;
+        fprintf(out, " %016llx %d %s", (unsigned long long)next_hash, next->active != state->active, text);
+    }
+
+    fclose(out);
+    return result;
+}
+
+static int add_book_entry(
+    struct book_builder * restrict const me,
+    const struct book_entry * const entry)
+{
+    if (me->qentries == me->entries_capacity) {
+        const size_t capacity = me->entries_capacity ? 2 * me->entries_capacity : 1024;
+        struct book_entry * const entries = realloc(me->entries, capacity * sizeof(struct book_entry));
+        if (entries == NULL) {
+            return ENOMEM;
+        }
+        me->entries = entries;
+        me->entries_capacity = capacity;
+    }
+
+    me->entries[me->qentries++] = *entry;
+    return 0;
+}
+
+static int add_book_child(
+    struct book_builder * restrict const me,
+    const struct book_child * const child)
+{
+    if (me->qchildren == me->children_capacity) {
+        const size_t capacity = me->children_capacity ? 2 * me->children_capacity : 1024;
+        struct book_child * const children = realloc(me->children, capacity * sizeof(struct book_child));
+        if (children == NULL) {
+            return ENOMEM;
+        }
+        me->children = children;
+        me->children_capacity = capacity;
+    }
+
+    me->children[me->qchildren++] = *child;
+    return 0;
+}
+
+static void collect_book_result(
+    struct batch * restrict const batch,
+    const size_t index,
+    const int is_next_ready)
+{
+    struct book_builder * restrict const me = batch->context;
+    const struct batch_job * const job = batch->jobs + index;
+    const char * const result = job->result;
+
+    if (result == NULL || strncmp(result, "error ", 6) == 0) {
+        fprintf(stderr, "Position %s is skipped: %s\n", job->line, result ? result + 6 : "Out of memory.");
+        ++me->qerrors;
+        return;
+    }
+
+    char * ptr;
+    struct book_entry entry;
+    entry.hash = strtoull(result, &ptr, 16);
+    entry.step = strtoul(ptr, &ptr, 10);
+    entry.qgames = strtoul(ptr, &ptr, 10);
+    if (add_book_entry(me, &entry) != 0) {
+        me->status = ENOMEM;
+        return;
+    }
+
+    while (*ptr == ' ') {
+        struct book_child child;
+        child.hash = strtoull(ptr, &ptr, 16);
+        child.depth = me->depths[index] + strtoul(ptr, &ptr, 10);
+
+        const char * const text = ptr + strspn(ptr, " ");
+        const size_t len = strcspn(text, " ");
+        ptr += text - ptr + len;
+        if (child.depth >= me->qturns) {
+            continue;
+        }
+
+        child.line = strndup(text, len);
+        if (child.line == NULL || add_book_child(me, &child) != 0) {
+            free(child.line);
+            me->status = ENOMEM;
+            return;
+        }
+    }
+}
+
+static int cmp_book_entries(const void * const a, const void * const b)
+{
+    const struct book_entry * const ea = a;
+    const struct book_entry * const eb = b;
+    if (ea->hash < eb->hash) return -1;
+    if (ea->hash > eb->hash) return +1;
+    return 0;
+}
+
+static int cmp_book_children(const void * const a, const void * const b)
+{
+    const struct book_child * const ca = a;
+    const struct book_child * const cb = b;
+    if (ca->hash < cb->hash) return -1;
+    if (ca->hash > cb->hash) return +1;
+    if (ca->depth < cb->depth) return -1;
+    if (ca->depth > cb->depth) return +1;
+    return 0;
+}
+
+/* Jobs of the next level are new positions, a position found twice keeps the least depth */
+static int next_book_level(
+    struct book_builder * restrict const me,
+    struct batch * restrict const batch)
+{
+    free_batch_jobs(batch);
+
+    qsort(me->entries, me->qentries, sizeof(struct book_entry), cmp_book_entries);
+    qsort(me->children, me->qchildren, sizeof(struct book_child), cmp_book_children);
+
+    struct batch_job * const jobs = malloc((me->qchildren + 1) * sizeof(struct batch_job));
+    unsigned int * const depths = realloc(me->depths, (me->qchildren + 1) * sizeof(unsigned int));
+    if (depths != NULL) {
+        me->depths = depths;
+    }
+
+    if (jobs == NULL || depths == NULL) {
+        free(jobs);
+        return ENOMEM;
+    }
+
+    size_t qjobs = 0;
+    for (size_t i = 0; i < me->qchildren; ++i) {
+        const struct book_child * const child = me->children + i;
+        const struct book_entry key = { child->hash, 0, 0 };
+        const int is_known = (i > 0 && child->hash == me->children[i-1].hash)
+            || bsearch(&key, me->entries, me->qentries, sizeof(struct book_entry), cmp_book_entries) != NULL;
+        if (is_known) {
+            free(child->line);
+            continue;
+        }
+
+        jobs[qjobs].line = child->line;
+        jobs[qjobs].result = NULL;
+        jobs[qjobs].is_done = 0;
+        depths[qjobs] = child->depth;
+        ++qjobs;
+    }
+
+    me->qchildren = 0;
+    batch->jobs = jobs;
+    batch->qjobs = qjobs;
+    return 0;
+}
+
+/* Roots are positions from input or the start position of the first engine */
+static int init_book_roots(
+    struct book_builder * restrict const me,
+    struct batch * restrict const batch)
+{
+    if (batch->qjobs == 0) {
+        const struct state * const state = batch->workers[0].cmd_parser.state;
+        const size_t sz = position_text_sz(state->geometry);
+        char * const line = malloc(sz);
+        batch->jobs = malloc(sizeof(struct batch_job));
+        if (line == NULL || batch->jobs == NULL) {
+            free(line);
+            return ENOMEM;
+        }
+
+        state_encode(state, line, sz);
+        batch->jobs[0].line = line;
+        batch->jobs[0].result = NULL;
+        batch->jobs[0].is_done = 0;
+        batch->qjobs = 1;
+    }
+
+    me->depths = calloc(batch->qjobs, sizeof(unsigned int));
+    return me->depths ? 0 : ENOMEM;
+}
+
+static int build_book(
+    struct book_builder * restrict const me,
+    struct batch * restrict const batch,
+    const char * const path)
+{
+    int status = init_book_roots(me, batch);
+
+    for (unsigned int level = 0; status == 0 && batch->qjobs > 0; ++level) {
+        const size_t qjobs = batch->qjobs;
+        status = run_batch_jobs(batch, collect_book_result);
+        if (status == 0) {
+            status = me->status;
+        }
+
+        if (status == 0) {
+            fprintf(stderr, "Level %u: %zu positions searched, %zu in book.\n", level, qjobs, me->qentries);
+            status = next_book_level(me, batch);
+        }
+    }
+
+    if (status == ENOMEM) {
+        fprintf(stderr, "Not enough memory to build book.\n");
+        return status;
+    }
+
+    if (status != 0) {
+        return status;
+    }
+
+    if (me->qentries > UINT32_MAX) {
+        fprintf(stderr, "Too many positions for book.\n");
+        return EOVERFLOW;
+    }
+
+    const struct geometry * const geometry = batch->workers[0].cmd_parser.geometry;
+    status = save_book(path, geometry_tag(geometry), me->entries, me->qentries);
+    if (status != 0) {
+        fprintf(stderr, "Cannot write book %s, code %d: %s.\n", path, status, strerror(status));
+        return status;
+    }
+
+    printf("Book %s: %zu positions, %zu skipped.\n", path, me->qentries, me->qerrors);
+    return 0;
+}
+
+static int book_build_main(const int argc, char * argv[])
+{
+    if (argc < 1 || argc > 4) {
+        fprintf(stderr, "Usage: paper-football --book-build PATH [TURNS [WIDTH [WORKERS]]] < setup\n");
+        return EINVAL;
+    }
+
+    long qturns = 4;
+    long width = 2;
+    long qworkers = default_qworkers();
+    if (0
+        || read_count(argc > 1 ? argv[1] : NULL, "number of turns", BOOK_MAX_TURNS, &qturns) != 0
+        || read_count(argc > 2 ? argv[2] : NULL, "width", QSTEPS, &width) != 0
+        || read_count(argc > 3 ? argv[3] : NULL, "number of workers", 1024, &qworkers) != 0)
+    {
+        return EINVAL;
+    }
+
+    struct book_builder builder;
+    struct book_builder * restrict const me = &builder;
+    memset(me, 0, sizeof(struct book_builder));
+    me->qturns = qturns;
+    me->width = width;
+
+    struct batch batch;
+    int status = init_batch(&batch, qworkers, book_search, me);
+
+    if (status == 0) {
+        status = read_batch(&batch, stdin);
+        if (status != 0) {
+            fprintf(stderr, "Cannot read setup, code %d: %s.\n", status, strerror(status));
+        }
+    }
+
+    if (status == 0) {
+        status = apply_batch_header(&batch);
+    }
+
+    if (status == 0) {
+        status = build_book(me, &batch, argv[0]);
+    }
+
+    for (size_t i = 0; i < me->qchildren; ++i) {
+        free(me->children[i].line);
+    }
+    free(me->children);
+    free(me->depths);
+    free(me->entries);
+
+    free_batch(&batch);
+    return status;
+}
+
+static int run(int argc, char * argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "--analyze-batch") == 0) {
+        return batch_main(argc - 2, argv + 2);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--book-build") == 0) {
+        if (opening_book.map) {
+            fprintf(stderr, "Book is built from search, --book cannot be used with --book-build.\n");
+            return EINVAL;
+        }
+        return book_build_main(argc - 2, argv + 2);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--daemon") == 0) {
+        return daemon_main(argc - 2, argv + 2);
+    }
+
+    struct cmd_parser cmd_parser;
+    const int status = init_cmd_parser(&cmd_parser, stdout, stderr);
+    if (status != 0) {
+        return status;
+    }
+
+    if (argc > 1) {
+        int result = EINVAL;
+        if (strcmp(argv[1], "--binary") == 0) {
+            result = process_bin(&cmd_parser);
+        } else {
+            fprintf(stderr, "Unknown option %s, only --book, --binary, --daemon, --analyze-batch and --book-build are supported.\n", argv[1]);
+        }
+        free_cmd_parser(&cmd_parser);
+        return result;
+    }
+
+    /* Text protocol keeps reading commands while AI is thinking */
+    cmd_parser.is_async = 1;
+
+    char * line = 0;
+    size_t len = 0;
+    for (;; ) {
+        const ssize_t has_read = getline(&line, &len, stdin);
+        if (has_read == -1) {
+            break;
+        }
+
+        const int is_quit = process_cmd(&cmd_parser, line);
+        if (is_quit) {
+            break;
+        }
+    }
+
+    free_cmd_parser(&cmd_parser);
+
+    if (line) {
+        free(line);
+    }
+
+    return 0;
+}
+
+int main(int argc, char * argv[])
+{
+    /* Book goes before the mode option, it is mapped for the whole run */
+    if (argc > 2 && strcmp(argv[1], "--book") == 0) {
+        const int status = open_book(&opening_book, argv[2]);
+        if (status != 0) {
+            fprintf(stderr, "Cannot open book %s, code %d: %s.\n", argv[2], status, strerror(status));
+            return status;
+        }
+
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+
+    const int status = run(argc, argv);
+    close_book(&opening_book);
+    return status;
+}
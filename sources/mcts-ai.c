@@ -1,17 +1,75 @@
 #include "paper-football.h"
 
+#include <fcntl.h>
 #include <math.h>
 #include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
 
 #define ERROR_BUF_SZ   256
 
-#define QPARAMS   4
+#define EAST_STEPS ((1 << NORTH_EAST) | (1 << EAST) | (1 << SOUTH_EAST))
+
+/*
+ * Default board (9x11, goal width 2) is baked into specialized hot loops:
+ * next point is ball + delta, and a step out of the board is a goal. Any
+ * geometry with the same steps (std 9x11 with other goal width) fits too.
+ */
+#define DEFAULT_BW        9
+#define DEFAULT_BH       11
+#define DEFAULT_QPOINTS  (DEFAULT_BW * DEFAULT_BH)
+
+static const int default_deltas[QSTEPS] = {
+    DEFAULT_BW-1, DEFAULT_BW, DEFAULT_BW+1, 1, -DEFAULT_BW+1, -DEFAULT_BW, -DEFAULT_BW-1, -1
+};
+
+enum cutoff_mode { CUTOFF_ZERO, CUTOFF_EVAL };
+
+static const char * const cutoff_names[] = { "zero", "eval", NULL };
+
+enum rollout_policy { POLICY_UNIFORM, POLICY_GOAL_GREEDY, POLICY_DISTANCE_BIASED };
+
+static const char * const policy_names[] = { "uniform", "goal_greedy", "distance_biased", NULL };
+
+#define QPARAMS  12
+#define QSTATS    9
 
 static const uint32_t     def_cache = 2 * 1024 * 1024;
 static const uint32_t    def_qthink =     1024 * 1024;
 static const uint32_t def_max_depth =             128;
 static const  float           def_C =             1.4;
+static const uint32_t def_adjudicate =              1;
+static const uint32_t    def_cutoff =    CUTOFF_ZERO;
+static const uint32_t    def_policy = POLICY_UNIFORM;
+static const uint32_t     def_reach =              0;
+static const uint32_t     def_batch =              1;
+static const uint32_t      def_seed =              1;
+static const uint32_t   def_multipv =              1;
+static const uint32_t      def_memo =             64;
+
+#define MAX_BATCH   64
+#define MAX_MULTIPV  8
+#define MAX_MEMO    65536
+
+/*
+ * Result of a search kept across moves: key is the position hash mixed with
+ * the parameters which change the search (all but qthink and multipv).
+ * Entries are few, so LRU is a linear scan over last use ticks.
+ */
+struct memo_entry
+{
+    uint64_t key;
+    uint64_t tick;
+    uint32_t qthink;
+    uint64_t qplayouts;
+    uint32_t qnodes;
+    uint32_t qstats;
+    double score;
+    enum step step;
+    struct step_stat stats[QSTEPS];
+};
 
 struct mcts_ai
 {
@@ -19,12 +77,34 @@ struct mcts_ai
     struct state * backup;
     char * error_buf;
     struct ai_param params[QPARAMS+1];
+    struct ai_param counters[QSTATS+1];
     struct step_stat stats[QSTEPS];
 
     uint32_t cache;
     uint32_t qthink;
     uint32_t max_depth;
     float    C;
+    uint32_t adjudicate;
+    uint32_t cutoff;
+    uint32_t policy;
+    uint32_t reach;
+    uint32_t batch;
+    uint32_t seed;
+    uint32_t multipv;
+    uint32_t memo;
+
+    /* Long analysis plays more than 2^32 rollout steps */
+    uint64_t qrollouts;
+    uint64_t qadjudicated;
+    uint64_t qrollout_steps;
+    uint64_t qreach_cuts;
+    uint32_t simd;
+
+    /* Memo counters are kept for all searches, rate is hits in percents */
+    uint32_t qmemo_hits;
+    uint32_t qmemo_extends;
+    uint32_t qmemo_misses;
+    float memo_rate;
 
     struct node * nodes;
     uint32_t total_nodes;
@@ -36,6 +116,39 @@ struct mcts_ai
     struct hist_item * hist_ptr;
     struct hist_item * hist_last;
     uint32_t max_hist_len;
+
+    steps_t root_steps;
+    int is_default_board;
+    uint32_t qlast_games;
+    uint8_t * batch_lines;
+    uint8_t * reach_buf;
+    uint64_t rng;
+    int is_stopped;
+    int is_analyzing;
+
+    struct node * search_root;
+    enum step search_choice;
+    uint32_t search_qthink;
+    double search_start;
+    int is_search_done;
+
+    const struct book * book;
+    int is_book_match;
+
+    /* Tree in the cache is for the position with this hash, a loaded tree is continued */
+    uint64_t tree_hash;
+    uint64_t tree_key;
+    int is_tree_loaded;
+
+    /* Memo entry answered the search or thinking already done in the extended tree */
+    struct memo_entry * memo_entries;
+    uint64_t memo_tick;
+    const struct memo_entry * memo_answer;
+    uint32_t memo_qthink;
+
+    struct ai_variation variations[MAX_MULTIPV];
+    uint32_t pv_nodes[MAX_MULTIPV];
+    enum step pv_steps[MAX_MULTIPV][MAX_PV_LEN];
 };
 
 struct hist_item
@@ -44,24 +157,73 @@ struct hist_item
     int active;
 };
 
+/* Counters are wide: analysis has no budget and may run for hours */
 struct node
 {
-    int32_t score;
-    int32_t qgames;
+    double score;
+    int64_t qgames;
     int32_t children[QSTEPS];
 };
 
-static void init_magic_steps(void);
 static enum step ai_go(
     struct mcts_ai * restrict const me,
     struct ai_explanation * restrict const explanation);
 
+static enum step ai_analyze(
+    struct mcts_ai * restrict const me,
+    const double interval,
+    ai_report_func report,
+    void * const arg);
+
+static int go_begin(struct mcts_ai * restrict const me);
+
+static int go_continue(
+    struct mcts_ai * restrict const me,
+    const uint32_t budget);
+
+static enum step go_peek(
+    struct mcts_ai * restrict const me,
+    struct ai_explanation * restrict const explanation);
+
+static int save_tree(
+    struct mcts_ai * restrict const me,
+    const char * const path);
+
+static int load_tree(
+    struct mcts_ai * restrict const me,
+    const char * const path);
+
+static enum step go_end(
+    struct mcts_ai * restrict const me,
+    struct ai_explanation * restrict const explanation);
+
 #define OFFSET(name) offsetof(struct mcts_ai, name)
-static struct ai_param def_params[QPARAMS+1] = {
+static const struct ai_param def_params[QPARAMS+1] = {
     {     "cache",     &def_cache, U32, OFFSET(cache) },
     {    "qthink",    &def_qthink, U32, OFFSET(qthink) },
     { "max_depth", &def_max_depth, U32, OFFSET(max_depth) },
     {         "C",         &def_C, F32, OFFSET(C) },
+    { "adjudicate", &def_adjudicate, U32, OFFSET(adjudicate) },
+    {    "cutoff",    &def_cutoff, ENUM, OFFSET(cutoff), cutoff_names },
+    {    "policy",    &def_policy, ENUM, OFFSET(policy), policy_names },
+    {     "reach",     &def_reach, U32, OFFSET(reach) },
+    {     "batch",     &def_batch, U32, OFFSET(batch) },
+    {      "seed",      &def_seed, U32, OFFSET(seed) },
+    {   "multipv",   &def_multipv, U32, OFFSET(multipv) },
+    {      "memo",      &def_memo, U32, OFFSET(memo) },
+    { NULL, NULL, NO_TYPE, 0 }
+};
+
+static const struct ai_param def_counters[QSTATS+1] = {
+    {      "rollouts", NULL, U64, OFFSET(qrollouts) },
+    {   "adjudicated", NULL, U64, OFFSET(qadjudicated) },
+    {  "played_steps", NULL, U64, OFFSET(qrollout_steps) },
+    {    "reach_cuts", NULL, U64, OFFSET(qreach_cuts) },
+    {          "simd", NULL, ENUM, OFFSET(simd), simd_names },
+    {     "memo_hits", NULL, U32, OFFSET(qmemo_hits) },
+    {  "memo_extends", NULL, U32, OFFSET(qmemo_extends) },
+    {   "memo_misses", NULL, U32, OFFSET(qmemo_misses) },
+    {     "memo_rate", NULL, F32, OFFSET(memo_rate) },
     { NULL, NULL, NO_TYPE, 0 }
 };
 
@@ -71,8 +233,18 @@ static void * move_ptr(void * ptr, size_t offset)
     return base + offset;
 }
 
+/* Sliced search is over when its tree or its position is gone */
+static void cancel_search(struct mcts_ai * restrict const me)
+{
+    me->search_root = NULL;
+    me->search_choice = INVALID_STEP;
+    me->memo_answer = NULL;
+    me->is_search_done = 1;
+}
+
 static void reset_cache(struct mcts_ai * restrict const me)
 {
+    cancel_search(me);
     me->total_nodes = me->nodes ? me->cache / sizeof(struct node) : 0;
     me->used_nodes = 0;
     me->good_node_alloc = 0;
@@ -101,20 +273,105 @@ static int set_cache(
     }
 
     free_cache(me);
+
+    me->nodes = malloc(*value);
+    if (me->nodes == NULL) {
+        snprintf(me->error_buf, ERROR_BUF_SZ, "Bad alloc %u bytes (nodes).", *value);
+        return ENOMEM;
+    }
+
+    me->cache = *value;
+    reset_cache(me);
     return 0;
 }
 
-static int init_cache(struct mcts_ai * restrict const me)
+/* Every engine has own xorshift64* state, so engines do not share libc rand() */
+static uint64_t seed_rng(const uint32_t seed)
 {
-    if (me->nodes == NULL && me->cache > 0) {
-        me->nodes = malloc(me->cache);
-        if (me->nodes == NULL) {
-            snprintf(me->error_buf, ERROR_BUF_SZ, "Bad alloc %u bytes (nodes).", me->cache);
-            return ENOMEM;
-        }
+    /* splitmix64 step: close seeds give unrelated states, zero never comes out */
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return (z ^ (z >> 31)) | 1;
+}
+
+static inline uint32_t ai_random(struct mcts_ai * restrict const me)
+{
+    uint64_t x = me->rng;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    me->rng = x;
+    return (x * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+static int set_seed(
+    struct mcts_ai * restrict const me,
+    const uint32_t * value)
+{
+    me->rng = seed_rng(*value);
+    return 0;
+}
+
+static int set_batch(
+    struct mcts_ai * restrict const me,
+    const uint32_t * value)
+{
+    if (*value < 1 || *value > MAX_BATCH) {
+        snprintf(me->error_buf, ERROR_BUF_SZ, "Invalid value for batch, it should be in range 1..%d.", MAX_BATCH);
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+static int set_multipv(
+    struct mcts_ai * restrict const me,
+    const uint32_t * value)
+{
+    if (*value < 1 || *value > MAX_MULTIPV) {
+        snprintf(me->error_buf, ERROR_BUF_SZ, "Invalid value for multipv, it should be in range 1..%d.", MAX_MULTIPV);
+        return EINVAL;
+    }
+
+    return 0;
+}
+
+static void free_memo(struct mcts_ai * restrict const me)
+{
+    if (me->memo_entries) {
+        free(me->memo_entries);
+        me->memo_entries = NULL;
+    }
+
+    me->memo_tick = 0;
+    me->memo_answer = NULL;
+    me->qmemo_hits = 0;
+    me->qmemo_extends = 0;
+    me->qmemo_misses = 0;
+    me->memo_rate = 0.0;
+}
+
+static int set_memo(
+    struct mcts_ai * restrict const me,
+    const uint32_t * value)
+{
+    if (*value > MAX_MEMO) {
+        snprintf(me->error_buf, ERROR_BUF_SZ, "Too big value for memo, maximum is %u.", MAX_MEMO);
+        return EINVAL;
+    }
+
+    free_memo(me);
+    if (*value == 0) {
+        return 0;
+    }
+
+    me->memo_entries = calloc(*value, sizeof(struct memo_entry));
+    if (me->memo_entries == NULL) {
+        snprintf(me->error_buf, ERROR_BUF_SZ, "Bad alloc %u memo entries.", *value);
+        return ENOMEM;
     }
 
-    reset_cache(me);
     return 0;
 }
 
@@ -133,6 +390,28 @@ static int set_param(
         case OFFSET(cache):
             status = set_cache(me, value);
             break;
+        case OFFSET(batch):
+            status = set_batch(me, value);
+            break;
+        case OFFSET(seed):
+            status = set_seed(me, value);
+            break;
+        case OFFSET(multipv):
+            status = set_multipv(me, value);
+            break;
+        case OFFSET(memo):
+            status = set_memo(me, value);
+            break;
+    }
+
+    if (status == 0 && param->type == ENUM) {
+        const uint32_t index = *(const uint32_t *)value;
+        for (uint32_t i=0; i<=index; ++i) {
+            if (param->names[i] == NULL) {
+                snprintf(me->error_buf, ERROR_BUF_SZ, "Invalid value %u for %s.", index, param->name);
+                return EINVAL;
+            }
+        }
     }
 
     if (status == 0) {
@@ -153,31 +432,86 @@ static void init_param(
     set_param(me, param, def_param->value);
 }
 
+static void reset_counters(struct mcts_ai * restrict const me)
+{
+    me->qrollouts = 0;
+    me->qadjudicated = 0;
+    me->qrollout_steps = 0;
+    me->qreach_cuts = 0;
+}
+
+static inline int next_point(
+    const int32_t * const connections,
+    const int ball,
+    const enum step step,
+    const int is_default_board)
+{
+    if (is_default_board) {
+        const int next = ball + default_deltas[step];
+        return next >= DEFAULT_QPOINTS ? GOAL_1 : next < 0 ? GOAL_2 : next;
+    }
+
+    return connections[ball*QSTEPS + step];
+}
+
+/* Every possible step of the geometry should match the baked rule */
+static int is_default_board(const struct geometry * const geometry)
+{
+    if (geometry->width != DEFAULT_BW || geometry->height != DEFAULT_BH) {
+        return 0;
+    }
+
+    if (geometry->qpoints != DEFAULT_QPOINTS) {
+        return 0;
+    }
+
+    const int32_t * const connections = geometry->connections;
+    for (int point = 0; point < DEFAULT_QPOINTS; ++point)
+    for (enum step step=0; step<QSTEPS; ++step) {
+        const int next = connections[point*QSTEPS + step];
+        if (next != NO_WAY && next != next_point(NULL, point, step, 1)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* Book is checked against the board once, lookups use only the position hash */
+static void set_book(
+    struct mcts_ai * restrict const me,
+    const struct book * const book)
+{
+    me->book = book;
+    me->is_book_match = book != NULL && book->tag == geometry_tag(me->state->geometry);
+}
+
 static void free_ai(struct mcts_ai * restrict const me)
 {
     free_cache(me);
-    if (me->hist) {
-        free(me->hist);
-    }
+    free_memo(me);
     free(me);
 }
 
 struct mcts_ai * create_mcts_ai(const struct geometry * const geometry)
 {
-    init_magic_steps();
-
+    /* Every step of a path takes an unused edge, only the last one may go to a goal */
     const uint32_t qpoints = geometry->qpoints;
-    const size_t sizes[6] = {
+    const uint32_t max_hist_len = geometry->qedges + 1;
+    const size_t sizes[9] = {
         sizeof(struct mcts_ai),
         sizeof(struct state),
         qpoints,
         sizeof(struct state),
         qpoints,
-        ERROR_BUF_SZ
+        ERROR_BUF_SZ,
+        MAX_BATCH * qpoints,
+        max_hist_len * sizeof(struct hist_item),
+        qpoints
     };
 
-    void * ptrs[6];
-    void * data = multialloc(6, sizes, ptrs, 64);
+    void * ptrs[9];
+    void * data = multialloc(9, sizes, ptrs, 64);
 
     if (data == NULL) {
         return NULL;
@@ -193,24 +527,49 @@ struct mcts_ai * create_mcts_ai(const struct geometry * const geometry)
     me->state = state;
     me->backup = backup;
     me->error_buf = error_buf;
+    me->batch_lines = ptrs[6];
+    me->reach_buf = ptrs[8];
+    me->qlast_games = 1;
 
     me->nodes = NULL;
     reset_cache(me);
 
-    me->hist = NULL;
-    me->hist_last = NULL;
-    me->hist_ptr = NULL;
+    me->hist = ptrs[7];
+    me->hist_last = me->hist + max_hist_len;
+    me->hist_ptr = me->hist;
     me->max_hist_len = 0;
+    me->root_steps = 0xFF;
+    me->is_default_board = is_default_board(geometry);
+    me->simd = simd_variant();
+    me->is_stopped = 0;
+    me->is_analyzing = 0;
+    me->search_root = NULL;
+    me->search_choice = INVALID_STEP;
+    me->is_search_done = 1;
+    me->book = NULL;
+    me->is_book_match = 0;
+    me->tree_hash = 0;
+    me->tree_key = 0;
+    me->is_tree_loaded = 0;
+    me->memo_entries = NULL;
+    me->memo_qthink = 0;
 
     memcpy(me->params, def_params, sizeof(me->params));
     for (int i=0; i<QPARAMS; ++i) {
         init_param(me, i);
     }
 
+    memcpy(me->counters, def_counters, sizeof(me->counters));
+    for (int i=0; i<QSTATS; ++i) {
+        me->counters[i].value = move_ptr(me, me->counters[i].offset);
+    }
+    reset_counters(me);
+
     state->geometry = geometry;
     state->lines = lines;
     state->active = 1;
     state->ball = qpoints / 2;
+    state->ball_before_goal = NO_WAY;
 
     backup->geometry = geometry;
     backup->lines = backup_lines;
@@ -230,11 +589,23 @@ int mcts_ai_reset(
     const struct geometry * const geometry)
 {
     ai->error = NULL;
+    ai->history.qsteps = 0;
+
+    /* Same board: start position in place, parameters and node cache are kept */
+    struct mcts_ai * restrict const old = ai->data;
+    if (old->state->geometry == geometry) {
+        struct state * restrict const state = old->state;
+        init_lines(geometry, state->lines);
+        state->active = 1;
+        state->ball = geometry->qpoints / 2;
+        state->ball_before_goal = NO_WAY;
+        cancel_search(old);
+        return 0;
+    }
 
     struct mcts_ai * restrict const me = create_mcts_ai(geometry);
     if (me == NULL) {
-        snprintf(me->error_buf, ERROR_BUF_SZ, "Bad alloc for create_mcts_ai.");
-        ai->error = me->error_buf;
+        ai->error = "Bad alloc for create_mcts_ai.";
         return errno;
     }
 
@@ -249,6 +620,8 @@ int mcts_ai_reset(
         }
     }
 
+    set_book(me, old->book);
+
     free_ai(ai->data);
     ai->data = me;
     return 0;
@@ -277,6 +650,7 @@ int mcts_ai_do_step(
         return EINVAL;
     }
 
+    cancel_search(me);
     return 0;
 }
 
@@ -322,6 +696,7 @@ int mcts_ai_do_steps(
         }
     }
 
+    cancel_search(me);
     return 0;
 }
 
@@ -345,6 +720,7 @@ int mcts_ai_undo_step(
     }
 
     --history->qsteps;
+    cancel_search(me);
     return 0;
 }
 
@@ -375,6 +751,52 @@ int mcts_ai_undo_steps(
     }
 
     history->qsteps -= qsteps;
+    cancel_search(me);
+    return 0;
+}
+
+int mcts_ai_snapshot(
+    const struct ai * const ai,
+    struct ai_snapshot * restrict const snapshot)
+{
+    const struct mcts_ai * const me = ai->data;
+    return ai_snapshot_save(snapshot, me->state, &ai->history);
+}
+
+int mcts_ai_restore(
+    struct ai * restrict const ai,
+    const struct ai_snapshot * const snapshot)
+{
+    ai->error = NULL;
+    struct mcts_ai * restrict const me = ai->data;
+
+    const int status = ai_snapshot_load(snapshot, me->state, &ai->history);
+    if (status != 0) {
+        snprintf(me->error_buf, ERROR_BUF_SZ, "Cannot restore snapshot, status is %d.", status);
+        ai->error = me->error_buf;
+    }
+
+    cancel_search(me);
+    return status;
+}
+
+int mcts_ai_set_state(
+    struct ai * restrict const ai,
+    const struct state * const state)
+{
+    ai->error = NULL;
+    struct mcts_ai * restrict const me = ai->data;
+
+    const int status = state_copy(me->state, state);
+    if (status != 0) {
+        snprintf(me->error_buf, ERROR_BUF_SZ, "Position is for another board.");
+        ai->error = me->error_buf;
+        return status;
+    }
+
+    me->state->ball_before_goal = state->ball_before_goal;
+    ai->history.qsteps = 0;
+    cancel_search(me);
     return 0;
 }
 
@@ -391,12 +813,109 @@ enum step mcts_ai_go(
     return step;
 }
 
+int mcts_ai_go_begin(struct ai * restrict const ai)
+{
+    ai->error = NULL;
+    struct mcts_ai * restrict const me = ai->data;
+    const int status = go_begin(me);
+    if (status != 0) {
+        ai->error = me->error_buf;
+    }
+    return status;
+}
+
+int mcts_ai_go_continue(struct ai * restrict const ai, const uint32_t budget)
+{
+    struct mcts_ai * restrict const me = ai->data;
+    return go_continue(me, budget);
+}
+
+enum step mcts_ai_go_peek(
+    struct ai * restrict const ai,
+    struct ai_explanation * restrict const explanation)
+{
+    ai->error = NULL;
+    struct mcts_ai * restrict const me = ai->data;
+    const enum step step = go_peek(me, explanation);
+    if (step == INVALID_STEP) {
+        ai->error = me->error_buf;
+    }
+    return step;
+}
+
+enum step mcts_ai_go_end(
+    struct ai * restrict const ai,
+    struct ai_explanation * restrict const explanation)
+{
+    ai->error = NULL;
+    struct mcts_ai * restrict const me = ai->data;
+    const enum step step = go_end(me, explanation);
+    if (step == INVALID_STEP) {
+        ai->error = me->error_buf;
+    }
+    return step;
+}
+
+enum step mcts_ai_analyze(
+    struct ai * restrict const ai,
+    const double interval,
+    ai_report_func report,
+    void * const arg)
+{
+    ai->error = NULL;
+    struct mcts_ai * restrict const me = ai->data;
+    const enum step step = ai_analyze(me, interval, report, arg);
+    if (step == INVALID_STEP) {
+        ai->error = me->error_buf;
+    }
+    return step;
+}
+
+void mcts_ai_stop(struct ai * restrict const ai, const int is_stopped)
+{
+    struct mcts_ai * restrict const me = ai->data;
+    __atomic_store_n(&me->is_stopped, is_stopped, __ATOMIC_RELAXED);
+}
+
+void mcts_ai_set_book(struct ai * restrict const ai, const struct book * const book)
+{
+    set_book(ai->data, book);
+}
+
+int mcts_ai_save_tree(struct ai * restrict const ai, const char * const path)
+{
+    ai->error = NULL;
+    struct mcts_ai * restrict const me = ai->data;
+    const int status = save_tree(me, path);
+    if (status != 0) {
+        ai->error = me->error_buf;
+    }
+    return status;
+}
+
+int mcts_ai_load_tree(struct ai * restrict const ai, const char * const path)
+{
+    ai->error = NULL;
+    struct mcts_ai * restrict const me = ai->data;
+    const int status = load_tree(me, path);
+    if (status != 0) {
+        ai->error = me->error_buf;
+    }
+    return status;
+}
+
 const struct ai_param * mcts_ai_get_params(const struct ai * const ai)
 {
     struct mcts_ai * restrict const me = ai->data;
     return me->params;
 }
 
+const struct ai_param * mcts_ai_get_stats(const struct ai * const ai)
+{
+    struct mcts_ai * restrict const me = ai->data;
+    return me->counters;
+}
+
 static const struct ai_param * find_param(
     struct mcts_ai * restrict const me,
     const char * const name)
@@ -456,10 +975,23 @@ int init_mcts_ai(
     ai->do_steps = mcts_ai_do_steps;
     ai->undo_step = mcts_ai_undo_step;
     ai->undo_steps = mcts_ai_undo_steps;
+    ai->snapshot = mcts_ai_snapshot;
+    ai->restore = mcts_ai_restore;
+    ai->set_state = mcts_ai_set_state;
     ai->go = mcts_ai_go;
+    ai->go_begin = mcts_ai_go_begin;
+    ai->go_continue = mcts_ai_go_continue;
+    ai->go_peek = mcts_ai_go_peek;
+    ai->go_end = mcts_ai_go_end;
+    ai->stop = mcts_ai_stop;
+    ai->set_book = mcts_ai_set_book;
+    ai->save_tree = mcts_ai_save_tree;
+    ai->load_tree = mcts_ai_load_tree;
+    ai->analyze = mcts_ai_analyze;
     ai->get_params = mcts_ai_get_params;
     ai->set_param = mcts_ai_set_param;
     ai->get_state = mcts_ai_get_state;
+    ai->get_stats = mcts_ai_get_stats;
     ai->free = free_mcts_ai;
 
     return 0;
@@ -469,16 +1001,19 @@ int init_mcts_ai(
 
 /* AI step selection */
 
-static enum step magic_steps[256][8];
+/*
+ * Steps of every mask in a row and their count, bytes keep both tables in
+ * 2.3 Kb of L1. Tables are filled once at startup, engines only read them.
+ */
+static uint8_t magic_steps[256][8];
+static uint8_t magic_qsteps[256];
 
+__attribute__ ((constructor))
 static void init_magic_steps(void)
 {
-    if (magic_steps[1][1] == 1) {
-        return;
-    }
-
     for (uint32_t mask=0; mask<256; ++mask) {
         steps_t steps = mask;
+        magic_qsteps[mask] = step_count(mask);
         for (int n=0; n<8; ++n) {
             if (steps == 0) {
                 magic_steps[mask][n] = INVALID_STEP;
@@ -504,73 +1039,440 @@ static struct node * alloc_node(struct mcts_ai * restrict const me)
     return result;
 }
 
-static int rollout(
-    struct state * restrict const state,
-    uint32_t max_steps,
-    uint32_t * qthink)
+/*
+ * Static evaluation for player 1 in [-1, 1]: ball position relative to both
+ * goals, a bonus for the side to move when it is close to its target, and a
+ * penalty for the side to move when few steps are left (risk of dead end).
+ */
+static float evaluate(
+    const struct geometry * const geometry,
+    const uint8_t * const lines,
+    const int ball,
+    const int active)
 {
-    const int32_t * const connections = state->geometry->connections;
+    const float sign = active == 1 ? +1.0f : -1.0f;
+    const float dist1 = geometry->goal_dists[2*ball + 0];
+    const float dist2 = geometry->goal_dists[2*ball + 1];
+    const float target = active == 1 ? dist1 : dist2;
+    const float mobility = step_count(lines[ball] ^ 0xFF);
 
-    int active = state->active;
-    int ball = state->ball;
-    uint8_t * restrict const lines = state->lines;
+    const float position = (dist2 - dist1) / (dist1 + dist2);
+    const float tempo = sign / target;
+    const float risk = sign * (QSTEPS - mobility) / QSTEPS;
 
-    if (ball == GOAL_1) {
-        return +1;
-    }
+    return 0.6f * position + 0.25f * tempo - 0.15f * risk;
+}
 
-    if (ball == GOAL_2) {
-        return -1;
-    }
+/* Playout in progress: a single rollout plays one, batched rollouts keep many */
+struct playout
+{
+    uint8_t * lines;
+    int ball;
+    int active;
+    uint32_t max_steps;
+    uint32_t reach_countdown;
+    uint64_t rng;
+};
 
-    for (;;) {
-        if (max_steps-- == 0) {
-            return 0;
-        }
+/* Every playout has own xorshift64* state seeded from the engine one */
+static inline uint64_t playout_seed(struct mcts_ai * restrict const me)
+{
+    const uint64_t seed = (uint64_t)ai_random(me) << 32 ^ ai_random(me);
+    return seed | 1;
+}
 
-        const steps_t ball_lines = lines[ball];
-        const steps_t answers = ball_lines ^ 0xFF;
-        if (answers == 0) {
-            return active != 1 ? +1 : -1;
+static inline uint32_t playout_random(struct playout * restrict const playout)
+{
+    uint64_t x = playout->rng;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    playout->rng = x;
+    return (x * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+/* Uniform in [0, n) without division: high word of a 32x32 product */
+static inline uint32_t playout_bounded(
+    struct playout * restrict const playout,
+    const uint32_t n)
+{
+    return ((uint64_t)playout_random(playout) * n) >> 32;
+}
+
+/*
+ * One step of a playout, returns 1 and sets score when the playout is over.
+ * Step is specialized for every policy: policy is a constant in each loop
+ * below, so the uniform loop has no policy code at all.
+ */
+static inline __attribute__((always_inline)) int playout_step(
+    struct mcts_ai * restrict const me,
+    const struct geometry * const geometry,
+    struct playout * restrict const playout,
+    uint32_t * qthink,
+    float * restrict const score,
+    const enum rollout_policy policy,
+    const int is_default_board)
+{
+    const int32_t * const connections = geometry->connections;
+    const uint8_t * const goal_steps = geometry->goal_steps;
+    const uint8_t * const closer_steps = geometry->closer_steps;
+    uint8_t * restrict const lines = playout->lines;
+    const int ball = playout->ball;
+    const int active = playout->active;
+
+    if (playout->max_steps-- == 0) {
+        *score = me->cutoff == CUTOFF_EVAL ? evaluate(geometry, lines, ball, active) : 0;
+        return 1;
+    }
+
+    const steps_t ball_lines = lines[ball];
+    const steps_t answers = ball_lines ^ 0xFF;
+    if (answers == 0) {
+        *score = active != 1 ? +1 : -1;
+        return 1;
+    }
+
+    if (me->adjudicate) {
+        /* Active player scores if possible, or concedes if every step is an own goal */
+        const steps_t own_goal = answers & goal_steps[2*ball + 2 - active];
+        const steps_t opp_goal = answers & goal_steps[2*ball + active - 1];
+        if (opp_goal != 0) {
+            ++me->qadjudicated;
+            *score = active == 1 ? +1 : -1;
+            return 1;
+        }
+        if (own_goal == answers) {
+            ++me->qadjudicated;
+            *score = active != 1 ? +1 : -1;
+            return 1;
+        }
+    }
+
+    if (me->reach != 0 && --playout->reach_countdown == 0) {
+        /* Only one goal is left: give the game to its owner without playing it out */
+        playout->reach_countdown = me->reach;
+        const int goals = reachable_goals(geometry, lines, ball, me->reach_buf);
+        if (goals == REACH_GOAL_1 || goals == REACH_GOAL_2) {
+            ++me->qreach_cuts;
+            *score = goals == REACH_GOAL_1 ? +1 : -1;
+            return 1;
         }
+    }
 
-        const int qanswers = step_count(answers);
-        const int index = qanswers == 1 ? 0 : rand() % qanswers;
-        enum step step = magic_steps[answers][index];
+    steps_t choices = answers;
 
-        const int next = connections[ball*QSTEPS + step];
+    if (policy == POLICY_GOAL_GREEDY) {
+        /* Score when possible, never concede while there is an alternative */
+        const steps_t scoring = answers & goal_steps[2*ball + active - 1];
+        const steps_t safe = answers & ~goal_steps[2*ball + 2 - active];
+        choices = scoring ? scoring : safe ? safe : answers;
+    }
 
-        if (next == GOAL_1) {
-            return +1;
+    if (policy == POLICY_DISTANCE_BIASED) {
+        /* In 3 cases of 4 go towards the goal of the active player */
+        const steps_t closer = answers & closer_steps[2*ball + active - 1];
+        if (closer != 0 && (playout_random(playout) & 3) != 0) {
+            choices = closer;
         }
+    }
 
-        if (next == GOAL_2) {
-            return -1;
+    /* A random number is drawn even for a forced step, it costs less than a mispredict */
+    const uint32_t index = playout_bounded(playout, magic_qsteps[choices]);
+    const enum step step = magic_steps[choices][index];
+
+    const int next = next_point(connections, ball, step, is_default_board);
+
+    /* Both goals are negative sentinels: GOAL_1 = -1 scores +1, GOAL_2 = -2 scores -1 */
+    if (next < 0) {
+        *score = 2 * next + 3;
+        return 1;
+    }
+
+    lines[ball] |= (1 << step);
+    lines[next] |= (1 << BACK(step));
+    playout->ball = next;
+    ++*qthink;
+
+    /* Turn passes on a fresh point */
+    playout->active ^= 3 & -(ball_lines == 0);
+
+    return 0;
+}
+
+static inline __attribute__((always_inline)) float rollout_loop(
+    struct mcts_ai * restrict const me,
+    struct state * restrict const state,
+    uint32_t max_steps,
+    uint32_t * qthink,
+    const enum rollout_policy policy,
+    const int is_default_board)
+{
+    if (state->ball == GOAL_1) {
+        return +1;
+    }
+
+    if (state->ball == GOAL_2) {
+        return -1;
+    }
+
+    struct playout playout = {
+        .lines = state->lines,
+        .ball = state->ball,
+        .active = state->active,
+        .max_steps = max_steps,
+        .reach_countdown = me->reach,
+        .rng = playout_seed(me),
+    };
+
+    float score;
+    while (!playout_step(me, state->geometry, &playout, qthink, &score, policy, is_default_board));
+    return score;
+}
+
+/*
+ * Batch plays qlanes rollouts from the same state in lockstep: one step of
+ * every running playout per pass, so loads of independent boards overlap.
+ */
+static inline __attribute__((always_inline)) void rollout_batch_loop(
+    struct mcts_ai * restrict const me,
+    const struct state * const state,
+    const uint32_t qlanes,
+    uint32_t max_steps,
+    uint32_t * qthink,
+    float * restrict const scores,
+    const enum rollout_policy policy,
+    const int is_default_board)
+{
+    if (state->ball < 0) {
+        const float score = state->ball == GOAL_1 ? +1 : -1;
+        for (uint32_t lane = 0; lane < qlanes; ++lane) {
+            scores[lane] = score;
         }
+        return;
+    }
 
-        lines[ball] |= (1 << step);
-        lines[next] |= (1 << BACK(step));
-        ball = next;
-        ++*qthink;
+    const struct geometry * const geometry = state->geometry;
+    const uint32_t qpoints = geometry->qpoints;
+    struct playout playouts[MAX_BATCH];
+    uint8_t running[MAX_BATCH];
+
+    uint64_t seed = playout_seed(me);
+    for (uint32_t lane = 0; lane < qlanes; ++lane) {
+        struct playout * restrict const playout = playouts + lane;
+        playout->lines = me->batch_lines + lane * qpoints;
+        memcpy(playout->lines, state->lines, qpoints);
+        playout->ball = state->ball;
+        playout->active = state->active;
+        playout->max_steps = max_steps;
+        playout->reach_countdown = me->reach;
+        seed += 0x9E3779B97F4A7C15ULL;
+        playout->rng = seed | 1;
+        running[lane] = lane;
+    }
 
-        if (ball_lines == 0) {
-            active ^= 3;
+    uint32_t qrunning = qlanes;
+    while (qrunning > 0) {
+        uint32_t qkeep = 0;
+        for (uint32_t i = 0; i < qrunning; ++i) {
+            const uint32_t lane = running[i];
+            const int is_over = playout_step(me, geometry, playouts + lane, qthink, scores + lane,
+                policy, is_default_board);
+            running[qkeep] = lane;
+            qkeep += !is_over;
+        }
+        qrunning = qkeep;
+    }
+}
+
+/* Policy and board are constants in every branch, so each one gets its own loop */
+static inline __attribute__((always_inline)) float rollout_switch(
+    struct mcts_ai * restrict const me,
+    struct state * restrict const state,
+    uint32_t max_steps,
+    uint32_t * qthink)
+{
+    if (me->is_default_board) {
+        switch (me->policy) {
+            case POLICY_GOAL_GREEDY:
+                return rollout_loop(me, state, max_steps, qthink, POLICY_GOAL_GREEDY, 1);
+            case POLICY_DISTANCE_BIASED:
+                return rollout_loop(me, state, max_steps, qthink, POLICY_DISTANCE_BIASED, 1);
+            default:
+                return rollout_loop(me, state, max_steps, qthink, POLICY_UNIFORM, 1);
+        }
+    }
+
+    switch (me->policy) {
+        case POLICY_GOAL_GREEDY:
+            return rollout_loop(me, state, max_steps, qthink, POLICY_GOAL_GREEDY, 0);
+        case POLICY_DISTANCE_BIASED:
+            return rollout_loop(me, state, max_steps, qthink, POLICY_DISTANCE_BIASED, 0);
+        default:
+            return rollout_loop(me, state, max_steps, qthink, POLICY_UNIFORM, 0);
+    }
+}
+
+/* The same loops are compiled for every SIMD variant, popcnt alone pays off in step_count */
+static float rollout_generic(
+    struct mcts_ai * restrict const me,
+    struct state * restrict const state,
+    uint32_t max_steps,
+    uint32_t * qthink)
+{
+    return rollout_switch(me, state, max_steps, qthink);
+}
+
+#ifdef HAVE_SIMD_DISPATCH
+__attribute__ ((target ("avx2,bmi2,popcnt")))
+static float rollout_avx2(
+    struct mcts_ai * restrict const me,
+    struct state * restrict const state,
+    uint32_t max_steps,
+    uint32_t * qthink)
+{
+    return rollout_switch(me, state, max_steps, qthink);
+}
+
+__attribute__ ((target ("avx512f,avx512bw,avx2,bmi2,popcnt")))
+static float rollout_avx512(
+    struct mcts_ai * restrict const me,
+    struct state * restrict const state,
+    uint32_t max_steps,
+    uint32_t * qthink)
+{
+    return rollout_switch(me, state, max_steps, qthink);
+}
+#endif
+
+static float rollout(
+    struct mcts_ai * restrict const me,
+    struct state * restrict const state,
+    uint32_t max_steps,
+    uint32_t * qthink)
+{
+    switch (me->simd) {
+#ifdef HAVE_SIMD_DISPATCH
+        case SIMD_AVX512:
+            return rollout_avx512(me, state, max_steps, qthink);
+        case SIMD_AVX2:
+            return rollout_avx2(me, state, max_steps, qthink);
+#endif
+        default:
+            return rollout_generic(me, state, max_steps, qthink);
+    }
+}
+
+static inline __attribute__((always_inline)) void rollout_batch_switch(
+    struct mcts_ai * restrict const me,
+    const struct state * const state,
+    const uint32_t qlanes,
+    uint32_t max_steps,
+    uint32_t * qthink,
+    float * restrict const scores)
+{
+    if (me->is_default_board) {
+        switch (me->policy) {
+            case POLICY_GOAL_GREEDY:
+                rollout_batch_loop(me, state, qlanes, max_steps, qthink, scores, POLICY_GOAL_GREEDY, 1);
+                return;
+            case POLICY_DISTANCE_BIASED:
+                rollout_batch_loop(me, state, qlanes, max_steps, qthink, scores, POLICY_DISTANCE_BIASED, 1);
+                return;
+            default:
+                rollout_batch_loop(me, state, qlanes, max_steps, qthink, scores, POLICY_UNIFORM, 1);
+                return;
         }
     }
+
+    switch (me->policy) {
+        case POLICY_GOAL_GREEDY:
+            rollout_batch_loop(me, state, qlanes, max_steps, qthink, scores, POLICY_GOAL_GREEDY, 0);
+            return;
+        case POLICY_DISTANCE_BIASED:
+            rollout_batch_loop(me, state, qlanes, max_steps, qthink, scores, POLICY_DISTANCE_BIASED, 0);
+            return;
+        default:
+            rollout_batch_loop(me, state, qlanes, max_steps, qthink, scores, POLICY_UNIFORM, 0);
+            return;
+    }
+}
+
+static void rollout_batch_generic(
+    struct mcts_ai * restrict const me,
+    const struct state * const state,
+    const uint32_t qlanes,
+    uint32_t max_steps,
+    uint32_t * qthink,
+    float * restrict const scores)
+{
+    rollout_batch_switch(me, state, qlanes, max_steps, qthink, scores);
+}
+
+#ifdef HAVE_SIMD_DISPATCH
+__attribute__ ((target ("avx2,bmi2,popcnt")))
+static void rollout_batch_avx2(
+    struct mcts_ai * restrict const me,
+    const struct state * const state,
+    const uint32_t qlanes,
+    uint32_t max_steps,
+    uint32_t * qthink,
+    float * restrict const scores)
+{
+    rollout_batch_switch(me, state, qlanes, max_steps, qthink, scores);
+}
+
+__attribute__ ((target ("avx512f,avx512bw,avx2,bmi2,popcnt")))
+static void rollout_batch_avx512(
+    struct mcts_ai * restrict const me,
+    const struct state * const state,
+    const uint32_t qlanes,
+    uint32_t max_steps,
+    uint32_t * qthink,
+    float * restrict const scores)
+{
+    rollout_batch_switch(me, state, qlanes, max_steps, qthink, scores);
+}
+#endif
+
+static void rollout_batch(
+    struct mcts_ai * restrict const me,
+    const struct state * const state,
+    const uint32_t qlanes,
+    uint32_t max_steps,
+    uint32_t * qthink,
+    float * restrict const scores)
+{
+    switch (me->simd) {
+#ifdef HAVE_SIMD_DISPATCH
+        case SIMD_AVX512:
+            rollout_batch_avx512(me, state, qlanes, max_steps, qthink, scores);
+            return;
+        case SIMD_AVX2:
+            rollout_batch_avx2(me, state, qlanes, max_steps, qthink, scores);
+            return;
+#endif
+        default:
+            rollout_batch_generic(me, state, qlanes, max_steps, qthink, scores);
+            return;
+    }
 }
 
+/* Score is a sum of qgames results for player 1 */
 static void update_history(
     struct mcts_ai * restrict const me,
-    const int32_t score)
+    const float score,
+    const uint32_t qgames)
 {
     const struct hist_item * ptr = me->hist;
     const struct hist_item * const end = me->hist_ptr;
     for (; ptr != end; ++ptr) {
         struct node * restrict const node = me->nodes + ptr->inode;
-        ++node->qgames;
+        node->qgames += qgames;
         node->score += ptr->active == 1 ? score : -score;
     }
 
+    me->qlast_games = qgames;
+
     const uint32_t hist_len = me->hist_ptr - me->hist;
     if (hist_len > me->max_hist_len) {
         me->max_hist_len = hist_len;
@@ -582,31 +1484,14 @@ static void add_history(
     struct node * restrict const node,
     const int active)
 {
-    if (me->hist_ptr != me->hist_last) {
-        me->hist_ptr->inode = node - me->nodes;
-        me->hist_ptr->active = active;
-        ++me->hist_ptr;
-        return;
-    }
-
-    const size_t hist_capacity = me->hist_last - me->hist;
-    const size_t new_hist_capacity = 128 + 2 * hist_capacity;
-    const size_t new_history_sz = new_hist_capacity * sizeof(struct hist_item);
-    struct hist_item * restrict const new_hist = realloc(me->hist, new_history_sz);
-    if (new_hist == NULL) {
-        return;
-    }
-
-    me->hist_ptr += new_hist - me->hist;
-    me->hist = new_hist;
-    me->hist_last = new_hist + new_hist_capacity;
+    /* History is sized for the longest possible path in create_mcts_ai */
     me->hist_ptr->inode = node - me->nodes;
     me->hist_ptr->active = active;
     ++me->hist_ptr;
 }
 
 static enum step select_step(
-    const struct mcts_ai * const me,
+    struct mcts_ai * restrict const me,
     const struct node * const node,
     steps_t steps)
 {
@@ -625,10 +1510,8 @@ static enum step select_step(
     while (steps != 0) {
         const enum step step = extract_step(&steps);
         const struct node * const child = me->nodes + node->children[step];
-        const float score = child->score;
-        const float qgames = child->qgames;
-        const float ev = score / qgames;
-        const float investigation = sqrt(log_total/qgames);
+        const float ev = child->score / child->qgames;
+        const float investigation = sqrt(log_total / child->qgames);
         const float weight = ev + me->C * investigation;
 
         if (weight >= best_weight) {
@@ -640,14 +1523,15 @@ static enum step select_step(
         }
     }
 
-    const int index = qbest == 1 ? 0 : rand() % qbest;
+    const int index = qbest == 1 ? 0 : ai_random(me) % qbest;
     const enum step choice = best_steps[index];
     return choice;
 }
 
-static uint32_t simulate(
+static inline __attribute__((always_inline)) uint32_t simulate_loop(
     struct mcts_ai * restrict const me,
-    struct node * restrict node)
+    struct node * restrict node,
+    const int is_default_board)
 {
     struct state * restrict const state = me->backup;
     state_copy(state, me->state);
@@ -667,11 +1551,14 @@ static uint32_t simulate(
 
     uint32_t qthink = 1;
     me->hist_ptr = me->hist;
+    me->qlast_games = 1;
+    steps_t mask = me->root_steps;
 
     for (;;) {
-        const steps_t answers = lines[ball] ^ 0xFF;
+        const steps_t answers = (lines[ball] ^ 0xFF) & mask;
+        mask = 0xFF;
         if (answers == 0) {
-            update_history(me, active != 1 ? +1 : -1);
+            update_history(me, active != 1 ? +1 : -1, 1);
             return qthink;
         }
 
@@ -682,7 +1569,11 @@ static uint32_t simulate(
         if (ichild == 0) {
             struct node * restrict const child = alloc_node(me);
             if (child == NULL) {
-                return 0;
+                if (!me->is_analyzing) {
+                    return 0;
+                }
+                /* Analysis goes on with full tree, rollout starts at the leaf */
+                break;
             }
             node->children[step] = child - me->nodes;
             node = child;
@@ -692,15 +1583,15 @@ static uint32_t simulate(
 
         add_history(me, node, active);
 
-        const int next = connections[ball*QSTEPS + step];
+        const int next = next_point(connections, ball, step, is_default_board);
 
         if (next == GOAL_1) {
-            update_history(me, +1);
+            update_history(me, +1, 1);
             return qthink;
         }
 
         if (next == GOAL_2) {
-            update_history(me, -1);
+            update_history(me, -1, 1);
             return qthink;
         }
 
@@ -719,11 +1610,52 @@ static uint32_t simulate(
 
     state->ball = ball;
     state->active = active;
-    const int32_t score = rollout(state, me->max_depth, &qthink);
-    update_history(me, score);
+    const uint32_t rollout_start = qthink;
+    if (me->batch > 1) {
+        float scores[MAX_BATCH];
+        rollout_batch(me, state, me->batch, me->max_depth, &qthink, scores);
+
+        float score = 0;
+        for (uint32_t lane = 0; lane < me->batch; ++lane) {
+            score += scores[lane];
+        }
+
+        me->qrollouts += me->batch;
+        me->qrollout_steps += qthink - rollout_start;
+        update_history(me, score, me->batch);
+        return qthink;
+    }
+
+    const float score = rollout(me, state, me->max_depth, &qthink);
+    ++me->qrollouts;
+    me->qrollout_steps += qthink - rollout_start;
+    update_history(me, score, 1);
     return qthink;
 }
 
+static uint32_t simulate_generic(
+    struct mcts_ai * restrict const me,
+    struct node * restrict node)
+{
+    return simulate_loop(me, node, 0);
+}
+
+static uint32_t simulate_default(
+    struct mcts_ai * restrict const me,
+    struct node * restrict node)
+{
+    return simulate_loop(me, node, 1);
+}
+
+static uint32_t simulate(
+    struct mcts_ai * restrict const me,
+    struct node * restrict node)
+{
+    return me->is_default_board
+        ? simulate_default(me, node)
+        : simulate_generic(me, node);
+}
+
 static int compare_stats(
     const void * const ptr_a,
     const void * const ptr_b)
@@ -735,37 +1667,162 @@ static int compare_stats(
     return 0;
 }
 
-static enum step ai_go(
+/* Node 0 is a sentinel and node 1 is the root of the last search */
+static int has_tree(const struct mcts_ai * const me)
+{
+    return me->used_nodes >= 2 && me->tree_hash == state_hash(me->state);
+}
+
+static uint64_t memo_key(const struct mcts_ai * const me, const uint64_t hash)
+{
+    uint32_t C_bits;
+    memcpy(&C_bits, &me->C, sizeof(C_bits));
+    const uint32_t values[9] = {
+        me->cache, me->max_depth, C_bits, me->adjudicate, me->cutoff,
+        me->policy, me->reach, me->batch, me->seed
+    };
+
+    uint64_t key = hash;
+    for (int i=0; i<9; ++i) {
+        key = (key ^ values[i]) * 0x100000001B3ULL;
+    }
+    return key;
+}
+
+static struct memo_entry * find_memo(
     struct mcts_ai * restrict const me,
-    struct ai_explanation * restrict const explanation)
+    const uint64_t key)
 {
-    if (explanation) {
-        explanation->qstats = 0;
-        explanation->stats = NULL;
-        explanation->time = 0.0;
-        explanation->score = -1.0;
+    struct memo_entry * restrict const entries = me->memo_entries;
+    for (uint32_t i=0; i<me->memo; ++i) {
+        if (entries[i].tick != 0 && entries[i].key == key) {
+            entries[i].tick = ++me->memo_tick;
+            return entries + i;
+        }
+    }
+
+    return NULL;
+}
+
+/* Entry with the same key is overwritten, otherwise a free or the least recently used one */
+static struct memo_entry * take_memo(
+    struct mcts_ai * restrict const me,
+    const uint64_t key)
+{
+    struct memo_entry * restrict const entries = me->memo_entries;
+    struct memo_entry * restrict result = entries;
+    for (uint32_t i=0; i<me->memo; ++i) {
+        if (entries[i].tick != 0 && entries[i].key == key) {
+            result = entries + i;
+            break;
+        }
+
+        if (entries[i].tick < result->tick) {
+            result = entries + i;
+        }
     }
 
+    result->key = key;
+    result->tick = ++me->memo_tick;
+    return result;
+}
+
+static void count_memo(
+    struct mcts_ai * restrict const me,
+    uint32_t * restrict const counter)
+{
+    ++*counter;
+    const uint32_t total = me->qmemo_hits + me->qmemo_extends + me->qmemo_misses;
+    me->memo_rate = 100.0 * me->qmemo_hits / total;
+}
+
+/*
+ * Prepares the search tree, returns root node or NULL if there is nothing
+ * to search: *choice is the forced step or INVALID_STEP on error. For go
+ * (is_go is set) it may be the book step or the step of a memo entry with
+ * enough thinking, an entry with less thinking extends the tree if it is
+ * still in the cache (memo_qthink is the thinking done).
+ */
+static struct node * start_search(
+    struct mcts_ai * restrict const me,
+    enum step * restrict const choice,
+    const int is_go)
+{
+    me->memo_answer = NULL;
+    me->memo_qthink = 0;
+
     const steps_t steps = state_get_steps(me->state);
     if (steps == 0) {
         snprintf(me->error_buf, ERROR_BUF_SZ, "no possible steps.");
-        return INVALID_STEP;
+        *choice = INVALID_STEP;
+        return NULL;
     }
 
     const int multiple_ways = steps & (steps - 1);
     if (!multiple_ways) {
-        const enum step choice = first_step(steps);
-        return choice;
+        *choice = first_step(steps);
+        return NULL;
     }
 
-    double start = clock();
+    /* Book step is checked, a hash collision should not make an illegal step */
+    if (is_go && me->is_book_match) {
+        const enum step step = book_lookup(me->book, me->state);
+        if (step != INVALID_STEP && (steps & (1 << step))) {
+            *choice = step;
+            return NULL;
+        }
+    }
+
+    /* Mirrored steps are equal in symmetric position, search only one of them */
+    const int is_symmetric = state_is_symmetric(me->state);
+    me->root_steps = is_symmetric ? 0xFF ^ EAST_STEPS : 0xFF;
+
+    const steps_t root_steps = steps & me->root_steps;
+    const int multiple_root_ways = root_steps & (root_steps - 1);
+    if (!multiple_root_ways) {
+        const enum step step = first_step(root_steps);
+        *choice = ai_random(me) % 2 ? MIRROR(step) : step;
+        return NULL;
+    }
+
+    reset_counters(me);
+
+    const uint64_t hash = state_hash(me->state);
+    const uint64_t key = memo_key(me, hash);
+
+    /* Loaded tree is continued once, by the next search in its position */
+    const int is_tree_loaded = me->is_tree_loaded;
+    me->is_tree_loaded = 0;
+    if (is_tree_loaded && has_tree(me)) {
+        me->tree_key = key;
+        return me->nodes + 1;
+    }
+
+    if (is_go && me->memo_entries != NULL) {
+        const struct memo_entry * const entry = find_memo(me, key);
+        if (entry != NULL && entry->qthink >= me->qthink && (steps & (1 << entry->step))) {
+            count_memo(me, &me->qmemo_hits);
+            me->memo_answer = entry;
+            *choice = entry->step;
+            return NULL;
+        }
+
+        if (entry != NULL && me->used_nodes >= 2 && me->tree_key == key && me->tree_hash == hash) {
+            count_memo(me, &me->qmemo_extends);
+            me->memo_qthink = entry->qthink;
+            return me->nodes + 1;
+        }
 
-    init_cache(me);
+        count_memo(me, &me->qmemo_misses);
+    }
+
+    reset_cache(me);
 
     struct node * restrict const zero = alloc_node(me);
     if (zero == NULL) {
         snprintf(me->error_buf, ERROR_BUF_SZ, "alloc zero node failed.");
-        return INVALID_STEP;
+        *choice = INVALID_STEP;
+        return NULL;
     }
     zero->score = 2;
     zero->qgames = 1;
@@ -773,28 +1830,39 @@ static enum step ai_go(
     struct node * restrict const root = alloc_node(me);
     if (root == NULL) {
         snprintf(me->error_buf, ERROR_BUF_SZ, "alloc root node failed.");
-        return INVALID_STEP;
+        *choice = INVALID_STEP;
+        return NULL;
     }
 
     root->qgames = 1;
-    uint32_t qthink = 0;
-    for (;;) {
-        const uint32_t delta_think = simulate(me, root);
-        if (delta_think == 0) {
-            break;
-        }
+    me->tree_hash = hash;
+    me->tree_key = key;
+    return root;
+}
 
-        qthink += delta_think;
-        ++root->qgames;
+/* Returns number of steps thought, 0 if the tree is full */
+static inline uint32_t search_more(
+    struct mcts_ai * restrict const me,
+    struct node * restrict const root)
+{
+    const uint32_t delta_think = simulate(me, root);
+    root->qgames += delta_think == 0 ? 0 : me->qlast_games;
+    return delta_think;
+}
 
-        if (qthink >= me->qthink) {
-            break;
-        }
-    }
+static inline int is_stopped(const struct mcts_ai * const me)
+{
+    return __atomic_load_n(&me->is_stopped, __ATOMIC_RELAXED);
+}
 
+/* Most visited root steps, ties are kept in order */
+static int best_root_steps(
+    const struct mcts_ai * const me,
+    const struct node * const root,
+    enum step best_steps[QSTEPS])
+{
     int qbest = 0;
-    int32_t best_qgames = 0;
-    enum step best_steps[QSTEPS];
+    int64_t best_qgames = 0;
 
     for (enum step step=0; step<QSTEPS; ++step) {
         const uint32_t ichild = root->children[step];
@@ -812,171 +1880,2456 @@ static enum step ai_go(
         }
     }
 
-    const int index = qbest == 1 ? 0 : rand() % qbest;
-    enum step result = best_steps[index];
+    return qbest;
+}
 
-    if (explanation) {
-        double finish = clock();
-        explanation->time = (finish - start) / CLOCKS_PER_SEC;
+/* Used when nothing is searched yet */
+static enum step first_root_step(const struct mcts_ai * const me)
+{
+    return first_step(state_get_steps(me->state) & me->root_steps);
+}
 
-        size_t qstats = 1;
-        for (enum step step=0; step<QSTEPS; ++step) {
-            const uint32_t ichild = root->children[step];
-            if (ichild == 0) {
-                continue;
+static enum step choose_step(
+    struct mcts_ai * restrict const me,
+    const struct node * const root)
+{
+    enum step best_steps[QSTEPS];
+    const int qbest = best_root_steps(me, root, best_steps);
+    if (qbest == 0) {
+        return first_root_step(me);
+    }
+
+    const int index = qbest == 1 ? 0 : ai_random(me) % qbest;
+    enum step result = best_steps[index];
+    if (me->root_steps != 0xFF && ai_random(me) % 2) {
+        result = MIRROR(result);
+    }
+
+    return result;
+}
+
+/*
+ * Principal variations
+ *
+ * Root turns are paths from the root until the active player changes or
+ * the game is over, the most visited ones are kept sorted by qgames. A path
+ * is cut at a tree leaf or at MAX_PV_LEN steps. Every kept turn is
+ * continued by the most visited children.
+ */
+
+struct pv_search
+{
+    struct mcts_ai * me;
+    struct state * state;
+    int active;
+    uint32_t qvariations;
+    enum step path[MAX_PV_LEN];
+};
+
+static void add_turn(
+    struct pv_search * restrict const search,
+    const uint32_t inode,
+    const unsigned int len)
+{
+    struct mcts_ai * restrict const me = search->me;
+    const int64_t qgames = me->nodes[inode].qgames;
+
+    uint32_t i = search->qvariations;
+    if (i == me->multipv && qgames <= me->variations[i-1].qgames) {
+        return;
+    }
+
+    if (i == me->multipv) {
+        --i;
+    } else {
+        ++search->qvariations;
+    }
+
+    for (; i > 0 && me->variations[i-1].qgames < qgames; --i) {
+        me->variations[i] = me->variations[i-1];
+        me->pv_nodes[i] = me->pv_nodes[i-1];
+        memcpy(me->pv_steps[i], me->pv_steps[i-1], sizeof(me->pv_steps[i]));
+    }
+
+    me->variations[i].qgames = qgames;
+    me->variations[i].qturn = len;
+    me->pv_nodes[i] = inode;
+    memcpy(me->pv_steps[i], search->path, len * sizeof(enum step));
+}
+
+static void find_turns(
+    struct pv_search * restrict const search,
+    const struct node * const node,
+    const unsigned int depth)
+{
+    struct mcts_ai * restrict const me = search->me;
+    struct state * restrict const state = search->state;
+
+    for (enum step step=0; step<QSTEPS; ++step) {
+        const uint32_t ichild = node->children[step];
+        if (ichild == 0 || me->nodes[ichild].qgames <= 0) {
+            continue;
+        }
+
+        state_step(state, step);
+        search->path[depth] = step;
+
+        const int is_turn_over = 0
+            || state->active != search->active
+            || state_status(state) != IN_PROGRESS
+            || depth + 1 == MAX_PV_LEN
+        ;
+
+        const struct node * const child = me->nodes + ichild;
+        int is_leaf = 1;
+        for (enum step next=0; next<QSTEPS; ++next) {
+            const uint32_t inext = child->children[next];
+            is_leaf &= inext == 0 || me->nodes[inext].qgames <= 0;
+        }
+
+        if (is_turn_over || is_leaf) {
+            add_turn(search, ichild, depth + 1);
+        } else {
+            find_turns(search, child, depth + 1);
+        }
+
+        state_unstep(state, step);
+    }
+}
+
+static void explain_variations(
+    struct mcts_ai * restrict const me,
+    const struct node * const root,
+    struct ai_explanation * restrict const explanation)
+{
+    struct pv_search search;
+    search.me = me;
+    search.state = me->backup;
+    search.active = me->state->active;
+    search.qvariations = 0;
+
+    state_copy(me->backup, me->state);
+    find_turns(&search, root, 0);
+
+    for (uint32_t i = 0; i < search.qvariations; ++i) {
+        struct ai_variation * restrict const variation = me->variations + i;
+        const struct node * node = me->nodes + me->pv_nodes[i];
+
+        const int64_t qgames = node->qgames;
+        variation->score = 0.5 * (node->score + qgames) / (double)qgames;
+        variation->steps = me->pv_steps[i];
+
+        unsigned int len = variation->qturn;
+        while (len < MAX_PV_LEN) {
+            enum step best_step = INVALID_STEP;
+            int64_t best_qgames = 0;
+            for (enum step step=0; step<QSTEPS; ++step) {
+                const uint32_t ichild = node->children[step];
+                if (ichild != 0 && me->nodes[ichild].qgames > best_qgames) {
+                    best_step = step;
+                    best_qgames = me->nodes[ichild].qgames;
+                }
+            }
+
+            if (best_step == INVALID_STEP) {
+                break;
+            }
+
+            me->pv_steps[i][len++] = best_step;
+            node = me->nodes + node->children[best_step];
+        }
+
+        variation->qsteps = len;
+    }
+
+    explanation->qvariations = search.qvariations;
+    explanation->variations = me->variations;
+}
+
+/* Root statistics, the chosen step goes first, other steps by qgames */
+static void explain(
+    struct mcts_ai * restrict const me,
+    const struct node * const root,
+    const enum step result,
+    struct ai_explanation * restrict const explanation)
+{
+    const steps_t steps = state_get_steps(me->state);
+
+    /* Result may be not visited yet if search is ended at once */
+    me->stats[0].step = result;
+    me->stats[0].qgames = 0;
+    me->stats[0].score = -1.0;
+
+    size_t qstats = 1;
+    for (enum step step=0; step<QSTEPS; ++step) {
+        const steps_t mask = 1 << step;
+        const int is_pruned = (mask & steps & ~me->root_steps) != 0;
+        const uint32_t ichild = root->children[is_pruned ? MIRROR(step) : step];
+        if (ichild == 0) {
+            continue;
+        }
+
+        const struct node * const child = me->nodes + ichild;
+        const int64_t qgames = child->qgames;
+        const double score = child->score;
+        double norm_score = -1.0;
+        if (qgames > 0) {
+            norm_score = 0.5 * (score + qgames) / (double)qgames;
+        }
+
+        const size_t i = step == result ? 0 : qstats;
+        me->stats[i].step = step;
+        me->stats[i].qgames = child->qgames;
+        me->stats[i].score = norm_score;
+        qstats += !!i;
+    }
+
+    explanation->qstats = qstats;
+    explanation->stats = me->stats;
+    explanation->qplayouts = root->qgames - 1;
+    explanation->qnodes = me->used_nodes;
+
+    explanation->score = me->stats[0].score;
+    if (me->state->active == 2) {
+        explanation->score = 1.0 - explanation->score;
+    }
+
+    if (qstats > 2) {
+        qsort(me->stats + 1, qstats - 1, sizeof(struct step_stat), compare_stats);
+    }
+
+    explain_variations(me, root, explanation);
+}
+
+static void init_explanation(struct ai_explanation * restrict const explanation)
+{
+    explanation->qstats = 0;
+    explanation->stats = NULL;
+    explanation->time = 0.0;
+    explanation->score = -1.0;
+    explanation->qplayouts = 0;
+    explanation->qnodes = 0;
+    explanation->qvariations = 0;
+    explanation->variations = NULL;
+}
+
+static void explain_memo(
+    struct mcts_ai * restrict const me,
+    const struct memo_entry * const entry,
+    struct ai_explanation * restrict const explanation)
+{
+    memcpy(me->stats, entry->stats, entry->qstats * sizeof(struct step_stat));
+    explanation->qstats = entry->qstats;
+    explanation->stats = me->stats;
+    explanation->score = entry->score;
+    explanation->qplayouts = entry->qplayouts;
+    explanation->qnodes = entry->qnodes;
+}
+
+/* Root statistics are kept, principal variations are not */
+static void save_memo(
+    struct mcts_ai * restrict const me,
+    const enum step step,
+    const struct ai_explanation * const explanation)
+{
+    struct memo_entry * restrict const entry = take_memo(me, me->tree_key);
+    entry->qthink = me->search_qthink;
+    entry->qplayouts = explanation->qplayouts;
+    entry->qnodes = explanation->qnodes;
+    entry->qstats = explanation->qstats;
+    entry->score = explanation->score;
+    entry->step = step;
+    memcpy(entry->stats, explanation->stats, explanation->qstats * sizeof(struct step_stat));
+}
+
+/*
+ * Search in slices: root, thought steps and start time are kept in the
+ * engine between calls, so search may be continued later. A step, a new
+ * position or a new cache ends the search, go_end fails then. ai_go is a
+ * single slice without budget limit.
+ */
+
+static int go_begin(struct mcts_ai * restrict const me)
+{
+    me->search_root = start_search(me, &me->search_choice, 1);
+    if (me->search_root == NULL && me->search_choice == INVALID_STEP) {
+        me->is_search_done = 1;
+        return EINVAL;
+    }
+
+    if (me->search_root != NULL) {
+        me->search_choice = INVALID_STEP;
+    }
+
+    me->search_qthink = me->memo_qthink;
+    me->is_search_done = me->search_root == NULL;
+    me->search_start = clock();
+    return 0;
+}
+
+/* Thinks at most budget steps (or one more simulation), returns nonzero when search is completed */
+static int go_continue(
+    struct mcts_ai * restrict const me,
+    const uint32_t budget)
+{
+    struct node * restrict const root = me->search_root;
+
+    uint32_t qthink = 0;
+    while (!me->is_search_done && qthink < budget) {
+        const uint32_t delta_think = search_more(me, root);
+        if (delta_think == 0) {
+            me->is_search_done = 1;
+            break;
+        }
+
+        qthink += delta_think;
+        me->search_qthink += delta_think;
+        if (me->search_qthink >= me->qthink) {
+            me->is_search_done = 1;
+            break;
+        }
+
+        if (is_stopped(me)) {
+            me->is_search_done = 1;
+            break;
+        }
+    }
+
+    return me->is_search_done;
+}
+
+/* Current best step without finishing the search */
+static enum step go_peek(
+    struct mcts_ai * restrict const me,
+    struct ai_explanation * restrict const explanation)
+{
+    if (explanation) {
+        init_explanation(explanation);
+    }
+
+    struct node * restrict const root = me->search_root;
+    if (root == NULL) {
+        if (me->search_choice == INVALID_STEP) {
+            snprintf(me->error_buf, ERROR_BUF_SZ, "no search in progress.");
+        }
+
+        if (explanation && me->memo_answer) {
+            explain_memo(me, me->memo_answer, explanation);
+        }
+        return me->search_choice;
+    }
+
+    enum step best_steps[QSTEPS];
+    const int qbest = best_root_steps(me, root, best_steps);
+    const enum step best = qbest > 0 ? best_steps[0] : first_root_step(me);
+
+    if (explanation) {
+        double now = clock();
+        explain(me, root, best, explanation);
+        explanation->time = (now - me->search_start) / CLOCKS_PER_SEC;
+    }
+
+    return best;
+}
+
+static enum step go_end(
+    struct mcts_ai * restrict const me,
+    struct ai_explanation * restrict const explanation)
+{
+    if (explanation) {
+        init_explanation(explanation);
+    }
+
+    struct node * restrict const root = me->search_root;
+    const enum step choice = me->search_choice;
+    const struct memo_entry * const memo_answer = me->memo_answer;
+    me->search_root = NULL;
+    me->search_choice = INVALID_STEP;
+    me->memo_answer = NULL;
+    me->is_search_done = 1;
+
+    if (root == NULL) {
+        if (choice == INVALID_STEP) {
+            snprintf(me->error_buf, ERROR_BUF_SZ, "no search in progress.");
+        }
+
+        if (explanation && memo_answer) {
+            explain_memo(me, memo_answer, explanation);
+        }
+        return choice;
+    }
+
+    const enum step result = choose_step(me, root);
+
+    if (explanation) {
+        double finish = clock();
+        explain(me, root, result, explanation);
+        explanation->time = (finish - me->search_start) / CLOCKS_PER_SEC;
+    }
+
+    if (me->memo_entries != NULL) {
+        struct ai_explanation memo_explanation;
+        if (explanation == NULL) {
+            explain(me, root, result, &memo_explanation);
+        }
+        save_memo(me, result, explanation ? explanation : &memo_explanation);
+    }
+
+    return result;
+}
+
+static enum step ai_go(
+    struct mcts_ai * restrict const me,
+    struct ai_explanation * restrict const explanation)
+{
+    const int status = go_begin(me);
+    if (status != 0) {
+        if (explanation) {
+            init_explanation(explanation);
+        }
+        return INVALID_STEP;
+    }
+
+    go_continue(me, UINT32_MAX);
+    return go_end(me, explanation);
+}
+
+static double wall_time(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + 1.0e-9 * now.tv_nsec;
+}
+
+/* Clock is checked once per ANALYZE_CHECK_MASK+1 simulations */
+#define ANALYZE_CHECK_MASK  63
+
+static enum step ai_analyze(
+    struct mcts_ai * restrict const me,
+    const double interval,
+    ai_report_func report,
+    void * const arg)
+{
+    struct ai_explanation explanation;
+    init_explanation(&explanation);
+
+    enum step choice;
+    struct node * restrict const root = start_search(me, &choice, 0);
+    if (root == NULL) {
+        if (choice != INVALID_STEP) {
+            explanation.qstats = 1;
+            explanation.stats = me->stats;
+            me->stats[0].step = choice;
+            me->stats[0].qgames = 0;
+            me->stats[0].score = -1.0;
+            report(arg, &explanation);
+        }
+        return choice;
+    }
+
+    const double start = wall_time();
+    double next_report = start + interval;
+
+    /* Tree is kept, when the cache is full only statistics are updated */
+    me->is_analyzing = 1;
+    for (uint32_t i = 0; !is_stopped(me); ++i) {
+        if (search_more(me, root) == 0) {
+            break;
+        }
+
+        if ((i & ANALYZE_CHECK_MASK) != 0) {
+            continue;
+        }
+
+        const double now = wall_time();
+        if (now >= next_report) {
+            enum step best_steps[QSTEPS];
+            best_root_steps(me, root, best_steps);
+            explain(me, root, best_steps[0], &explanation);
+            explanation.time = now - start;
+            report(arg, &explanation);
+            next_report = now + interval;
+        }
+    }
+
+    me->is_analyzing = 0;
+    const enum step result = choose_step(me, root);
+    explain(me, root, result, &explanation);
+    explanation.time = wall_time() - start;
+    report(arg, &explanation);
+    return result;
+}
+
+
+/*
+ * Tree file: header, root position text padded to 8 bytes and the node
+ * arena as it is in memory. Nodes are at a fixed offset, so the file may be
+ * mapped and read in place, load copies them to the cache.
+ */
+
+static const char tree_magic[8] = { 'p', 'f', 't', 'r', 'e', 'e', '0', '1' };
+
+struct tree_header
+{
+    char magic[8];
+    uint32_t tag;
+    uint32_t node_sz;
+    uint64_t hash;
+    uint32_t qnodes;
+    uint32_t position_sz;
+};
+
+static size_t tree_nodes_offset(const uint32_t position_sz)
+{
+    return sizeof(struct tree_header) + ((position_sz + 7) & ~(size_t)7);
+}
+
+static int save_tree(
+    struct mcts_ai * restrict const me,
+    const char * const path)
+{
+    if (!has_tree(me)) {
+        snprintf(me->error_buf, ERROR_BUF_SZ, "No search tree for the current position.");
+        return EINVAL;
+    }
+
+    const struct geometry * const geometry = me->state->geometry;
+    const size_t position_sz = position_text_sz(geometry);
+    const size_t nodes_offset = tree_nodes_offset(position_sz);
+    char position[nodes_offset - sizeof(struct tree_header)];
+    memset(position, 0, sizeof(position));
+    state_encode(me->state, position, position_sz);
+
+    struct tree_header header;
+    memcpy(header.magic, tree_magic, sizeof(tree_magic));
+    header.tag = geometry_tag(geometry);
+    header.node_sz = sizeof(struct node);
+    header.hash = me->tree_hash;
+    header.qnodes = me->used_nodes;
+    header.position_sz = position_sz;
+
+    FILE * const file = fopen(path, "wb");
+    if (file == NULL) {
+        const int status = errno;
+        snprintf(me->error_buf, ERROR_BUF_SZ, "Cannot open %s: %s.", path, strerror(status));
+        return status;
+    }
+
+    const int is_written = 1
+        && fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(position, sizeof(position), 1, file) == 1
+        && fwrite(me->nodes, sizeof(struct node), me->used_nodes, file) == me->used_nodes;
+    int status = is_written ? 0 : errno ? errno : EIO;
+
+    if (fclose(file) != 0 && status == 0) {
+        status = errno;
+    }
+
+    if (status != 0) {
+        snprintf(me->error_buf, ERROR_BUF_SZ, "Cannot write %s: %s.", path, strerror(status));
+    }
+
+    return status;
+}
+
+/* Children are checked, so a broken file cannot make the search go out of the cache */
+static int check_tree(
+    struct mcts_ai * restrict const me,
+    const struct tree_header * const header,
+    const size_t file_sz)
+{
+    const struct geometry * const geometry = me->state->geometry;
+
+    if (memcmp(header->magic, tree_magic, sizeof(tree_magic)) != 0 || header->node_sz != sizeof(struct node)) {
+        snprintf(me->error_buf, ERROR_BUF_SZ, "Not a search tree file or tree of another engine version.");
+        return EINVAL;
+    }
+
+    const size_t nodes_offset = tree_nodes_offset(header->position_sz);
+    if (header->qnodes < 2 || file_sz != nodes_offset + (size_t)header->qnodes * sizeof(struct node)) {
+        snprintf(me->error_buf, ERROR_BUF_SZ, "Search tree file is truncated or broken.");
+        return EINVAL;
+    }
+
+    if (header->tag != geometry_tag(geometry)) {
+        snprintf(me->error_buf, ERROR_BUF_SZ, "Search tree is for another board.");
+        return EINVAL;
+    }
+
+    if (header->hash != state_hash(me->state)) {
+        const char * const position = (const char *)(header + 1);
+        snprintf(me->error_buf, ERROR_BUF_SZ, "Search tree is for position %.*s.",
+            (int)strnlen(position, header->position_sz), position);
+        return EINVAL;
+    }
+
+    if (header->qnodes > me->total_nodes) {
+        snprintf(me->error_buf, ERROR_BUF_SZ, "Cache is too small for the tree, %zu bytes required.",
+            (size_t)header->qnodes * sizeof(struct node));
+        return ENOSPC;
+    }
+
+    const struct node * const nodes = (const struct node *)((const char *)header + nodes_offset);
+    const struct node * const root = nodes + 1;
+    int has_children = 0;
+    for (enum step step=0; step<QSTEPS; ++step) {
+        has_children |= root->children[step] != 0;
+    }
+
+    if (root->qgames <= 0 || !has_children) {
+        snprintf(me->error_buf, ERROR_BUF_SZ, "Search tree file is broken, root is not searched.");
+        return EINVAL;
+    }
+
+    /* Selection divides by child games, every referenced child is played */
+    for (uint32_t i=0; i<header->qnodes; ++i)
+    for (enum step step=0; step<QSTEPS; ++step) {
+        const uint32_t ichild = nodes[i].children[step];
+        if (ichild >= header->qnodes || (ichild != 0 && nodes[ichild].qgames <= 0)) {
+            snprintf(me->error_buf, ERROR_BUF_SZ, "Search tree file is broken, node %u has invalid child.", i);
+            return EINVAL;
+        }
+    }
+
+    return 0;
+}
+
+static int load_tree(
+    struct mcts_ai * restrict const me,
+    const char * const path)
+{
+    const int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        const int status = errno;
+        snprintf(me->error_buf, ERROR_BUF_SZ, "Cannot open %s: %s.", path, strerror(status));
+        return status;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct tree_header)) {
+        close(fd);
+        snprintf(me->error_buf, ERROR_BUF_SZ, "Search tree file is truncated or broken.");
+        return EINVAL;
+    }
+
+    const size_t file_sz = st.st_size;
+    const void * const map = mmap(NULL, file_sz, PROT_READ, MAP_PRIVATE, fd, 0);
+    const int map_status = map == MAP_FAILED ? errno : 0;
+    close(fd);
+    if (map_status != 0) {
+        snprintf(me->error_buf, ERROR_BUF_SZ, "Cannot map %s: %s.", path, strerror(map_status));
+        return map_status;
+    }
+
+    const struct tree_header * const header = map;
+    const int status = check_tree(me, header, file_sz);
+    if (status == 0) {
+        const char * const nodes = (const char *)map + tree_nodes_offset(header->position_sz);
+        cancel_search(me);
+        memcpy(me->nodes, nodes, (size_t)header->qnodes * sizeof(struct node));
+        me->used_nodes = header->qnodes;
+        me->good_node_alloc = header->qnodes;
+        me->bad_node_alloc = 0;
+        me->tree_hash = header->hash;
+        me->is_tree_loaded = 1;
+    }
+
+    munmap((void *)map, file_sz);
+    return status;
+}
+
+
+
+#ifdef MAKE_CHECK
+
+#include "insider.h"
+
+#include <pthread.h>
+
+#define BW    9
+#define BH   11
+#define GW    2
+
+#define QROLLOUTS   1024
+
+int test_rollout(void)
+{
+    struct geometry * restrict const geometry = create_std_geometry(BW, BH, GW);
+    if (geometry == NULL) {
+        test_fail("create_std_geometry(%d, %d, %d) fails, return value is NULL, errno is %d.",
+            BW, BH, GW, errno);
+    }
+
+    struct mcts_ai * restrict const me = create_mcts_ai(geometry);
+    if (me == NULL) {
+        test_fail("create_mcts_ai(geometry) fails, return value is NULL, errno is %d.", errno);
+    }
+
+    struct state * restrict const state = create_state(geometry);
+    if (state == NULL) {
+        test_fail("create_state(geometry) fails, fails, return value is NULL, errno is %d.", errno);
+    }
+
+    struct state * restrict const base = create_state(geometry);
+    if (base == NULL) {
+        test_fail("create_state(geometry) fails, fails, return value is NULL, errno is %d.", errno);
+    }
+
+    for (int i=0; i<QROLLOUTS; ++i) {
+        state_copy(state, base);
+
+        uint32_t qthink = 0;
+        const float score = rollout(me, state, BW*BH*8, &qthink);
+        if (score != -1 && score != +1) {
+            test_fail("rollout %d returns unexpected score %f (-1 or +1 expected).", i, score);
+        }
+
+        if (qthink >= BW*BH*8) {
+            test_fail("Unexpected qthink value %u after rollout.", qthink);
+        }
+    }
+
+    state_copy(state, base);
+    uint32_t qthink = 0;
+    const float score = rollout(me, state, 4, &qthink);
+    if (score != 0) {
+        test_fail("short rollout returns unexpected score %f, 0 expected.", score);
+    }
+
+    if (qthink != 4) {
+        test_fail("Unexpected qthink value %u after rollout, 4 expected.", qthink);
+    }
+
+    destroy_state(base);
+    destroy_state(state);
+    free_ai(me);
+    destroy_geometry(geometry);
+    return 0;
+}
+
+int test_adjudication(void)
+{
+    struct geometry * restrict const geometry = create_std_geometry(BW, BH, GW);
+    if (geometry == NULL) {
+        test_fail("create_std_geometry(%d, %d, %d) fails, return value is NULL, errno is %d.",
+            BW, BH, GW, errno);
+    }
+
+    struct mcts_ai * restrict const me = create_mcts_ai(geometry);
+    if (me == NULL) {
+        test_fail("create_mcts_ai(geometry) fails, return value is NULL, errno is %d.", errno);
+    }
+
+    struct state * restrict const state = create_state(geometry);
+    if (state == NULL) {
+        test_fail("create_state(geometry) fails, fails, return value is NULL, errno is %d.", errno);
+    }
+
+    const int goal_mouth = (BH-1) * BW + BW/2;
+
+    /* Player 1 has a step to GOAL_1 */
+    state->ball = goal_mouth;
+    state->active = 1;
+    uint32_t qthink = 0;
+    float score = rollout(me, state, BW*BH*8, &qthink);
+    if (score != +1) {
+        test_fail("goal in one step: rollout returns %f, +1 expected.", score);
+    }
+    if (qthink != 0) {
+        test_fail("goal in one step: qthink is %u, 0 expected.", qthink);
+    }
+    if (me->qadjudicated != 1) {
+        test_fail("goal in one step: qadjudicated is %llu, 1 expected.", (unsigned long long)me->qadjudicated);
+    }
+
+    /* Player 2 has only a step to GOAL_1 */
+    init_lines(geometry, state->lines);
+    state->lines[goal_mouth] = 0xFF ^ (1 << NORTH);
+    state->ball = goal_mouth;
+    state->active = 2;
+    qthink = 0;
+    score = rollout(me, state, BW*BH*8, &qthink);
+    if (score != +1) {
+        test_fail("forced own goal: rollout returns %f, +1 expected.", score);
+    }
+    if (qthink != 0) {
+        test_fail("forced own goal: qthink is %u, 0 expected.", qthink);
+    }
+    if (me->qadjudicated != 2) {
+        test_fail("forced own goal: qadjudicated is %llu, 2 expected.", (unsigned long long)me->qadjudicated);
+    }
+
+    /* Switched off adjudication plays the step */
+    me->adjudicate = 0;
+    state->lines[goal_mouth] = 0xFF ^ (1 << NORTH);
+    state->ball = goal_mouth;
+    state->active = 2;
+    qthink = 0;
+    score = rollout(me, state, BW*BH*8, &qthink);
+    if (score != +1) {
+        test_fail("no adjudication: rollout returns %f, +1 expected.", score);
+    }
+    if (me->qadjudicated != 2) {
+        test_fail("no adjudication: qadjudicated is %llu, 2 expected.", (unsigned long long)me->qadjudicated);
+    }
+
+    /* Reachability check sees that only GOAL_1 is left */
+    me->reach = 1;
+    init_lines(geometry, state->lines);
+    for (enum step step=0; step<QSTEPS; ++step) {
+        const int next = geometry->connections[QSTEPS*goal_mouth + step];
+        if (step != NORTH && next >= 0) {
+            state->lines[goal_mouth] |= 1 << step;
+            state->lines[next] |= 1 << BACK(step);
+        }
+    }
+    state->ball = goal_mouth;
+    state->active = 2;
+    score = rollout(me, state, BW*BH*8, &qthink);
+    if (score != +1) {
+        test_fail("reachability cut: rollout returns %f, +1 expected.", score);
+    }
+    if (me->qreach_cuts != 1) {
+        test_fail("reachability cut: qreach_cuts is %llu, 1 expected.", (unsigned long long)me->qreach_cuts);
+    }
+
+    destroy_state(state);
+    free_ai(me);
+    destroy_geometry(geometry);
+    return 0;
+}
+
+int test_rollout_policies(void)
+{
+    struct geometry * restrict const geometry = create_std_geometry(BW, BH, GW);
+    if (geometry == NULL) {
+        test_fail("create_std_geometry(%d, %d, %d) fails, return value is NULL, errno is %d.",
+            BW, BH, GW, errno);
+    }
+
+    struct mcts_ai * restrict const me = create_mcts_ai(geometry);
+    if (me == NULL) {
+        test_fail("create_mcts_ai(geometry) fails, return value is NULL, errno is %d.", errno);
+    }
+
+    struct state * restrict const state = create_state(geometry);
+    if (state == NULL) {
+        test_fail("create_state(geometry) fails, fails, return value is NULL, errno is %d.", errno);
+    }
+
+    for (me->policy = 0; policy_names[me->policy] != NULL; ++me->policy) {
+        for (int i=0; i<QROLLOUTS; ++i) {
+            init_lines(geometry, state->lines);
+            state->ball = geometry->qpoints / 2;
+            state->active = 1;
+
+            uint32_t qthink = 0;
+            const float score = rollout(me, state, BW*BH*8, &qthink);
+            if (score != -1 && score != +1) {
+                test_fail("%s rollout %d returns unexpected score %f (-1 or +1 expected).",
+                    policy_names[me->policy], i, score);
+            }
+        }
+    }
+
+    /* Player 2 in front of GOAL_1: goal greedy policy never concedes */
+    const int goal_mouth = (BH-1) * BW + BW/2;
+    me->policy = POLICY_GOAL_GREEDY;
+    me->adjudicate = 0;
+    for (int i=0; i<QROLLOUTS; ++i) {
+        init_lines(geometry, state->lines);
+        state->ball = goal_mouth;
+        state->active = 2;
+
+        uint32_t qthink = 0;
+        const float score = rollout(me, state, 1, &qthink);
+        if (score != 0) {
+            test_fail("goal_greedy rollout %d returns %f, but 0 (no own goal) expected.", i, score);
+        }
+    }
+
+    /* Player 1 in the center: distance biased policy mostly goes north */
+    const int center = geometry->qpoints / 2;
+    const uint8_t north = (1 << NORTH_WEST) | (1 << NORTH) | (1 << NORTH_EAST);
+    int qnorth = 0;
+    me->policy = POLICY_DISTANCE_BIASED;
+    for (int i=0; i<QROLLOUTS; ++i) {
+        init_lines(geometry, state->lines);
+        state->ball = center;
+        state->active = 1;
+
+        uint32_t qthink = 0;
+        rollout(me, state, 1, &qthink);
+        qnorth += (state->lines[center] & north) != 0;
+    }
+
+    if (qnorth < QROLLOUTS * 2 / 3) {
+        test_fail("distance_biased rollout goes north only %d times of %d.", qnorth, QROLLOUTS);
+    }
+
+    destroy_state(state);
+    free_ai(me);
+    destroy_geometry(geometry);
+    return 0;
+}
+
+int test_default_board(void)
+{
+    struct geometry * restrict const geometry = create_std_geometry(BW, BH, GW);
+    struct geometry * restrict const wide_goal = create_std_geometry(BW, BH, GW + 2);
+    struct geometry * restrict const hockey = create_hockey_geometry(BW, BH, GW, 2);
+    if (geometry == NULL || wide_goal == NULL || hockey == NULL) {
+        test_fail("create geometry fails, errno is %d.", errno);
+    }
+
+    if (!is_default_board(geometry)) {
+        test_fail("Std %dx%d board with goal width %d is not recognized as default.", BW, BH, GW);
+    }
+
+    /* Goal width only turns some goal steps into NO_WAY, baked rule still holds */
+    if (!is_default_board(wide_goal)) {
+        test_fail("Std %dx%d board with goal width %d is not recognized as default.", BW, BH, GW + 2);
+    }
+
+    if (is_default_board(hockey)) {
+        test_fail("Hockey board is recognized as default.");
+    }
+
+    struct mcts_ai * restrict const me = create_mcts_ai(geometry);
+    struct state * restrict const generic = create_state(geometry);
+    struct state * restrict const baked = create_state(geometry);
+    if (me == NULL || generic == NULL || baked == NULL) {
+        test_fail("bad alloc, errno is %d.", errno);
+    }
+
+    /* Both loops should play exactly the same games with the same random sequence */
+    for (me->policy = 0; policy_names[me->policy] != NULL; ++me->policy)
+    for (int i=0; i<QROLLOUTS; ++i) {
+        uint32_t generic_qthink = 0;
+        uint32_t baked_qthink = 0;
+
+        init_lines(geometry, generic->lines);
+        init_lines(geometry, baked->lines);
+
+        me->rng = seed_rng(i);
+        me->is_default_board = 0;
+        const float generic_score = rollout(me, generic, BW*BH*QSTEPS, &generic_qthink);
+
+        me->rng = seed_rng(i);
+        me->is_default_board = 1;
+        const float baked_score = rollout(me, baked, BW*BH*QSTEPS, &baked_qthink);
+
+        if (generic_score != baked_score || generic_qthink != baked_qthink) {
+            test_fail("%s rollout %d: generic returns %f after %u steps, baked returns %f after %u steps.",
+                policy_names[me->policy], i, generic_score, generic_qthink, baked_score, baked_qthink);
+        }
+
+        if (memcmp(generic->lines, baked->lines, geometry->qpoints) != 0) {
+            test_fail("%s rollout %d: generic and baked lines differ.", policy_names[me->policy], i);
+        }
+    }
+
+    destroy_state(baked);
+    destroy_state(generic);
+    free_ai(me);
+    destroy_geometry(hockey);
+    destroy_geometry(wide_goal);
+    destroy_geometry(geometry);
+    return 0;
+}
+
+int test_simd_rollouts(void)
+{
+    struct geometry * restrict const geometry = create_hockey_geometry(BW, BH, GW, 2);
+    if (geometry == NULL) {
+        test_fail("create_hockey_geometry fails, errno is %d.", errno);
+    }
+
+    struct mcts_ai * restrict const me = create_mcts_ai(geometry);
+    struct state * restrict const state = create_state(geometry);
+    if (me == NULL || state == NULL) {
+        test_fail("bad alloc, errno is %d.", errno);
+    }
+
+    if (me->simd != simd_variant()) {
+        test_fail("AI uses %s variant, but %s is chosen for CPU.", simd_names[me->simd], simd_names[simd_variant()]);
+    }
+
+    /* Every variant supported by CPU plays the same games */
+    for (int i=0; i<QROLLOUTS; ++i) {
+        float expected_score = 0;
+        uint32_t expected_qthink = 0;
+        for (enum simd_variant simd = SIMD_GENERIC; simd <= simd_variant(); ++simd) {
+            me->simd = simd;
+            init_lines(geometry, state->lines);
+            state->ball = geometry->qpoints / 2;
+            state->active = 1;
+
+            uint32_t qthink = 0;
+            me->rng = seed_rng(i);
+            const float score = rollout(me, state, BW*BH*QSTEPS, &qthink);
+            if (simd == SIMD_GENERIC) {
+                expected_score = score;
+                expected_qthink = qthink;
+            } else if (score != expected_score || qthink != expected_qthink) {
+                test_fail("Rollout %d: %s variant returns %f after %u steps, generic returns %f after %u steps.",
+                    i, simd_names[simd], score, qthink, expected_score, expected_qthink);
+            }
+        }
+    }
+
+    destroy_state(state);
+    free_ai(me);
+    destroy_geometry(geometry);
+    return 0;
+}
+
+int test_batch_rollouts(void)
+{
+    struct geometry * restrict const geometry = create_std_geometry(BW, BH, GW);
+    if (geometry == NULL) {
+        test_fail("create_std_geometry(%d, %d, %d) fails, errno is %d.", BW, BH, GW, errno);
+    }
+
+    struct ai storage;
+    struct ai * restrict const ai = &storage;
+    int status = init_mcts_ai(ai, geometry);
+    if (status != 0) {
+        test_fail("init_mcts_ai fails with code %d.", status);
+    }
+
+    struct mcts_ai * restrict const me = ai->data;
+    const struct state * const state = ai->get_state(ai);
+
+    const uint32_t bad_batches[2] = { 0, MAX_BATCH + 1 };
+    for (int i=0; i<2; ++i) {
+        status = ai->set_param(ai, "batch", bad_batches + i);
+        if (status == 0) {
+            test_fail("set_param(batch, %u) should fail.", bad_batches[i]);
+        }
+    }
+
+    /* Every lane plays own game, the state itself is not changed */
+    uint8_t saved_lines[BW*BH];
+    memcpy(saved_lines, state->lines, sizeof(saved_lines));
+
+    float scores[MAX_BATCH];
+    uint32_t qthink = 0;
+    rollout_batch(me, state, MAX_BATCH, BW*BH*QSTEPS, &qthink, scores);
+
+    if (memcmp(saved_lines, state->lines, sizeof(saved_lines)) != 0) {
+        test_fail("rollout_batch changes the state.");
+    }
+
+    if (qthink < MAX_BATCH) {
+        test_fail("rollout_batch plays only %u steps in %d lanes.", qthink, MAX_BATCH);
+    }
+
+    int qwins[2] = { 0, 0 };
+    for (int lane = 0; lane < MAX_BATCH; ++lane) {
+        if (scores[lane] != -1 && scores[lane] != +1) {
+            test_fail("rollout_batch lane %d returns %f (-1 or +1 expected).", lane, scores[lane]);
+        }
+        ++qwins[scores[lane] > 0];
+    }
+
+    if (qwins[0] == 0 || qwins[1] == 0) {
+        test_fail("All %d lanes have the same result from the start position.", MAX_BATCH);
+    }
+
+    /* Search counts every lane as a game */
+    const uint32_t batch = 16;
+    const uint32_t qthink_param = 64 * 1024;
+    ai->set_param(ai, "batch", &batch);
+    ai->set_param(ai, "qthink", &qthink_param);
+
+    struct ai_explanation explanation;
+    const enum step step = ai->go(ai, &explanation);
+    if (step == INVALID_STEP) {
+        test_fail("ai->go fails: %s", ai->error);
+    }
+
+    if (me->qrollouts % batch != 0) {
+        test_fail("%llu rollouts are played, it is not a multiple of batch %u.", (unsigned long long)me->qrollouts, batch);
+    }
+
+    int32_t qgames = 0;
+    for (size_t i=0; i<explanation.qstats; ++i) {
+        qgames += explanation.stats[i].qgames;
+    }
+
+    if (qgames < (int64_t)me->qrollouts) {
+        test_fail("Root children have %d games, but %llu rollouts are played.", qgames, (unsigned long long)me->qrollouts);
+    }
+
+    ai->free(ai);
+    destroy_geometry(geometry);
+    return 0;
+}
+
+int test_evaluation(void)
+{
+    struct geometry * restrict const geometry = create_std_geometry(BW, BH, GW);
+    if (geometry == NULL) {
+        test_fail("create_std_geometry(%d, %d, %d) fails, return value is NULL, errno is %d.",
+            BW, BH, GW, errno);
+    }
+
+    struct mcts_ai * restrict const me = create_mcts_ai(geometry);
+    if (me == NULL) {
+        test_fail("create_mcts_ai(geometry) fails, return value is NULL, errno is %d.", errno);
+    }
+
+    struct state * restrict const state = create_state(geometry);
+    if (state == NULL) {
+        test_fail("create_state(geometry) fails, fails, return value is NULL, errno is %d.", errno);
+    }
+
+    const int qpoints = geometry->qpoints;
+    const uint8_t * const lines = state->lines;
+
+    const int goal_mouth = (BH-1) * BW + BW/2;
+    if (geometry->goal_dists[2*goal_mouth + 0] != 1 || geometry->goal_dists[2*goal_mouth + 1] != BH) {
+        test_fail("Unexpected goal distances %u, %u from goal mouth, expected 1, %d.",
+            geometry->goal_dists[2*goal_mouth + 0], geometry->goal_dists[2*goal_mouth + 1], BH);
+    }
+
+    for (int point=0; point<qpoints; ++point)
+    for (int active=1; active<=2; ++active) {
+        const float value = evaluate(geometry, lines, point, active);
+        if (value < -1.0f || value > +1.0f) {
+            test_fail("evaluate(%d, %d) = %f is out of [-1, 1].", point, active, value);
+        }
+
+        /* Rotation on 180 degrees swaps players */
+        const float rotated = evaluate(geometry, lines, qpoints - 1 - point, active ^ 3);
+        if (fabsf(value + rotated) > 1.0e-5f) {
+            test_fail("evaluate(%d, %d) = %f, but rotated value is %f.", point, active, value, rotated);
+        }
+    }
+
+    if (evaluate(geometry, lines, goal_mouth, 1) < 0.5f) {
+        test_fail("Player 1 near GOAL_1 should be evaluated as winning, but %f.",
+            evaluate(geometry, lines, goal_mouth, 1));
+    }
+
+    me->cutoff = CUTOFF_EVAL;
+    uint32_t qthink = 0;
+    const float score = rollout(me, state, 4, &qthink);
+    if (score == 0 || score < -1.0f || score > 1.0f) {
+        test_fail("short rollout with eval cutoff returns %f.", score);
+    }
+
+    destroy_state(state);
+    free_ai(me);
+    destroy_geometry(geometry);
+    return 0;
+}
+
+#define ALLOCATED_NODES    32
+
+/* Search must not touch the heap: every buffer is allocated in create or set_param */
+int test_zero_alloc_go(void)
+{
+    const int sizes[2][3] = { { BW, BH, GW }, { 21, 31, 6 } };
+    for (int i=0; i<2; ++i) {
+        struct geometry * restrict const geometry = create_std_geometry(sizes[i][0], sizes[i][1], sizes[i][2]);
+        if (geometry == NULL) {
+            test_fail("create_std_geometry(%d, %d, %d) fails, errno is %d.",
+                sizes[i][0], sizes[i][1], sizes[i][2], errno);
+        }
+
+        struct ai storage;
+        struct ai * restrict const ai = &storage;
+        const int status = init_mcts_ai(ai, geometry);
+        if (status != 0) {
+            test_fail("init_mcts_ai fails with code %d.", status);
+        }
+
+        const uint32_t reach = 1 + 15 * i;
+        const uint32_t batch = 1 + 7 * i;
+        const uint32_t qthink = 8 * 1024;
+        ai->set_param(ai, "reach", &reach);
+        ai->set_param(ai, "batch", &batch);
+        ai->set_param(ai, "qthink", &qthink);
+
+        for (int j=0; j<4; ++j) {
+            const struct state * const state = ai->get_state(ai);
+            if (state_status(state) != IN_PROGRESS) {
+                break;
+            }
+
+            struct ai_explanation explanation;
+            const unsigned int qallocs_before = qallocs;
+            const enum step step = ai->go(ai, &explanation);
+            if (step == INVALID_STEP) {
+                test_fail("ai->go fails: %s", ai->error);
+            }
+
+            if (qallocs != qallocs_before) {
+                test_fail("%u heap allocations in ai->go on %dx%d board.",
+                    qallocs - qallocs_before, sizes[i][0], sizes[i][1]);
+            }
+
+            ai->do_step(ai, step);
+        }
+
+        ai->free(ai);
+        destroy_geometry(geometry);
+    }
+
+    return 0;
+}
+
+int test_node_cache(void)
+{
+    struct geometry * restrict const geometry = create_std_geometry(BW, BH, GW);
+    if (geometry == NULL) {
+        test_fail("create_std_geometry(%d, %d, %d) fails, return value is NULL, errno is %d.",
+            BW, BH, GW, errno);
+    }
+
+    struct ai storage;
+    struct ai * restrict const ai = &storage;
+    init_mcts_ai(ai, geometry);
+
+    const uint32_t cache = ALLOCATED_NODES * sizeof(struct node);
+    const int status = ai->set_param(ai, "cache", &cache);
+    if (status != 0) {
+        test_fail("ai->set_param fails with code %d, %s.", status, ai->error);
+    }
+
+    struct mcts_ai * restrict const me = ai->data;
+
+    for (int j=0; j<3; ++j) {
+        reset_cache(me);
+        for (unsigned int i=0; i<ALLOCATED_NODES; ++i) {
+            struct node * restrict const node = alloc_node(me);
+            if (node == NULL) {
+                test_fail("%d alloc node fails, NULL is returned.", i);
+            }
+
+            if (me->good_node_alloc != i+1) {
+                test_fail("good_node_alloc mismatch, actual %u, expected %u.", me->good_node_alloc, i+1);
+            }
+
+            if (me->bad_node_alloc != 0) {
+                test_fail("bad_node_alloc mismatch, actual %u, expected %u.", me->bad_node_alloc, 0);
+            }
+        }
+
+        for (unsigned int i=0; i<ALLOCATED_NODES/2; ++i) {
+            struct node * restrict const node = alloc_node(me);
+            if (node != NULL) {
+                test_fail("%d alloc, failture expected, but node is allocated.", i);
+            }
+
+            if (me->good_node_alloc != ALLOCATED_NODES) {
+                test_fail("good_node_alloc mismatch, actual %u, expected %u.", me->good_node_alloc, ALLOCATED_NODES);
+            }
+
+            if (me->bad_node_alloc != i+1) {
+                test_fail("bad_node_alloc mismatch, actual %u, expected %u.", me->bad_node_alloc, i+1);
+            }
+        }
+
+        if (j == 1) {
+            /* Setting cache again frees old nodes and allocates new ones */
+            if (ai->set_param(ai, "cache", &cache) != 0) {
+                test_fail("ai->set_param fails: %s", ai->error);
+            }
+        }
+    }
+
+    ai->free(ai);
+    destroy_geometry(geometry);
+    return 0;
+}
+
+#define HISTORY_QITEMS 256
+
+int test_mcts_history(void)
+{
+    struct geometry * restrict const geometry = create_std_geometry(BW, BH, GW);
+    if (geometry == NULL) {
+        test_fail("create_std_geometry(%d, %d, %d) fails, return value is NULL, errno is %d.",
+            BW, BH, GW, errno);
+    }
+
+    struct ai storage;
+    struct ai * restrict const ai = &storage;
+    init_mcts_ai(ai, geometry);
+    struct mcts_ai * restrict const me = ai->data;
+
+    const uint32_t cache = (HISTORY_QITEMS + 16) * sizeof(struct node);
+    ai->set_param(ai, "cache", &cache);
+    reset_cache(me);
+
+    const ptrdiff_t hist_capacity = me->hist_last - me->hist;
+    if (hist_capacity != geometry->qedges + 1) {
+        test_fail("History capacity is %td, qedges + 1 = %u expected.", hist_capacity, geometry->qedges + 1);
+    }
+
+    if (hist_capacity < HISTORY_QITEMS) {
+        test_fail("History capacity %td is less than %d.", hist_capacity, HISTORY_QITEMS);
+    }
+
+    const struct node * nodes[HISTORY_QITEMS];
+
+    for (int i=0; i<HISTORY_QITEMS; ++i) {
+        struct node * restrict const node = alloc_node(me);
+        nodes[i] = node;
+
+        const int active = (i%2) + 1;
+        node->qgames = i;
+        node->score = active == 1 ? i/2 : -i/2;
+        add_history(me, node, active);
+    }
+
+    update_history(me, -1, 1);
+
+    for (int i=0; i<HISTORY_QITEMS; ++i) {
+        const struct node * const node = nodes[i];
+        if (node->qgames != i+1) {
+            test_fail("Unexpected qgames %lld for nodes[%d], %d expected.", (long long)node->qgames, i, i+1);
+        }
+        const int active = (i%2) + 1;
+        const int32_t score = active == 1 ? i/2 - 1 : 1 - i/2;
+        if (node->score != score) {
+            test_fail("Unexpected score %f for nodes[%d], %d expected.", node->score, i, score);
+        }
+    }
+
+    ai->free(ai);
+    destroy_geometry(geometry);
+    return 0;
+}
+
+int test_ucb_formula(void)
+{
+    struct geometry * restrict const geometry = create_std_geometry(BW, BH, GW);
+    if (geometry == NULL) {
+        test_fail("create_std_geometry(%d, %d, %d) fails, return value is NULL, errno is %d.",
+            BW, BH, GW, errno);
+    }
+
+    struct ai storage;
+    struct ai * restrict const ai = &storage;
+    init_mcts_ai(ai, geometry);
+    const uint32_t cache = 1024 * sizeof(struct node);
+    const int status = ai->set_param(ai, "cache", &cache);
+    if (status != 0) {
+        test_fail("ai->set_param fails with code %d, %s.", status, ai->error);
+    }
+
+    struct mcts_ai * restrict const me = ai->data;
+    reset_cache(me);
+
+    struct node node;
+    node.qgames = 10;
+    node.score = 0;
+
+    node.children[NORTH] = 1; /*       1.55985508 */
+    node.children[EAST]  = 2; /* BEST  1.56219899 */
+    node.children[SOUTH] = 3; /*       1.55005966 */
+    node.children[WEST]  = 4; /*       1.53394851 */
+
+    me->C = 1.4;
+
+    me->nodes[1].qgames = 3;
+    me->nodes[2].qgames = 4;
+    me->nodes[3].qgames = 5;
+    me->nodes[4].qgames = 6;
+
+    me->nodes[1].score = 1;
+    me->nodes[2].score = 2;
+    me->nodes[3].score = 3;
+    me->nodes[4].score = 4;
+
+    steps_t steps = (1 << NORTH) | (1 << EAST) | (1 << SOUTH) | (1 << WEST);
+    const enum step choice = select_step(me, &node, steps);
+
+    if (choice != EAST) {
+        test_fail("Unexpected choice %d, expected EAST (%d).", choice, EAST);
+    }
+
+    /* Long analysis: games pass 2^31 and scores pass 2^24, exploration term is tiny */
+    node.qgames = 10LL << 30;
+    for (int i=1; i<=4; ++i) {
+        me->nodes[i].qgames <<= 30;
+        me->nodes[i].score = ldexp(me->nodes[i].score, 30);
+    }
+
+    const enum step wide_choice = select_step(me, &node, steps);
+    if (wide_choice != WEST) {
+        test_fail("Unexpected choice %d for wide counters, expected WEST (%d) with the best score.", wide_choice, WEST);
+    }
+
+    const double wide_score = me->nodes[4].score;
+    me->nodes[4].score += 1;
+    if (me->nodes[4].score == wide_score) {
+        test_fail("Result is lost in a score of %.0f.", wide_score);
+    }
+
+    struct node * restrict const root = alloc_node(me);
+    if (root == NULL) {
+        test_fail("alloc_node failed with NULL as a return value for root node.");
+    }
+    root->qgames = 1;
+
+    for (enum step step=0; step<QSTEPS; ++step) {
+        struct node * restrict const child = alloc_node(me);
+        if (child == NULL) {
+            test_fail("alloc_node failed with NULL as a return value for child node on step %d.", step);
+        }
+        child->qgames = 1;
+        child->score = 2;
+        root->children[step] = child - me->nodes;
+    }
+
+    steps_t visited = 0;
+    for (enum step step=0; step<QSTEPS; ++step) {
+        const enum step choice = select_step(me, root, 0xFF);
+        visited |= 1 << choice;
+        struct node * restrict const child = me->nodes + root->children[choice];
+        child->qgames = 1;
+        child->score = (rand() % 3) - 1;
+        ++root->qgames;
+    }
+
+    if (visited != 0xFF) {
+        test_fail("Some directions are visitied twice, visited mask is 0x%02X.", visited);
+    }
+
+    ai->free(ai);
+    destroy_geometry(geometry);
+    return 0;
+}
+
+#define QSIMULATIONS  1000
+
+int test_simulation(void)
+{
+    struct geometry * restrict const geometry = create_std_geometry(BW, BH, GW);
+    if (geometry == NULL) {
+        test_fail("create_std_geometry(%d, %d, %d) fails, return value is NULL, errno is %d.",
+            BW, BH, GW, errno);
+    }
+
+    struct ai storage;
+    struct ai * restrict const ai = &storage;
+    init_mcts_ai(ai, geometry);
+    const uint32_t cache = 2 * QSIMULATIONS * sizeof(struct node);
+    ai->set_param(ai, "cache", &cache);
+
+    struct mcts_ai * restrict const me = ai->data;
+    reset_cache(me);
+
+    struct node * restrict const zero = alloc_node(me);
+    if (zero == NULL) {
+        test_fail("alloc zero node failed.");
+    }
+    zero->score = 2;
+    zero->qgames = 1;
+
+    struct node * restrict const root = alloc_node(me);
+    if (zero == NULL) {
+        test_fail("alloc root node failed.");
+    }
+
+    root->qgames = 1;
+    for (int i=0; i<QSIMULATIONS; ++i) {
+        simulate(me, root);
+        ++root->qgames;
+    }
+
+    if (root->qgames != QSIMULATIONS + 1) {
+        test_fail("root->qgames = %lld, but %u expected.", (long long)root->qgames, QSIMULATIONS);
+    }
+
+    ai->free(ai);
+    destroy_geometry(geometry);
+    return 0;
+}
+
+int test_mcts_ai_unstep(void)
+{
+    int status;
+
+    struct geometry * restrict const geometry = create_std_geometry(BW, BH, GW);
+    if (geometry == NULL) {
+        test_fail("create_std_geometry(%d, %d, %d) fails, return value is NULL, errno is %d.",
+            BW, BH, GW, errno);
+    }
+
+    struct ai storage;
+    struct ai * restrict const ai = &storage;
+
+    init_mcts_ai(ai, geometry);
+
+    const uint32_t qthink = 16 * 1024;
+    status = ai->set_param(ai, "qthink", &qthink);
+    if (status != 0) {
+        test_fail("ai->set_param fails with code %d, %s.", status, ai->error);
+    }
+
+    const uint32_t cache = 2 * qthink;
+    status = ai->set_param(ai, "cache", &cache);
+    if (status != 0) {
+        test_fail("ai->set_param fails with code %d, %s.", status, ai->error);
+    }
+
+    const struct state * const state = ai->get_state(ai);
+    while (state_status(state) == IN_PROGRESS) {
+        const enum step step = ai->go(ai, NULL);
+        ai->do_step(ai, step);
+    }
+
+    status = ai->undo_steps(ai, ai->history.qsteps);
+    if (status != 0) {
+        test_fail("undo steps failed, status %d, error: %s", status, ai->error);
+    }
+
+    struct state * restrict const check_state = create_state(geometry);
+
+    if (state->active != check_state->active) {
+        test_fail("All undo: active expected %d, but value is %d.", check_state->active, state->active);
+    }
+
+    if (state->ball != check_state->ball) {
+        test_fail("All undo: ball expected %d, but value is %d.", check_state->ball, state->ball);
+    }
+
+    if (memcmp(state->lines, check_state->lines, geometry->qpoints) != 0) {
+        test_fail("All undo: lines mismatch.");
+    }
+
+    ai->free(ai);
+    destroy_state(check_state);
+
+    destroy_geometry(geometry);
+    return 0;
+}
+
+static void check_same_state(
+    const char * const what,
+    const struct state * const state,
+    const struct state * const expected)
+{
+    if (state->active != expected->active) {
+        test_fail("%s: active is %d, %d expected.", what, state->active, expected->active);
+    }
+
+    if (state->ball != expected->ball) {
+        test_fail("%s: ball is %d, %d expected.", what, state->ball, expected->ball);
+    }
+
+    if (memcmp(state->lines, expected->lines, state->geometry->qpoints) != 0) {
+        test_fail("%s: lines mismatch.", what);
+    }
+}
+
+int test_ai_snapshot(void)
+{
+    struct geometry * restrict const geometry = create_std_geometry(BW, BH, GW);
+    if (geometry == NULL) {
+        test_fail("create_std_geometry(%d, %d, %d) fails, return value is NULL, errno is %d.",
+            BW, BH, GW, errno);
+    }
+
+    struct ai_snapshot * restrict const snapshot = create_ai_snapshot(geometry);
+    struct state * restrict const expected = create_state(geometry);
+    struct state * restrict const start = create_state(geometry);
+    if (snapshot == NULL || expected == NULL || start == NULL) {
+        test_fail("bad alloc.");
+    }
+
+    typedef int (*init_ai_function)(struct ai * restrict const, const struct geometry * const);
+    const init_ai_function init_functions[2] = { &init_mcts_ai, &init_random_ai };
+
+    for (int i=0; i<2; ++i) {
+        struct ai storage;
+        struct ai * restrict const ai = &storage;
+        const int status = init_functions[i](ai, geometry);
+        if (status != 0) {
+            test_fail("init AI %d fails with code %d.", i, status);
+        }
+
+        const uint32_t qthink = 1024;
+        ai->set_param(ai, "qthink", &qthink);
+
+        const struct state * const state = ai->get_state(ai);
+        const enum step steps[4] = { NORTH, NORTH_EAST, WEST, SOUTH };
+        if (ai->do_steps(ai, 4, steps) != 0) {
+            test_fail("do_steps fails: %s", ai->error);
+        }
+
+        if (ai->snapshot(ai, snapshot) != 0) {
+            test_fail("snapshot fails.");
+        }
+        state_copy(expected, state);
+        const unsigned int qsteps = ai->history.qsteps;
+
+        /* Play forward, undo below the snapshot and play another line */
+        for (int j=0; j<6 && state_status(state) == IN_PROGRESS; ++j) {
+            ai->do_step(ai, ai->go(ai, NULL));
+        }
+        ai->undo_steps(ai, ai->history.qsteps);
+        ai->do_step(ai, SOUTH_WEST);
+
+        if (ai->restore(ai, snapshot) != 0) {
+            test_fail("restore fails: %s", ai->error);
+        }
+
+        check_same_state("restore", state, expected);
+        if (ai->history.qsteps != qsteps || memcmp(ai->history.steps, steps, sizeof(steps)) != 0) {
+            test_fail("restore: history mismatch, qsteps is %u, %u expected.", ai->history.qsteps, qsteps);
+        }
+
+        /* Restored engine undoes steps from the snapshot history */
+        if (ai->undo_steps(ai, qsteps) != 0) {
+            test_fail("undo after restore fails: %s", ai->error);
+        }
+        check_same_state("undo after restore", state, start);
+
+        /* Reset on the same board keeps engine data and clears history */
+        ai->do_steps(ai, 4, steps);
+        const void * const data = ai->data;
+        if (ai->reset(ai, geometry) != 0) {
+            test_fail("reset fails: %s", ai->error);
+        }
+
+        if (ai->data != data) {
+            test_fail("reset on the same board reallocates engine.");
+        }
+
+        if (ai->history.qsteps != 0) {
+            test_fail("reset keeps %u history steps.", ai->history.qsteps);
+        }
+        check_same_state("reset", ai->get_state(ai), start);
+
+        ai->free(ai);
+    }
+
+    destroy_state(start);
+    destroy_state(expected);
+    destroy_ai_snapshot(snapshot);
+    destroy_geometry(geometry);
+    return 0;
+}
+
+
+#define THREAD_QGAMES   4
+#define THREAD_QSTEPS  64
+
+struct thread_game
+{
+    const struct geometry * geometry;
+    uint32_t seed;
+    int status;
+    unsigned int qsteps;
+    enum step steps[THREAD_QSTEPS];
+};
+
+/* Engine plays against itself, steps of the game are the result */
+static void * play_thread_game(void * arg)
+{
+    struct thread_game * restrict const game = arg;
+    game->qsteps = 0;
+
+    struct ai storage;
+    struct ai * restrict const ai = &storage;
+    game->status = init_mcts_ai(ai, game->geometry);
+    if (game->status != 0) {
+        return NULL;
+    }
+
+    const uint32_t qthink = 16 * 1024;
+    const uint32_t cache = 256 * 1024;
+    ai->set_param(ai, "seed", &game->seed);
+    ai->set_param(ai, "qthink", &qthink);
+    ai->set_param(ai, "cache", &cache);
+
+    const struct state * const state = ai->get_state(ai);
+    while (state_status(state) == IN_PROGRESS && game->qsteps < THREAD_QSTEPS) {
+        const enum step step = ai->go(ai, NULL);
+        game->status = step == INVALID_STEP ? EINVAL : ai->do_step(ai, step);
+        if (game->status != 0) {
+            break;
+        }
+        game->steps[game->qsteps++] = step;
+    }
+
+    ai->free(ai);
+    return NULL;
+}
+
+int test_threads(void)
+{
+    struct geometry * restrict const geometry = create_std_geometry(BW, BH, GW);
+    if (geometry == NULL) {
+        test_fail("create_std_geometry(%d, %d, %d) fails, errno is %d.", BW, BH, GW, errno);
+    }
+
+    /* Games with the same seed are the same in any thread, games are played alone first */
+    struct thread_game expected[THREAD_QGAMES];
+    struct thread_game games[THREAD_QGAMES];
+    for (int i=0; i<THREAD_QGAMES; ++i) {
+        expected[i].geometry = geometry;
+        expected[i].seed = 1 + i % 2;
+        play_thread_game(expected + i);
+        if (expected[i].status != 0) {
+            test_fail("Game %d fails with status %d.", i, expected[i].status);
+        }
+        games[i] = expected[i];
+    }
+
+    pthread_t threads[THREAD_QGAMES];
+    for (int i=0; i<THREAD_QGAMES; ++i) {
+        const int status = pthread_create(threads + i, NULL, play_thread_game, games + i);
+        if (status != 0) {
+            test_fail("pthread_create fails with code %d.", status);
+        }
+    }
+
+    for (int i=0; i<THREAD_QGAMES; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (int i=0; i<THREAD_QGAMES; ++i) {
+        if (games[i].status != 0) {
+            test_fail("Thread game %d fails with status %d.", i, games[i].status);
+        }
+
+        const size_t sz = expected[i].qsteps * sizeof(enum step);
+        if (games[i].qsteps != expected[i].qsteps || memcmp(games[i].steps, expected[i].steps, sz) != 0) {
+            test_fail("Thread game %d differs from the same game played alone.", i);
+        }
+    }
+
+    if (expected[0].qsteps == expected[1].qsteps
+        && memcmp(expected[0].steps, expected[1].steps, expected[0].qsteps * sizeof(enum step)) == 0) {
+        test_fail("Games with different seeds are the same.");
+    }
+
+    destroy_geometry(geometry);
+    return 0;
+}
+
+struct stop_go
+{
+    struct ai * ai;
+    enum step step;
+};
+
+static void * stop_go_thread(void * arg)
+{
+    struct stop_go * restrict const go = arg;
+    go->step = go->ai->go(go->ai, NULL);
+    return NULL;
+}
+
+int test_ai_stop(void)
+{
+    struct geometry * restrict const geometry = create_std_geometry(BW, BH, GW);
+    if (geometry == NULL) {
+        test_fail("create_std_geometry(%d, %d, %d) fails, errno is %d.", BW, BH, GW, errno);
+    }
+
+    struct ai storage;
+    struct ai * restrict const ai = &storage;
+    const int status = init_mcts_ai(ai, geometry);
+    if (status != 0) {
+        test_fail("init_mcts_ai fails with code %d.", status);
+    }
+
+    struct mcts_ai * restrict const me = ai->data;
+    const uint32_t qthink = 1024 * 1024 * 1024;
+    ai->set_param(ai, "qthink", &qthink);
+    const steps_t steps = state_get_steps(ai->get_state(ai));
+
+    /* Flag set before go: go thinks as little as possible */
+    ai->stop(ai, 1);
+    for (int i=0; i<3; ++i) {
+        const enum step step = ai->go(ai, NULL);
+        if (step == INVALID_STEP || (steps & (1 << step)) == 0) {
+            test_fail("Stopped go returns invalid step %d.", step);
+        }
+
+        if (me->qrollouts > 64) {
+            test_fail("Stopped go plays %llu rollouts.", (unsigned long long)me->qrollouts);
+        }
+    }
+
+    /* Flag set from another thread during the search */
+    ai->stop(ai, 0);
+    struct stop_go go = { .ai = ai, .step = INVALID_STEP };
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, stop_go_thread, &go) != 0) {
+        test_fail("pthread_create fails.");
+    }
+
+    const struct timespec delay = { .tv_sec = 0, .tv_nsec = 20 * 1000 * 1000 };
+    nanosleep(&delay, NULL);
+    ai->stop(ai, 1);
+    pthread_join(thread, NULL);
+
+    if (go.step == INVALID_STEP || (steps & (1 << go.step)) == 0) {
+        test_fail("Go stopped from another thread returns invalid step %d.", go.step);
+    }
+
+    if (me->qrollouts >= qthink) {
+        test_fail("Go is not stopped, all %llu rollouts are played.", (unsigned long long)me->qrollouts);
+    }
+
+    ai->free(ai);
+    destroy_geometry(geometry);
+    return 0;
+}
+
+int test_ai_pv(void)
+{
+    struct geometry * restrict const geometry = create_std_geometry(BW, BH, GW);
+    if (geometry == NULL) {
+        test_fail("create_std_geometry(%d, %d, %d) fails, errno is %d.", BW, BH, GW, errno);
+    }
+
+    struct state * restrict const state = create_state(geometry);
+    if (state == NULL) {
+        test_fail("create_state fails.");
+    }
+
+    struct ai storage;
+    struct ai * restrict const ai = &storage;
+    const int status = init_mcts_ai(ai, geometry);
+    if (status != 0) {
+        test_fail("init_mcts_ai fails with code %d.", status);
+    }
+
+    const uint32_t bad_multipv[2] = { 0, MAX_MULTIPV + 1 };
+    for (int i=0; i<2; ++i) {
+        if (ai->set_param(ai, "multipv", bad_multipv + i) == 0) {
+            test_fail("multipv %u is accepted.", bad_multipv[i]);
+        }
+    }
+
+    const uint32_t multipv = 3;
+    const uint32_t qthink = 256 * 1024;
+    ai->set_param(ai, "multipv", &multipv);
+    ai->set_param(ai, "qthink", &qthink);
+
+    const enum step opening[3] = { NORTH, EAST, SOUTH_WEST };
+    for (int i=0; i<3; ++i) {
+        ai->do_step(ai, opening[i]);
+    }
+
+    struct ai_explanation explanation;
+    const enum step step = ai->go(ai, &explanation);
+    if (step == INVALID_STEP) {
+        test_fail("ai->go fails: %s", ai->error);
+    }
+
+    if (explanation.qvariations < 1 || explanation.qvariations > multipv) {
+        test_fail("%zu variations for multipv %u.", explanation.qvariations, multipv);
+    }
+
+    const struct state * const root = ai->get_state(ai);
+    for (size_t i = 0; i < explanation.qvariations; ++i) {
+        const struct ai_variation * const variation = explanation.variations + i;
+        if (i > 0 && variation->qgames > variation[-1].qgames) {
+            test_fail("Variation %zu has more games than the previous one.", i);
+        }
+
+        if (variation->qturn < 1 || variation->qturn > variation->qsteps || variation->qsteps > MAX_PV_LEN) {
+            test_fail("Variation %zu has %u turn steps of %u.", i, variation->qturn, variation->qsteps);
+        }
+
+        if (variation->score < 0.0 || variation->score > 1.0) {
+            test_fail("Variation %zu has score %f.", i, variation->score);
+        }
+
+        /* All steps are legal, turn steps belong to the active player */
+        state_copy(state, root);
+        for (unsigned int j = 0; j < variation->qsteps; ++j) {
+            if (j < variation->qturn && state->active != root->active) {
+                test_fail("Variation %zu step %u is not in the root turn.", i, j);
+            }
+
+            const enum step pv_step = variation->steps[j];
+            if (state_status(state) != IN_PROGRESS || state_step(state, pv_step) == NO_WAY) {
+                test_fail("Variation %zu step %u is invalid.", i, j);
             }
+        }
 
-            const struct node * const child = me->nodes + ichild;
-            const int32_t qgames = child->qgames;
-            const int32_t score = child->score;
-            double norm_score = -1.0;
-            if (qgames > 0) {
-                norm_score = 0.5 * (score + qgames) / (double)qgames;
+        for (size_t k = 0; k < i; ++k) {
+            const struct ai_variation * const other = explanation.variations + k;
+            const size_t sz = variation->qturn * sizeof(enum step);
+            if (other->qturn == variation->qturn && memcmp(other->steps, variation->steps, sz) == 0) {
+                test_fail("Variations %zu and %zu have the same turn.", k, i);
             }
+        }
+    }
+
+    ai->free(ai);
+    destroy_state(state);
+    destroy_geometry(geometry);
+    return 0;
+}
+
+/* Search in slices with peeks between them is the same search as go */
+int test_go_slices(void)
+{
+    struct geometry * restrict const geometry = create_std_geometry(BW, BH, GW);
+    if (geometry == NULL) {
+        test_fail("create_std_geometry(%d, %d, %d) fails, errno is %d.", BW, BH, GW, errno);
+    }
+
+    struct ai ai_storage[2];
+    for (int i=0; i<2; ++i) {
+        struct ai * restrict const ai = ai_storage + i;
+        const int status = init_mcts_ai(ai, geometry);
+        if (status != 0) {
+            test_fail("init_mcts_ai fails with code %d.", status);
+        }
+
+        const uint32_t qthink = 64 * 1024;
+        ai->set_param(ai, "qthink", &qthink);
+    }
+
+    struct ai * restrict const whole = ai_storage + 0;
+    struct ai * restrict const sliced = ai_storage + 1;
+    const struct state * const state = whole->get_state(whole);
+    const struct mcts_ai * const sliced_me = sliced->data;
 
-            const size_t i = step == result ? 0 : qstats;
-            me->stats[i].step = step;
-            me->stats[i].qgames = child->qgames;
-            me->stats[i].score = norm_score;
-            qstats += !!i;
+    if (sliced->go_end(sliced, NULL) != INVALID_STEP || sliced->error == NULL) {
+        test_fail("go_end without go_begin does not fail.");
+    }
+
+    for (int move = 0; move < 16 && state_status(state) == IN_PROGRESS; ++move) {
+        struct ai_explanation expected, explanation;
+        const enum step step = whole->go(whole, &expected);
+
+        if (sliced->go_begin(sliced) != 0) {
+            test_fail("go_begin fails: %s", sliced->error);
         }
 
-        explanation->qstats = qstats;
-        explanation->stats = me->stats;
+        uint64_t last_playouts = 0;
+        uint32_t last_qthink = 0;
+        while (!sliced->go_continue(sliced, 1000)) {
+            /* Slice may exceed the budget by one simulation, it is shorter than all edges */
+            const uint32_t qthink = sliced_me->search_qthink;
+            if (qthink - last_qthink >= 1000 + geometry->qedges) {
+                test_fail("Slice budget is exceeded: %u steps in a slice.", qthink - last_qthink);
+            }
+            last_qthink = qthink;
+
+            const enum step best = sliced->go_peek(sliced, &explanation);
+            if (best == INVALID_STEP || (state_get_steps(state) & (1 << best)) == 0) {
+                test_fail("go_peek returns invalid step %d.", best);
+            }
+
+            if (explanation.qplayouts < last_playouts) {
+                test_fail("Tree is lost between slices, playouts %llu -> %llu.",
+                    (unsigned long long)last_playouts, (unsigned long long)explanation.qplayouts);
+            }
+            last_playouts = explanation.qplayouts;
+        }
 
-        explanation->score = me->stats[0].score;
-        if (me->state->active == 2) {
-            explanation->score = 1.0 - explanation->score;
+        const enum step sliced_step = sliced->go_end(sliced, &explanation);
+        if (sliced_step != step) {
+            test_fail("Move %d: sliced search returns %d, go returns %d.", move, sliced_step, step);
         }
 
-        if (qstats > 2) {
-            qsort(me->stats + 1, qstats - 1, sizeof(struct step_stat), compare_stats);
+        if (explanation.qplayouts != expected.qplayouts || explanation.qnodes != expected.qnodes) {
+            test_fail("Move %d: sliced search differs from go.", move);
         }
+
+        whole->do_step(whole, step);
+        sliced->do_step(sliced, step);
     }
 
-    return result;
-}
+    sliced->reset(sliced, geometry);
+    const uint32_t no_memo = 0;
+    sliced->set_param(sliced, "memo", &no_memo);
 
+    /* New cache frees the tree under the search */
+    if (sliced->go_begin(sliced) != 0 || sliced_me->search_root == NULL) {
+        test_fail("go_begin does not start a search: %s", sliced->error);
+    }
 
+    sliced->go_continue(sliced, 1000);
+    const uint32_t cache = 2 * 1024 * 1024;
+    if (sliced->set_param(sliced, "cache", &cache) != 0) {
+        test_fail("set_param(\"cache\") fails: %s", sliced->error);
+    }
 
-#ifdef MAKE_CHECK
+    if (!sliced->go_continue(sliced, 1000)) {
+        test_fail("go_continue goes on after cache change.");
+    }
 
-#include "insider.h"
+    if (sliced->go_peek(sliced, NULL) != INVALID_STEP) {
+        test_fail("go_peek returns a step after cache change.");
+    }
 
-#define BW    9
-#define BH   11
-#define GW    2
+    if (sliced->go_end(sliced, NULL) != INVALID_STEP || sliced->error == NULL) {
+        test_fail("go_end does not fail after cache change.");
+    }
 
-#define QROLLOUTS   1024
+    /* Step changes the position under the search */
+    if (sliced->go_begin(sliced) != 0) {
+        test_fail("go_begin fails: %s", sliced->error);
+    }
 
-int test_rollout(void)
+    sliced->go_continue(sliced, 1000);
+    if (sliced->do_step(sliced, NORTH) != 0) {
+        test_fail("do_step(NORTH) fails: %s", sliced->error);
+    }
+
+    if (!sliced->go_continue(sliced, 1000)) {
+        test_fail("go_continue goes on after step.");
+    }
+
+    if (sliced->go_end(sliced, NULL) != INVALID_STEP || sliced->error == NULL) {
+        test_fail("go_end does not fail after step.");
+    }
+
+    /* Counters of a long analysis go over 32 bits */
+    if (sliced->go_begin(sliced) != 0 || sliced_me->search_root == NULL) {
+        test_fail("go_begin does not start a search: %s", sliced->error);
+    }
+
+    struct mcts_ai * restrict const wide = sliced->data;
+    wide->qrollouts = UINT32_MAX;
+    wide->qrollout_steps = UINT32_MAX;
+    sliced->go_continue(sliced, 1000);
+    if (wide->qrollouts <= UINT32_MAX || wide->qrollout_steps <= UINT32_MAX) {
+        test_fail("Counters wrap: %llu rollouts and %llu steps.",
+            (unsigned long long)wide->qrollouts, (unsigned long long)wide->qrollout_steps);
+    }
+
+    const struct ai_param * stat = sliced->get_stats(sliced);
+    while (stat->name != NULL && strcmp(stat->name, "played_steps") != 0) {
+        ++stat;
+    }
+
+    if (stat->type != U64 || *(const uint64_t *)stat->value != wide->qrollout_steps) {
+        test_fail("Counter played_steps is not reported as U64.");
+    }
+
+    sliced->go_end(sliced, NULL);
+
+    whole->free(whole);
+    sliced->free(sliced);
+    destroy_geometry(geometry);
+    return 0;
+}
+
+#define ANALYZE_MAX_REPORTS   1024
+
+struct analyze_run
+{
+    struct ai * ai;
+    enum step step;
+    unsigned int qreports;
+    uint64_t qplayouts[ANALYZE_MAX_REPORTS];
+    enum step best_steps[ANALYZE_MAX_REPORTS];
+    uint32_t qnodes;
+};
+
+static void analyze_report(void * arg, const struct ai_explanation * explanation)
 {
-    init_magic_steps();
+    struct analyze_run * restrict const run = arg;
+    if (run->qreports < ANALYZE_MAX_REPORTS) {
+        run->qplayouts[run->qreports] = explanation->qplayouts;
+        run->best_steps[run->qreports] = explanation->qstats > 0 ? explanation->stats[0].step : INVALID_STEP;
+        ++run->qreports;
+    }
+    run->qnodes = explanation->qnodes;
+}
+
+static void * analyze_thread(void * arg)
+{
+    struct analyze_run * restrict const run = arg;
+    run->step = run->ai->analyze(run->ai, 0.002, analyze_report, run);
+    return NULL;
+}
 
+int test_ai_analyze(void)
+{
     struct geometry * restrict const geometry = create_std_geometry(BW, BH, GW);
     if (geometry == NULL) {
-        test_fail("create_std_geometry(%d, %d, %d) fails, return value is NULL, errno is %d.",
-            BW, BH, GW, errno);
+        test_fail("create_std_geometry(%d, %d, %d) fails, errno is %d.", BW, BH, GW, errno);
     }
 
-    struct state * restrict const state = create_state(geometry);
-    if (state == NULL) {
-        test_fail("create_state(geometry) fails, fails, return value is NULL, errno is %d.", errno);
+    struct ai storage;
+    struct ai * restrict const ai = &storage;
+    const int status = init_mcts_ai(ai, geometry);
+    if (status != 0) {
+        test_fail("init_mcts_ai fails with code %d.", status);
     }
 
-    struct state * restrict const base = create_state(geometry);
-    if (base == NULL) {
-        test_fail("create_state(geometry) fails, fails, return value is NULL, errno is %d.", errno);
+    ai->do_step(ai, NORTH);
+    const struct state * const state = ai->get_state(ai);
+    const int ball = state->ball;
+    const int active = state->active;
+    const steps_t steps = state_get_steps(state);
+
+    static struct analyze_run run;
+    run.ai = ai;
+    run.step = INVALID_STEP;
+    run.qreports = 0;
+
+    ai->stop(ai, 0);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, analyze_thread, &run) != 0) {
+        test_fail("pthread_create fails.");
     }
 
-    for (int i=0; i<QROLLOUTS; ++i) {
-        state_copy(state, base);
+    const struct timespec delay = { .tv_sec = 0, .tv_nsec = 100 * 1000 * 1000 };
+    nanosleep(&delay, NULL);
+    ai->stop(ai, 1);
+    pthread_join(thread, NULL);
 
-        uint32_t qthink = 0;
-        const int score = rollout(state, BW*BH*8, &qthink);
-        if (score != -1 && score != +1) {
-            test_fail("rollout %d returns unexpected score %d (-1 or +1 expected).", i, score);
+    if (run.step == INVALID_STEP || (steps & (1 << run.step)) == 0) {
+        test_fail("Analyze returns invalid step %d.", run.step);
+    }
+
+    if (run.qreports < 2) {
+        test_fail("Only %u reports during analysis.", run.qreports);
+    }
+
+    /* Tree is not restarted between reports */
+    for (unsigned int i = 1; i < run.qreports; ++i) {
+        if (run.qplayouts[i] < run.qplayouts[i-1]) {
+            test_fail("Playouts decrease from %llu to %llu in report %u.",
+                (unsigned long long)run.qplayouts[i-1], (unsigned long long)run.qplayouts[i], i);
         }
+    }
 
-        if (qthink >= BW*BH*8) {
-            test_fail("Unexpected qthink value %u after rollout.", qthink);
+    if (run.qplayouts[run.qreports - 1] == 0 || run.qnodes == 0) {
+        test_fail("Empty tree in the last report.");
+    }
+
+    if (run.best_steps[run.qreports - 1] != run.step) {
+        test_fail("Last report best step %d differs from result %d.", run.best_steps[run.qreports - 1], run.step);
+    }
+
+    if (state->ball != ball || state->active != active) {
+        test_fail("Analyze changes the position.");
+    }
+
+    ai->free(ai);
+    destroy_geometry(geometry);
+    return 0;
+}
+
+int test_tree_file(void)
+{
+    struct geometry * restrict const geometry = create_std_geometry(BW, BH, GW);
+    if (geometry == NULL) {
+        test_fail("create_std_geometry(%d, %d, %d) fails, errno is %d.", BW, BH, GW, errno);
+    }
+
+    struct ai ai_storage[2];
+    for (int i=0; i<2; ++i) {
+        struct ai * restrict const ai = ai_storage + i;
+        const int status = init_mcts_ai(ai, geometry);
+        if (status != 0) {
+            test_fail("init_mcts_ai fails with code %d.", status);
         }
+
+        const uint32_t qthink = 32 * 1024;
+        ai->set_param(ai, "qthink", &qthink);
+
+        /* Repeated searches below should really search */
+        const uint32_t memo = 0;
+        ai->set_param(ai, "memo", &memo);
     }
 
-    state_copy(state, base);
-    uint32_t qthink = 0;
-    const int score = rollout(state, 4, &qthink);
-    if (score != 0) {
-        test_fail("short rollout returns unexpected score %d, 0 expected.", score);
+    struct ai * restrict const first = ai_storage + 0;
+    struct ai * restrict const second = ai_storage + 1;
+
+    char path[] = "/tmp/pf-tree-XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd == -1) {
+        test_fail("mkstemp fails, errno %d.", errno);
     }
+    close(fd);
 
-    if (qthink != 4) {
-        test_fail("Unexpected qthink value %u after rollout, 4 expected.", qthink);
+    if (first->save_tree(first, path) != EINVAL) {
+        test_fail("save_tree without search does not fail.");
     }
 
-    destroy_state(base);
-    destroy_state(state);
+    struct ai_explanation explanation;
+    first->do_step(first, NORTH);
+    second->do_step(second, NORTH);
+    if (first->go(first, &explanation) == INVALID_STEP) {
+        test_fail("go fails: %s", first->error);
+    }
+    const uint64_t qplayouts = explanation.qplayouts;
+    const uint32_t qnodes = explanation.qnodes;
+
+    int status = first->save_tree(first, path);
+    if (status != 0) {
+        test_fail("save_tree fails with code %d: %s", status, first->error);
+    }
+
+    /* Tree is for the position of the search, not for the position after a step */
+    first->do_step(first, EAST);
+    if (first->save_tree(first, path) != EINVAL) {
+        test_fail("save_tree of old tree does not fail.");
+    }
+
+    status = first->load_tree(first, path);
+    if (status != EINVAL || strstr(first->error, "position pf_") == NULL) {
+        test_fail("load_tree in another position: code %d, error `%s', EINVAL with position expected.", status, first->error);
+    }
+
+    status = second->load_tree(second, path);
+    if (status != 0) {
+        test_fail("load_tree fails with code %d: %s", status, second->error);
+    }
+
+    /* Search continues the loaded tree */
+    if (second->go(second, &explanation) == INVALID_STEP) {
+        test_fail("go after load_tree fails: %s", second->error);
+    }
+
+    if (explanation.qplayouts <= qplayouts || explanation.qnodes <= qnodes) {
+        test_fail("Loaded tree is not continued: %llu playouts and %u nodes after %llu playouts and %u nodes.",
+            (unsigned long long)explanation.qplayouts, explanation.qnodes, (unsigned long long)qplayouts, qnodes);
+    }
+
+    /* Next search starts from scratch */
+    const uint64_t qcontinued = explanation.qplayouts;
+    second->go(second, &explanation);
+    if (explanation.qplayouts >= qcontinued) {
+        test_fail("Loaded tree is continued twice.");
+    }
+
+    /* Broken nodes are rejected, the original file is restored after */
+    FILE * file = fopen(path, "rb");
+    if (file == NULL) {
+        test_fail("fopen fails, errno %d.", errno);
+    }
+
+    struct tree_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1) {
+        test_fail("fread of tree header fails.");
+    }
+
+    const size_t file_sz = tree_nodes_offset(header.position_sz) + (size_t)header.qnodes * sizeof(struct node);
+    char * restrict const original = malloc(2 * file_sz);
+    if (original == NULL) {
+        test_fail("malloc fails.");
+    }
+    rewind(file);
+    if (fread(original, file_sz, 1, file) != 1) {
+        test_fail("fread of tree file fails.");
+    }
+    fclose(file);
+
+    char * restrict const broken = original + file_sz;
+    struct node * const broken_nodes = (struct node *)(broken + tree_nodes_offset(header.position_sz));
+    for (int attempt = 0; attempt < 3; ++attempt) {
+        memcpy(broken, original, file_sz);
+        struct node * const root = broken_nodes + 1;
+        enum step step = 0;
+        while (root->children[step] == 0) {
+            ++step;
+        }
+
+        switch (attempt) {
+            case 0:
+                broken_nodes[root->children[step]].qgames = 0;
+                break;
+            case 1:
+                memset(root->children, 0, sizeof(root->children));
+                break;
+            default:
+                root->qgames = 0;
+                break;
+        }
+
+        file = fopen(path, "wb");
+        if (file == NULL || fwrite(broken, file_sz, 1, file) != 1 || fclose(file) != 0) {
+            test_fail("Cannot write broken tree file, errno %d.", errno);
+        }
+
+        status = second->load_tree(second, path);
+        if (status != EINVAL) {
+            test_fail("load_tree of broken tree %d returns %d, EINVAL expected.", attempt, status);
+        }
+    }
+
+    file = fopen(path, "wb");
+    if (file == NULL || fwrite(original, file_sz, 1, file) != 1 || fclose(file) != 0) {
+        test_fail("Cannot restore tree file, errno %d.", errno);
+    }
+    free(original);
+
+    const uint32_t small_cache = 16 * sizeof(struct node);
+    second->set_param(second, "cache", &small_cache);
+    status = second->load_tree(second, path);
+    if (status != ENOSPC) {
+        test_fail("load_tree to small cache returns %d, ENOSPC expected.", status);
+    }
+
+    if (truncate(path, sizeof(struct tree_header) + 8) != 0) {
+        test_fail("truncate fails, errno %d.", errno);
+    }
+
+    status = second->load_tree(second, path);
+    if (status != EINVAL) {
+        test_fail("load_tree of truncated file returns %d, EINVAL expected.", status);
+    }
+
+    unlink(path);
+    first->free(first);
+    second->free(second);
     destroy_geometry(geometry);
     return 0;
 }
 
-#define ALLOCATED_NODES    32
+static enum step test_memo_go(
+    struct ai * restrict const ai,
+    struct ai_explanation * restrict const explanation)
+{
+    const enum step step = ai->go(ai, explanation);
+    if (step == INVALID_STEP) {
+        test_fail("ai->go fails: %s", ai->error);
+    }
+    return step;
+}
 
-int test_node_cache(void)
+int test_memo(void)
 {
     struct geometry * restrict const geometry = create_std_geometry(BW, BH, GW);
     if (geometry == NULL) {
-        test_fail("create_std_geometry(%d, %d, %d) fails, return value is NULL, errno is %d.",
-            BW, BH, GW, errno);
+        test_fail("create_std_geometry(%d, %d, %d) fails, errno is %d.", BW, BH, GW, errno);
     }
 
     struct ai storage;
     struct ai * restrict const ai = &storage;
-    init_mcts_ai(ai, geometry);
-
-    const uint32_t cache = ALLOCATED_NODES * sizeof(struct node);
-    const int status = ai->set_param(ai, "cache", &cache);
+    int status = init_mcts_ai(ai, geometry);
     if (status != 0) {
-        test_fail("ai->set_param fails with code %d, %s.", status, ai->error);
+        test_fail("init_mcts_ai fails with code %d.", status);
     }
 
-    struct mcts_ai * restrict const me = ai->data;
+    const struct mcts_ai * const me = ai->data;
+    uint32_t qthink = 16 * 1024;
+    ai->set_param(ai, "qthink", &qthink);
 
-    for (int j=0; j<3; ++j) {
-        init_cache(me);
-        for (unsigned int i=0; i<ALLOCATED_NODES; ++i) {
-            struct node * restrict const node = alloc_node(me);
-            if (node == NULL) {
-                test_fail("%d alloc node fails, NULL is returned.", i);
-            }
+    /* Repeated search in the same position is answered without rollouts */
+    struct ai_explanation expected, explanation;
+    const enum step step = test_memo_go(ai, &expected);
+    const uint64_t qplayouts = expected.qplayouts;
+    const uint32_t qstats = expected.qstats;
+    struct step_stat stats[QSTEPS];
+    memcpy(stats, expected.stats, qstats * sizeof(struct step_stat));
 
-            if (me->good_node_alloc != i+1) {
-                test_fail("good_node_alloc mismatch, actual %u, expected %u.", me->good_node_alloc, i+1);
-            }
+    if (me->qmemo_misses != 1 || me->qmemo_hits != 0) {
+        test_fail("First search: %u misses and %u hits, 1 and 0 expected.", me->qmemo_misses, me->qmemo_hits);
+    }
 
-            if (me->bad_node_alloc != 0) {
-                test_fail("bad_node_alloc mismatch, actual %u, expected %u.", me->bad_node_alloc, 0);
-            }
-        }
+    if (test_memo_go(ai, &explanation) != step) {
+        test_fail("Memo hit changes the step.");
+    }
 
-        for (unsigned int i=0; i<ALLOCATED_NODES/2; ++i) {
-            struct node * restrict const node = alloc_node(me);
-            if (node != NULL) {
-                test_fail("%d alloc, failture expected, but node is allocated.", i);
-            }
+    if (me->qmemo_hits != 1 || me->qrollouts != 0) {
+        test_fail("Second search: %u hits and %llu rollouts, 1 hit without rollouts expected.", me->qmemo_hits, (unsigned long long)me->qrollouts);
+    }
 
-            if (me->good_node_alloc != ALLOCATED_NODES) {
-                test_fail("good_node_alloc mismatch, actual %u, expected %u.", me->good_node_alloc, ALLOCATED_NODES);
-            }
+    if (explanation.qplayouts != qplayouts || explanation.qstats != qstats
+        || memcmp(explanation.stats, stats, qstats * sizeof(struct step_stat)) != 0) {
+        test_fail("Memo hit explanation differs from the search explanation.");
+    }
 
-            if (me->bad_node_alloc != i+1) {
-                test_fail("bad_node_alloc mismatch, actual %u, expected %u.", me->bad_node_alloc, i+1);
-            }
-        }
+    /* More thinking continues the cached tree */
+    qthink *= 2;
+    ai->set_param(ai, "qthink", &qthink);
+    test_memo_go(ai, &explanation);
+    if (me->qmemo_extends != 1 || explanation.qplayouts <= qplayouts) {
+        test_fail("Search with more qthink: %u extends, %llu playouts after %llu, tree extension expected.",
+            me->qmemo_extends, (unsigned long long)explanation.qplayouts, (unsigned long long)qplayouts);
+    }
 
-        if (j == 1) {
-            free_cache(me);
-        }
+    test_memo_go(ai, &explanation);
+    if (me->qmemo_hits != 2) {
+        test_fail("Extended entry is not reused, %u hits.", me->qmemo_hits);
+    }
+
+    /* Search parameters are a part of the key */
+    const float C = 2.0;
+    const float old_C = me->C;
+    ai->set_param(ai, "C", &C);
+    test_memo_go(ai, &explanation);
+    if (me->qmemo_misses != 2 || me->qrollouts == 0) {
+        test_fail("Search with another C: %u misses and %llu rollouts, new search expected.", me->qmemo_misses, (unsigned long long)me->qrollouts);
+    }
+
+    ai->set_param(ai, "C", &old_C);
+    test_memo_go(ai, &explanation);
+    if (me->qmemo_hits != 3 || me->memo_rate != 50.0) {
+        test_fail("Entry is lost after another search: %u hits, rate %f.", me->qmemo_hits, me->memo_rate);
+    }
+
+    /* Least recently used entry is evicted */
+    const uint32_t one = 1;
+    ai->set_param(ai, "memo", &one);
+    test_memo_go(ai, NULL);
+    ai->do_step(ai, NORTH);
+    test_memo_go(ai, NULL);
+    ai->undo_step(ai);
+    test_memo_go(ai, NULL);
+    if (me->qmemo_misses != 3 || me->qmemo_hits != 0) {
+        test_fail("One entry memo: %u misses and %u hits, 3 misses expected.", me->qmemo_misses, me->qmemo_hits);
+    }
+
+    test_memo_go(ai, NULL);
+    if (me->qmemo_hits != 1) {
+        test_fail("One entry memo: last position is not kept.");
+    }
+
+    /* Re-applied memo is empty, an engine reused for the next batch position searches as a new one */
+    struct ai fresh_storage;
+    struct ai * restrict const fresh = &fresh_storage;
+    status = init_mcts_ai(fresh, geometry);
+    if (status != 0) {
+        test_fail("init_mcts_ai fails with code %d.", status);
+    }
+
+    const uint32_t seed = 7;
+    fresh->set_param(fresh, "qthink", &qthink);
+    fresh->set_param(fresh, "memo", &one);
+    fresh->set_param(fresh, "seed", &seed);
+    ai->set_param(ai, "seed", &seed);
+    ai->set_param(ai, "memo", &one);
+
+    struct ai_explanation fresh_explanation;
+    const enum step fresh_step = test_memo_go(fresh, &fresh_explanation);
+    if (test_memo_go(ai, &explanation) != fresh_step || explanation.qplayouts != fresh_explanation.qplayouts) {
+        test_fail("Reused engine differs from a new one.");
+    }
+
+    if (me->qmemo_misses != 1 || me->qmemo_hits != 0) {
+        test_fail("Re-applied memo: %u misses and %u hits, 1 miss expected.", me->qmemo_misses, me->qmemo_hits);
+    }
+
+    fresh->free(fresh);
+
+    /* Memo is disabled with zero entries */
+    const uint32_t zero = 0;
+    ai->set_param(ai, "memo", &zero);
+    test_memo_go(ai, NULL);
+    test_memo_go(ai, NULL);
+    if (me->qmemo_hits + me->qmemo_misses + me->qmemo_extends != 0 || me->qrollouts == 0) {
+        test_fail("Disabled memo is used.");
+    }
+
+    const uint32_t too_big = MAX_MEMO + 1;
+    if (ai->set_param(ai, "memo", &too_big) != EINVAL) {
+        test_fail("Too big memo is accepted.");
     }
 
     ai->free(ai);
@@ -984,240 +4337,359 @@ int test_node_cache(void)
     return 0;
 }
 
-#define HISTORY_QITEMS 1000
+#endif
 
-int test_mcts_history(void)
+
+
+#ifdef MAKE_BENCH
+
+#include "bench.h"
+
+#define BENCH_BW             9
+#define BENCH_BH            11
+#define BENCH_GW             2
+#define BENCH_QROLLOUTS 200000
+#define BENCH_QGAMES        40
+#define BENCH_QTHINK     20000
+
+static int play_game(
+    struct ai * restrict const ai1,
+    struct ai * restrict const ai2)
 {
-    struct geometry * restrict const geometry = create_std_geometry(BW, BH, GW);
-    if (geometry == NULL) {
-        test_fail("create_std_geometry(%d, %d, %d) fails, return value is NULL, errno is %d.",
-            BW, BH, GW, errno);
+    const struct state * const state = ai1->get_state(ai1);
+    while (state_status(state) == IN_PROGRESS) {
+        struct ai * restrict const ai = state->active == 1 ? ai1 : ai2;
+        const enum step step = ai->go(ai, NULL);
+        if (step == INVALID_STEP) {
+            bench_fail("ai->go failed: %s", ai->error);
+        }
+        ai1->do_step(ai1, step);
+        ai2->do_step(ai2, step);
     }
 
-    struct ai storage;
-    struct ai * restrict const ai = &storage;
-    init_mcts_ai(ai, geometry);
-    struct mcts_ai * restrict const me = ai->data;
+    return state_status(state) == WIN_1 ? 1 : 2;
+}
 
-    const uint32_t cache = (HISTORY_QITEMS + 16) * sizeof(struct node);
-    ai->set_param(ai, "cache", &cache);
-    init_cache(me);
+static int init_bench_ai(
+    struct ai * restrict const ai,
+    const struct geometry * const geometry,
+    const uint32_t policy)
+{
+    const uint32_t qthink = BENCH_QTHINK;
+    const int status = init_mcts_ai(ai, geometry);
+    if (status != 0) {
+        bench_fail("init_mcts_ai failed with code %d.", status);
+    }
 
-    const struct node * nodes[HISTORY_QITEMS];
+    ai->set_param(ai, "qthink", &qthink);
+    ai->set_param(ai, "policy", &policy);
+    return 0;
+}
 
-    for (int i=0; i<HISTORY_QITEMS; ++i) {
-        struct node * restrict const node = alloc_node(me);
-        nodes[i] = node;
+/*
+ * Speed: rollouts per second from the start position.
+ * Quality: score of MCTS with given policy against MCTS with uniform policy.
+ */
+int bench_rollout_policies(void)
+{
+    struct geometry * restrict const geometry = create_std_geometry(BENCH_BW, BENCH_BH, BENCH_GW);
+    if (geometry == NULL) {
+        bench_fail("create_std_geometry failed, errno is %d.", errno);
+    }
 
-        const int active = (i%2) + 1;
-        node->qgames = i;
-        node->score = active == 1 ? i/2 : -i/2;
-        add_history(me, node, active);
+    struct mcts_ai * restrict const me = create_mcts_ai(geometry);
+    struct state * restrict const state = create_state(geometry);
+    struct state * restrict const base = create_state(geometry);
+    if (me == NULL || state == NULL || base == NULL) {
+        bench_fail("bad alloc.");
     }
 
-    update_history(me, -1);
+    printf("%16s %12s %10s %10s\n", "policy", "rollouts/s", "avg len", "score");
 
-    for (int i=0; i<HISTORY_QITEMS; ++i) {
-        const struct node * const node = nodes[i];
-        if (node->qgames != i+1) {
-            test_fail("Unexpected qgames %u for nodes[%d], %d expected.", node->qgames, i, i+1);
+    for (uint32_t policy = 0; policy_names[policy] != NULL; ++policy) {
+        me->policy = policy;
+
+        uint32_t qthink = 0;
+        const double start = clock();
+        for (int i=0; i<BENCH_QROLLOUTS; ++i) {
+            state_copy(state, base);
+            rollout(me, state, BENCH_BW * BENCH_BH * QSTEPS, &qthink);
         }
-        const int active = (i%2) + 1;
-        const int32_t score = active == 1 ? i/2 - 1 : 1 - i/2;
-        if (node->score != score) {
-            test_fail("Unexpected score %d for nodes[%d], %d expected.", node->score, i, score);
+        const double finish = clock();
+        const double elapsed = (finish - start) / CLOCKS_PER_SEC;
+
+        int qwins = 0;
+        for (int game=0; game<BENCH_QGAMES; ++game) {
+            struct ai tested, uniform;
+            init_bench_ai(&tested, geometry, policy);
+            init_bench_ai(&uniform, geometry, POLICY_UNIFORM);
+
+            const int tested_side = 1 + game % 2;
+            const int winner = tested_side == 1
+                ? play_game(&tested, &uniform)
+                : play_game(&uniform, &tested);
+            qwins += winner == tested_side;
+
+            tested.free(&tested);
+            uniform.free(&uniform);
         }
+
+        printf("%16s %12.0f %10.2f %9.1f%%\n",
+            policy_names[policy],
+            BENCH_QROLLOUTS / elapsed,
+            (double)qthink / BENCH_QROLLOUTS,
+            100.0 * qwins / BENCH_QGAMES);
     }
 
-    ai->free(ai);
+    destroy_state(base);
+    destroy_state(state);
+    free_ai(me);
     destroy_geometry(geometry);
     return 0;
 }
 
-int test_ucb_formula(void)
+/*
+ * Rollout kernel as it was before table bytes, bounded random and goal
+ * sentinels: uniform policy, no adjudication, kept here as a baseline.
+ */
+static float reference_rollout(
+    struct state * restrict const state,
+    uint32_t max_steps,
+    uint32_t * qthink)
 {
-    struct geometry * restrict const geometry = create_std_geometry(BW, BH, GW);
-    if (geometry == NULL) {
-        test_fail("create_std_geometry(%d, %d, %d) fails, return value is NULL, errno is %d.",
-            BW, BH, GW, errno);
-    }
-
-    struct ai storage;
-    struct ai * restrict const ai = &storage;
-    init_mcts_ai(ai, geometry);
-    const uint32_t cache = 1024 * sizeof(struct node);
-    const int status = ai->set_param(ai, "cache", &cache);
-    if (status != 0) {
-        test_fail("ai->set_param fails with code %d, %s.", status, ai->error);
+    static enum step reference_steps[256][8];
+    if (reference_steps[1][1] == 0) {
+        for (uint32_t mask=0; mask<256; ++mask) {
+            steps_t steps = mask;
+            for (int n=0; n<8; ++n) {
+                reference_steps[mask][n] = steps == 0 ? INVALID_STEP : extract_step(&steps);
+            }
+        }
     }
 
-    struct mcts_ai * restrict const me = ai->data;
-    init_cache(me);
+    const int32_t * const connections = state->geometry->connections;
+    uint8_t * restrict const lines = state->lines;
+    int ball = state->ball;
+    int active = state->active;
 
-    struct node node;
-    node.qgames = 10;
-    node.score = 0;
+    for (;;) {
+        if (max_steps-- == 0) {
+            return 0;
+        }
 
-    node.children[NORTH] = 1; /*       1.55985508 */
-    node.children[EAST]  = 2; /* BEST  1.56219899 */
-    node.children[SOUTH] = 3; /*       1.55005966 */
-    node.children[WEST]  = 4; /*       1.53394851 */
+        const steps_t ball_lines = lines[ball];
+        const steps_t answers = ball_lines ^ 0xFF;
+        if (answers == 0) {
+            return active != 1 ? +1 : -1;
+        }
 
-    me->C = 1.4;
+        const int qanswers = step_count(answers);
+        const int index = qanswers == 1 ? 0 : rand() % qanswers;
+        const enum step step = reference_steps[answers][index];
+        const int next = connections[QSTEPS*ball + step];
 
-    me->nodes[1].qgames = 3;
-    me->nodes[2].qgames = 4;
-    me->nodes[3].qgames = 5;
-    me->nodes[4].qgames = 6;
+        if (next == GOAL_1) {
+            return +1;
+        }
 
-    me->nodes[1].score = 1;
-    me->nodes[2].score = 2;
-    me->nodes[3].score = 3;
-    me->nodes[4].score = 4;
+        if (next == GOAL_2) {
+            return -1;
+        }
 
-    steps_t steps = (1 << NORTH) | (1 << EAST) | (1 << SOUTH) | (1 << WEST);
-    const enum step choice = select_step(me, &node, steps);
+        lines[ball] |= (1 << step);
+        lines[next] |= (1 << BACK(step));
+        ball = next;
+        ++*qthink;
 
-    if (choice != EAST) {
-        test_fail("Unexpected choice %d, expected EAST (%d).", choice, EAST);
+        if (ball_lines == 0) {
+            active ^= 3;
+        }
     }
+}
 
-    struct node * restrict const root = alloc_node(me);
-    if (root == NULL) {
-        test_fail("alloc_node failed with NULL as a return value for root node.");
+/* Rollouts per second of the branchy baseline kernel and of rollout() */
+int bench_rollout_kernel(void)
+{
+    struct geometry * restrict const geometry = create_std_geometry(BENCH_BW, BENCH_BH, BENCH_GW);
+    if (geometry == NULL) {
+        bench_fail("create_std_geometry failed, errno is %d.", errno);
     }
-    root->qgames = 1;
 
-    for (enum step step=0; step<QSTEPS; ++step) {
-        struct node * restrict const child = alloc_node(me);
-        if (child == NULL) {
-            test_fail("alloc_node failed with NULL as a return value for child node on step %d.", step);
-        }
-        child->qgames = 1;
-        child->score = 2;
-        root->children[step] = child - me->nodes;
+    struct mcts_ai * restrict const me = create_mcts_ai(geometry);
+    struct state * restrict const state = create_state(geometry);
+    struct state * restrict const base = create_state(geometry);
+    if (me == NULL || state == NULL || base == NULL) {
+        bench_fail("bad alloc.");
     }
 
-    steps_t visited = 0;
-    for (enum step step=0; step<QSTEPS; ++step) {
-        const enum step choice = select_step(me, root, 0xFF);
-        visited |= 1 << choice;
-        struct node * restrict const child = me->nodes + root->children[choice];
-        child->qgames = 1;
-        child->score = (rand() % 3) - 1;
-        ++root->qgames;
-    }
+    me->policy = POLICY_UNIFORM;
+    me->adjudicate = 0;
+    me->reach = 0;
+    me->is_default_board = 0;
+    me->simd = SIMD_GENERIC;
 
-    if (visited != 0xFF) {
-        test_fail("Some directions are visitied twice, visited mask is 0x%02X.", visited);
+    printf("%10s %12s %10s %10s\n", "kernel", "rollouts/s", "avg len", "score");
+
+    for (int kernel = 0; kernel < 2; ++kernel) {
+        uint32_t qthink = 0;
+        double score = 0;
+        const double start = clock();
+        for (int i=0; i<BENCH_QROLLOUTS; ++i) {
+            state_copy(state, base);
+            score += kernel == 0
+                ? reference_rollout(state, BENCH_BW * BENCH_BH * QSTEPS, &qthink)
+                : rollout(me, state, BENCH_BW * BENCH_BH * QSTEPS, &qthink);
+        }
+        const double finish = clock();
+        const double elapsed = (finish - start) / CLOCKS_PER_SEC;
+
+        printf("%10s %12.0f %10.2f %10.4f\n",
+            kernel == 0 ? "reference" : "rollout",
+            BENCH_QROLLOUTS / elapsed,
+            (double)qthink / BENCH_QROLLOUTS,
+            score / BENCH_QROLLOUTS);
     }
 
-    ai->free(ai);
+    destroy_state(base);
+    destroy_state(state);
+    free_ai(me);
     destroy_geometry(geometry);
     return 0;
 }
 
-#define QSIMULATIONS  1000
-
-int test_simulation(void)
+/* Rollouts per second of every SIMD variant supported by CPU */
+int bench_simd_rollouts(void)
 {
-    struct geometry * restrict const geometry = create_std_geometry(BW, BH, GW);
+    struct geometry * restrict const geometry = create_std_geometry(BENCH_BW, BENCH_BH, BENCH_GW);
     if (geometry == NULL) {
-        test_fail("create_std_geometry(%d, %d, %d) fails, return value is NULL, errno is %d.",
-            BW, BH, GW, errno);
+        bench_fail("create_std_geometry failed, errno is %d.", errno);
     }
 
-    struct ai storage;
-    struct ai * restrict const ai = &storage;
-    init_mcts_ai(ai, geometry);
-    const uint32_t cache = 2 * QSIMULATIONS * sizeof(struct node);
-    ai->set_param(ai, "cache", &cache);
-
-    struct mcts_ai * restrict const me = ai->data;
-    init_cache(me);
-
-    struct node * restrict const zero = alloc_node(me);
-    if (zero == NULL) {
-        test_fail("alloc zero node failed.");
+    struct mcts_ai * restrict const me = create_mcts_ai(geometry);
+    struct state * restrict const state = create_state(geometry);
+    struct state * restrict const base = create_state(geometry);
+    if (me == NULL || state == NULL || base == NULL) {
+        bench_fail("bad alloc.");
     }
-    zero->score = 2;
-    zero->qgames = 1;
 
-    struct node * restrict const root = alloc_node(me);
-    if (zero == NULL) {
-        test_fail("alloc root node failed.");
-    }
+    printf("%10s %12s\n", "variant", "rollouts/s");
 
-    root->qgames = 1;
-    for (int i=0; i<QSIMULATIONS; ++i) {
-        simulate(me, root);
-        ++root->qgames;
-    }
+    for (enum simd_variant simd = SIMD_GENERIC; simd <= simd_variant(); ++simd) {
+        me->simd = simd;
 
-    if (root->qgames != QSIMULATIONS + 1) {
-        test_fail("root->qgames = %u, but %u expected.", root->qgames, QSIMULATIONS);
+        uint32_t qthink = 0;
+        const double start = clock();
+        for (int i=0; i<BENCH_QROLLOUTS; ++i) {
+            state_copy(state, base);
+            rollout(me, state, BENCH_BW * BENCH_BH * QSTEPS, &qthink);
+        }
+        const double finish = clock();
+        const double elapsed = (finish - start) / CLOCKS_PER_SEC;
+
+        printf("%10s %12.0f\n", simd_names[simd], BENCH_QROLLOUTS / elapsed);
     }
 
-    ai->free(ai);
+    destroy_state(base);
+    destroy_state(state);
+    free_ai(me);
     destroy_geometry(geometry);
     return 0;
 }
 
-int test_mcts_ai_unstep(void)
+/* Rollouts per second of single rollouts and interleaved batches of lanes */
+int bench_batch_rollouts(void)
 {
-    int status;
-
-    struct geometry * restrict const geometry = create_std_geometry(BW, BH, GW);
+    struct geometry * restrict const geometry = create_std_geometry(BENCH_BW, BENCH_BH, BENCH_GW);
     if (geometry == NULL) {
-        test_fail("create_std_geometry(%d, %d, %d) fails, return value is NULL, errno is %d.",
-            BW, BH, GW, errno);
+        bench_fail("create_std_geometry failed, errno is %d.", errno);
     }
 
-    struct ai storage;
-    struct ai * restrict const ai = &storage;
+    struct mcts_ai * restrict const me = create_mcts_ai(geometry);
+    struct state * restrict const state = create_state(geometry);
+    struct state * restrict const base = create_state(geometry);
+    if (me == NULL || state == NULL || base == NULL) {
+        bench_fail("bad alloc.");
+    }
 
-    init_mcts_ai(ai, geometry);
+    printf("%10s %12s\n", "batch", "rollouts/s");
 
-    const uint32_t qthink = 16 * 1024;
-    status = ai->set_param(ai, "qthink", &qthink);
-    if (status != 0) {
-        test_fail("ai->set_param fails with code %d, %s.", status, ai->error);
+    uint32_t qthink = 0;
+    double start = clock();
+    for (int i=0; i<BENCH_QROLLOUTS; ++i) {
+        state_copy(state, base);
+        rollout(me, state, BENCH_BW * BENCH_BH * QSTEPS, &qthink);
+    }
+    double finish = clock();
+    double elapsed = (finish - start) / CLOCKS_PER_SEC;
+    printf("%10s %12.0f\n", "single", BENCH_QROLLOUTS / elapsed);
+
+    float scores[MAX_BATCH];
+    const uint32_t batches[4] = { 1, 8, 16, 32 };
+    for (int b=0; b<4; ++b) {
+        const uint32_t qlanes = batches[b];
+        const int qbatches = BENCH_QROLLOUTS / qlanes;
+        start = clock();
+        for (int i=0; i<qbatches; ++i) {
+            rollout_batch(me, base, qlanes, BENCH_BW * BENCH_BH * QSTEPS, &qthink, scores);
+        }
+        finish = clock();
+        elapsed = (finish - start) / CLOCKS_PER_SEC;
+        printf("%10u %12.0f\n", qlanes, qbatches * qlanes / elapsed);
     }
 
-    const uint32_t cache = 2 * qthink;
-    status = ai->set_param(ai, "cache", &cache);
-    if (status != 0) {
-        test_fail("ai->set_param fails with code %d, %s.", status, ai->error);
+    destroy_state(base);
+    destroy_state(state);
+    free_ai(me);
+    destroy_geometry(geometry);
+    return 0;
+}
+
+/* Rollouts per second and search time of generic and baked loops on the default board */
+int bench_default_board(void)
+{
+    struct geometry * restrict const geometry = create_std_geometry(BENCH_BW, BENCH_BH, BENCH_GW);
+    if (geometry == NULL) {
+        bench_fail("create_std_geometry failed, errno is %d.", errno);
     }
 
-    const struct state * const state = ai->get_state(ai);
-    while (state_status(state) == IN_PROGRESS) {
-        const enum step step = ai->go(ai, NULL);
-        ai->do_step(ai, step);
+    struct mcts_ai * restrict const me = create_mcts_ai(geometry);
+    struct state * restrict const state = create_state(geometry);
+    struct state * restrict const base = create_state(geometry);
+    if (me == NULL || state == NULL || base == NULL) {
+        bench_fail("bad alloc.");
     }
 
-    status = ai->undo_steps(ai, ai->history.qsteps);
-    if (status != 0) {
-        test_fail("undo steps failed, status %d, error: %s", status, ai->error);
+    if (!me->is_default_board) {
+        bench_fail("default board is not recognized.");
     }
 
-    struct state * restrict const check_state = create_state(geometry);
+    printf("%10s %12s %12s\n", "loops", "rollouts/s", "go time");
 
-    if (state->active != check_state->active) {
-        test_fail("All undo: active expected %d, but value is %d.", check_state->active, state->active);
-    }
+    const char * const names[2] = { "generic", "baked" };
+    for (int baked = 0; baked < 2; ++baked) {
+        me->is_default_board = baked;
 
-    if (state->ball != check_state->ball) {
-        test_fail("All undo: ball expected %d, but value is %d.", check_state->ball, state->ball);
-    }
+        uint32_t qthink = 0;
+        const double start = clock();
+        for (int i=0; i<BENCH_QROLLOUTS; ++i) {
+            state_copy(state, base);
+            rollout(me, state, BENCH_BW * BENCH_BH * QSTEPS, &qthink);
+        }
+        const double finish = clock();
+        const double elapsed = (finish - start) / CLOCKS_PER_SEC;
 
-    if (memcmp(state->lines, check_state->lines, geometry->qpoints) != 0) {
-        test_fail("All undo: lines mismatch.");
-    }
+        me->qthink = 50 * BENCH_QTHINK;
+        struct ai_explanation explanation;
+        if (ai_go(me, &explanation) == INVALID_STEP) {
+            bench_fail("ai_go failed: %s", me->error_buf);
+        }
 
-    ai->free(ai);
-    destroy_state(check_state);
+        printf("%10s %12.0f %11.3fs\n", names[baked], BENCH_QROLLOUTS / elapsed, explanation.time);
+    }
 
+    destroy_state(base);
+    destroy_state(state);
+    free_ai(me);
     destroy_geometry(geometry);
     return 0;
 }
@@ -11,6 +11,11 @@ struct random_ai
     struct state * backup;
     char * error_buf;
     struct step_stat * stats;
+    uint64_t rng;
+
+    /* Sliced search: the step is chosen at once in go_begin */
+    enum step search_choice;
+    struct ai_explanation search_explanation;
 };
 
 static const struct ai_param terminator = { NULL, NULL, NO_TYPE, 0 };
@@ -47,11 +52,14 @@ struct random_ai * create_random_ai(const struct geometry * const geometry)
     me->backup = backup;
     me->error_buf = error_buf;
     me->stats = stats;
+    me->rng = 0x9E3779B97F4A7C15ULL;
+    me->search_choice = INVALID_STEP;
 
     state->geometry = geometry;
     state->lines = lines;
     state->active = 1;
     state->ball = qpoints / 2;
+    state->ball_before_goal = NO_WAY;
 
     backup->geometry = geometry;
     backup->lines = backup_lines;
@@ -60,6 +68,17 @@ struct random_ai * create_random_ai(const struct geometry * const geometry)
     return me;
 }
 
+/* Own xorshift64* state instead of libc rand(), engines may run in parallel threads */
+static uint32_t random_ai_random(struct random_ai * restrict const me)
+{
+    uint64_t x = me->rng;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    me->rng = x;
+    return (x * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
 void free_random_ai(struct ai * restrict const ai)
 {
     free_history(&ai->history);
@@ -71,15 +90,25 @@ int random_ai_reset(
     const struct geometry * const geometry)
 {
     ai->error = NULL;
+    ai->history.qsteps = 0;
+
+    struct random_ai * restrict const old = ai->data;
+    if (old->state->geometry == geometry) {
+        struct state * restrict const state = old->state;
+        init_lines(geometry, state->lines);
+        state->active = 1;
+        state->ball = geometry->qpoints / 2;
+        state->ball_before_goal = NO_WAY;
+        return 0;
+    }
 
     struct random_ai * restrict const me = create_random_ai(geometry);
     if (me == NULL) {
-        snprintf(me->error_buf, ERROR_BUF_SZ, "Bad alloc for create_random_ai.");
-        ai->error = me->error_buf;
+        ai->error = "Bad alloc for create_random_ai.";
         return errno;
     }
 
-    free_random_ai(ai);
+    free(ai->data);
     ai->data = me;
     return 0;
 }
@@ -207,6 +236,49 @@ int random_ai_undo_steps(
     return 0;
 }
 
+int random_ai_snapshot(
+    const struct ai * const ai,
+    struct ai_snapshot * restrict const snapshot)
+{
+    const struct random_ai * const me = ai->data;
+    return ai_snapshot_save(snapshot, me->state, &ai->history);
+}
+
+int random_ai_restore(
+    struct ai * restrict const ai,
+    const struct ai_snapshot * const snapshot)
+{
+    ai->error = NULL;
+    struct random_ai * restrict const me = ai->data;
+
+    const int status = ai_snapshot_load(snapshot, me->state, &ai->history);
+    if (status != 0) {
+        snprintf(me->error_buf, ERROR_BUF_SZ, "Cannot restore snapshot, status is %d.", status);
+        ai->error = me->error_buf;
+    }
+
+    return status;
+}
+
+int random_ai_set_state(
+    struct ai * restrict const ai,
+    const struct state * const state)
+{
+    ai->error = NULL;
+    struct random_ai * restrict const me = ai->data;
+
+    const int status = state_copy(me->state, state);
+    if (status != 0) {
+        snprintf(me->error_buf, ERROR_BUF_SZ, "Position is for another board.");
+        ai->error = me->error_buf;
+        return status;
+    }
+
+    me->state->ball_before_goal = state->ball_before_goal;
+    ai->history.qsteps = 0;
+    return 0;
+}
+
 enum step random_ai_go(
     struct ai * restrict const ai,
     struct ai_explanation * restrict const explanation)
@@ -244,13 +316,17 @@ enum step random_ai_go(
         }
     }
 
-    const int choice =  qalternatives > 1 ? rand() % qalternatives : 0;
+    const int choice =  qalternatives > 1 ? random_ai_random(me) % qalternatives : 0;
     enum step result = alternatives[choice];
 
     if (explanation) {
         double finish = clock();
         explanation->time = (finish - start) / CLOCKS_PER_SEC;
         explanation->score = 0.5;
+        explanation->qplayouts = 0;
+        explanation->qnodes = 0;
+        explanation->qvariations = 0;
+        explanation->variations = NULL;
         const size_t qstats = stats - me->stats;
         explanation->qstats = qstats > 1 ? qstats : 0;
         explanation->stats = qstats > 1 ? me->stats : NULL;
@@ -259,11 +335,90 @@ enum step random_ai_go(
     return result;
 }
 
+void random_ai_stop(struct ai * restrict const ai, const int is_stopped)
+{
+    /* Random AI never thinks */
+}
+
+void random_ai_set_book(struct ai * restrict const ai, const struct book * const book)
+{
+    /* Random AI plays random steps even in the opening */
+}
+
+int random_ai_save_tree(struct ai * restrict const ai, const char * const path)
+{
+    ai->error = "Random AI has no search tree.";
+    return ENOTSUP;
+}
+
+int random_ai_load_tree(struct ai * restrict const ai, const char * const path)
+{
+    ai->error = "Random AI has no search tree.";
+    return ENOTSUP;
+}
+
+int random_ai_go_begin(struct ai * restrict const ai)
+{
+    struct random_ai * restrict const me = ai->data;
+    me->search_choice = random_ai_go(ai, &me->search_explanation);
+    if (me->search_choice == INVALID_STEP) {
+        ai->error = "No possible steps.";
+        return EINVAL;
+    }
+    return 0;
+}
+
+int random_ai_go_continue(struct ai * restrict const ai, const uint32_t budget)
+{
+    return 1;
+}
+
+enum step random_ai_go_peek(
+    struct ai * restrict const ai,
+    struct ai_explanation * restrict const explanation)
+{
+    const struct random_ai * const me = ai->data;
+    if (explanation) {
+        *explanation = me->search_explanation;
+    }
+    return me->search_choice;
+}
+
+enum step random_ai_go_end(
+    struct ai * restrict const ai,
+    struct ai_explanation * restrict const explanation)
+{
+    struct random_ai * restrict const me = ai->data;
+    const enum step result = random_ai_go_peek(ai, explanation);
+    me->search_choice = INVALID_STEP;
+    return result;
+}
+
+enum step random_ai_analyze(
+    struct ai * restrict const ai,
+    const double interval,
+    ai_report_func report,
+    void * const arg)
+{
+    /* Nothing to analyze, the move is reported at once */
+    struct ai_explanation explanation;
+    const enum step result = random_ai_go(ai, &explanation);
+    if (result != INVALID_STEP) {
+        report(arg, &explanation);
+    }
+    return result;
+}
+
 const struct ai_param * random_ai_get_params(const struct ai * const ai)
 {
     return &terminator;
 }
 
+const struct ai_param * random_ai_get_stats(const struct ai * const ai)
+{
+    return &terminator;
+}
+
 int random_ai_set_param(
     struct ai * restrict const ai,
     const char * const name,
@@ -297,10 +452,23 @@ int init_random_ai(
     ai->do_steps = random_ai_do_steps;
     ai->undo_step = random_ai_undo_step;
     ai->undo_steps = random_ai_undo_steps;
+    ai->snapshot = random_ai_snapshot;
+    ai->restore = random_ai_restore;
+    ai->set_state = random_ai_set_state;
     ai->go = random_ai_go;
+    ai->stop = random_ai_stop;
+    ai->set_book = random_ai_set_book;
+    ai->save_tree = random_ai_save_tree;
+    ai->load_tree = random_ai_load_tree;
+    ai->go_begin = random_ai_go_begin;
+    ai->go_continue = random_ai_go_continue;
+    ai->go_peek = random_ai_go_peek;
+    ai->go_end = random_ai_go_end;
+    ai->analyze = random_ai_analyze;
     ai->get_params = random_ai_get_params;
     ai->set_param = random_ai_set_param;
     ai->get_state = random_ai_get_state;
+    ai->get_stats = random_ai_get_stats;
     ai->free = free_random_ai;
 
     return 0;
@@ -0,0 +1,93 @@
+#include "bench.h"
+#include "paper-football.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+const char * bench_name = "";
+
+void bench_fail(const char * const fmt, ...)
+{
+    fprintf(stderr, "Benchmark `%s' fails: ", bench_name);
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+
+
+/* Run/list benchmarks */
+
+typedef int (* bench_function)(void);
+
+struct bench_item
+{
+    const char * name;
+    bench_function function;
+};
+
+const struct bench_item benchmarks[] = {
+    { "rollout-policies", &bench_rollout_policies },
+    { "reachability", &bench_reachability },
+    { "default-board", &bench_default_board },
+    { "simd-rollouts", &bench_simd_rollouts },
+    { "batch-rollouts", &bench_batch_rollouts },
+    { "rollout-kernel", &bench_rollout_kernel },
+    { NULL, NULL }
+};
+
+void print_benchmarks(void)
+{
+    const struct bench_item * current = benchmarks;
+    for (; current->name != NULL; ++current) {
+        printf("%s\n", current->name);
+    }
+}
+
+void run_bench_item(const struct bench_item * const item)
+{
+    bench_name = item->name;
+    printf("Run benchmark %s:\n", item->name);
+    const int exit_code = (*item->function)();
+    if (exit_code) {
+        exit(exit_code);
+    }
+}
+
+void run_bench(const char * const name)
+{
+    const struct bench_item * current = benchmarks;
+    for (; current->name != NULL; ++current) {
+        if (strcmp(name, "all") == 0 || strcmp(name, current->name) == 0) {
+            run_bench_item(current);
+            if (strcmp(name, "all") != 0) {
+                return;
+            }
+        }
+    }
+
+    if (strcmp(name, "all") != 0) {
+        fprintf(stderr, "Benchmark “%s” is not found.\n", name);
+        exit(1);
+    }
+}
+
+int main(const int argc, const char * const argv[])
+{
+    if (argc == 1) {
+        print_benchmarks();
+        return 0;
+    }
+
+    for (size_t i=1; i<argc; ++i) {
+        run_bench(argv[i]);
+    }
+
+    return 0;
+}
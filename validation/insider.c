@@ -9,6 +9,38 @@
 
 const char * test_name = "";
 
+
+
+/* Allocator hooks, insider is linked with --wrap for every allocation function */
+
+unsigned int qallocs = 0;
+
+void * __real_malloc(size_t size);
+void * __real_calloc(size_t nmemb, size_t size);
+void * __real_realloc(void * ptr, size_t size);
+
+void * __wrap_malloc(size_t size)
+{
+    __atomic_fetch_add(&qallocs, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void * __wrap_calloc(size_t nmemb, size_t size)
+{
+    __atomic_fetch_add(&qallocs, 1, __ATOMIC_RELAXED);
+    return __real_calloc(nmemb, size);
+}
+
+void * __wrap_realloc(void * ptr, size_t size)
+{
+    __atomic_fetch_add(&qallocs, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+
+
+/* Test utils */
+
 void fail(void)
 {
     fprintf(stderr, "\n");
@@ -52,10 +84,21 @@ const struct test_item tests[] = {
     { "parser", &test_parser },
     { "std-geometry", &test_std_geometry },
     { "hockey-geometry", &test_hockey_geometry },
+    { "geometry-tables", &test_geometry_tables },
+    { "symmetry", &test_symmetry },
+    { "reachability", &test_reachability },
+    { "position", &test_position },
     { "step", &test_step },
     { "history", &test_history },
     { "random-ai", &test_random_ai },
     { "rollout", &test_rollout },
+    { "adjudication", &test_adjudication },
+    { "evaluation", &test_evaluation },
+    { "rollout-policies", &test_rollout_policies },
+    { "default-board", &test_default_board },
+    { "simd-rollouts", &test_simd_rollouts },
+    { "batch-rollouts", &test_batch_rollouts },
+    { "zero-alloc-go", &test_zero_alloc_go },
     { "node-cache", &test_node_cache },
     { "mcts-history", &test_mcts_history },
     { "ucb-formula", &test_ucb_formula },
@@ -63,6 +106,15 @@ const struct test_item tests[] = {
     { "unstep", &test_unstep },
     { "random-ai-unstep", &test_random_ai_unstep},
     { "mcts-ai-unstep", &test_mcts_ai_unstep},
+    { "ai-snapshot", &test_ai_snapshot },
+    { "threads", &test_threads },
+    { "ai-stop", &test_ai_stop },
+    { "ai-analyze", &test_ai_analyze },
+    { "ai-pv", &test_ai_pv },
+    { "go-slices", &test_go_slices },
+    { "book", &test_book },
+    { "tree-file", &test_tree_file },
+    { "memo", &test_memo },
     { NULL, NULL }
 };
 